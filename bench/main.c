@@ -0,0 +1,177 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Times add, lookup and remove phases over the tree test interfaces, reporting
+  hardware counters per operation where the host allows them to be read.
+
+  usage: lbtree_bench [key_size [max_entries]]
+*/
+
+#include "./everand/everand.h"
+#include "lbtree_d_test.h"
+#include "lbtree_da_test.h"
+#include "lbtree_test.h"
+#include "perf_counters.h"
+#include "tsearch_test.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SEED (16)
+#define MIN_ENTRIES (1 << 10)
+#define MAX_ENTRIES (1 << 20)
+#define KEY_SIZE (8)
+
+struct bench_tree {
+  const char *name;
+  const struct tree_test_iface *iface;
+};
+
+static const struct bench_tree bench_trees[] = {
+    {"lbtree", &lbtree_test_iface},
+    {"lbtree_d", &lbtree_d_test_iface},
+    {"lbtree_da", &lbtree_da_test_iface},
+    {"tsearch", &tsearch_test_iface}};
+
+struct bench_state {
+  const struct tree_test_iface *iface;
+  void *tree;
+  void **nodes;
+  size_t size;
+};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static void bench_add(struct bench_state *state) {
+  const struct tree_test_iface *iface = state->iface;
+  size_t i;
+  for (i = 0; i < state->size; ++i) {
+    void *repl = iface->add(&state->tree, state->nodes[i]);
+    if (repl != 0) {
+      /* duplicate random key, keep it out of the remove phase */
+      iface->node_tt(repl)->active = 0;
+    }
+    iface->node_tt(state->nodes[i])->active = 1;
+  }
+}
+
+static void bench_lookup(struct bench_state *state) {
+  const struct tree_test_iface *iface = state->iface;
+  size_t missing = 0;
+  size_t i;
+  for (i = 0; i < state->size; ++i) {
+    missing += (iface->lookup(state->tree, iface->node_tt(state->nodes[i])) ==
+                0)
+                   ? 1
+                   : 0;
+  }
+  if (missing != 0) {
+    fprintf(stderr, "lookup failed for %zu keys\n", missing);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void bench_rm(struct bench_state *state) {
+  const struct tree_test_iface *iface = state->iface;
+  size_t i;
+  for (i = 0; i < state->size; ++i) {
+    void *node = state->nodes[i];
+    if (iface->node_tt(node)->active != 0) {
+      iface->rm(&state->tree, node);
+    }
+  }
+}
+
+static void report(const char *name, size_t size, const char *phase,
+                   double ns, struct perf_counters *pc) {
+  printf("%-10s %9zu %-7s %9.1f", name, size, phase, ns / size);
+  unsigned int i;
+  for (i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    if (pc->valid[i] != 0) {
+      printf(" %10.2f", (double)pc->values[i] / size);
+    } else {
+      printf(" %10s", "-");
+    }
+  }
+  printf("\n");
+}
+
+static void measure(const char *name, const char *phase,
+                    void (*run)(struct bench_state *state),
+                    struct bench_state *state, struct perf_counters *pc) {
+  double start = now_ns();
+  perf_counters_start(pc);
+  run(state);
+  perf_counters_stop(pc);
+  report(name, state->size, phase, now_ns() - start, pc);
+}
+
+static void bench(const struct bench_tree *bt, size_t size, size_t key_size,
+                  struct perf_counters *pc) {
+  const struct tree_test_iface *iface = bt->iface;
+  struct bench_state state = {.iface = iface,
+                              .tree = iface->init(),
+                              .nodes = iface->nodes_new(size, key_size),
+                              .size = size};
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    struct tree_test *tt = iface->node_tt(state.nodes[i]);
+    tt->id = i;
+    tt->active = 0;
+    tt->key.size = key_size;
+    everand_arr(tt->key.buf, key_size);
+  }
+
+  measure(bt->name, "add", &bench_add, &state, pc);
+  measure(bt->name, "lookup", &bench_lookup, &state, pc);
+  measure(bt->name, "rm", &bench_rm, &state, pc);
+
+  iface->del(state.tree);
+  iface->nodes_del(state.nodes);
+}
+
+int main(int argc, char *argv[]) {
+  size_t key_size = (argc > 1) ? strtoul(argv[1], 0, 0) : KEY_SIZE;
+  size_t max_entries = (argc > 2) ? strtoul(argv[2], 0, 0) : MAX_ENTRIES;
+
+  struct perf_counters pc;
+  if (perf_counters_open(&pc) != PERF_COUNTER_COUNT) {
+    fprintf(stderr, "some hardware counters are unavailable, reported as "
+                    "\"-\"\n");
+  }
+
+  printf("%-10s %9s %-7s %9s", "tree", "entries", "phase", "ns/op");
+  unsigned int i;
+  for (i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    printf(" %10s", perf_counter_names[i]);
+  }
+  printf("\n");
+
+  everand_seed(SEED);
+  size_t size;
+  for (size = MIN_ENTRIES; size <= max_entries; size *= 4) {
+    for (i = 0; i < (sizeof(bench_trees) / sizeof(*bench_trees)); ++i) {
+      bench(&bench_trees[i], size, key_size, &pc);
+    }
+  }
+
+  perf_counters_close(&pc);
+  return 0;
+}
@@ -0,0 +1,162 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Times add, lookup, iterate and remove phases of `lbtree_cpp::map` against
+  `std::map` and `std::unordered_map` with 64 bit keys, reporting hardware
+  counters per operation as lbtree_bench does.
+
+  usage: lbtree_map_bench [max_entries]
+*/
+
+extern "C" {
+#include "perf_counters.h"
+}
+#include "lbtree.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory_resource>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#define SEED (16)
+#define MIN_ENTRIES (1 << 10)
+#define MAX_ENTRIES (1 << 20)
+
+namespace {
+
+using key_type = std::uint64_t;
+
+double now_ns() {
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void report(const char *name, std::size_t size, const char *phase, double ns,
+            const perf_counters &pc) {
+  std::printf("%-15s %9zu %-7s %9.1f", name, size, phase, ns / size);
+  for (unsigned int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    if (pc.valid[i] != 0) {
+      std::printf(" %10.2f", static_cast<double>(pc.values[i]) / size);
+    } else {
+      std::printf(" %10s", "-");
+    }
+  }
+  std::printf("\n");
+}
+
+template <class F>
+void measure(const char *name, const char *phase, std::size_t size,
+             perf_counters &pc, F run) {
+  double start = now_ns();
+  perf_counters_start(&pc);
+  run();
+  perf_counters_stop(&pc);
+  report(name, size, phase, now_ns() - start, pc);
+}
+
+/* `keys` are inserted in order, looked up and removed in the order of
+  `shuffled`, so that the later phases do not follow the allocation order. */
+template <class Map>
+void bench(const char *name, Map &m, const std::vector<key_type> &keys,
+           const std::vector<key_type> &shuffled, perf_counters &pc) {
+  std::size_t size = keys.size();
+  measure(name, "add", size, pc, [&] {
+    for (key_type k : keys) {
+      m.try_emplace(k, k);
+    }
+  });
+  measure(name, "lookup", size, pc, [&] {
+    std::size_t missing = 0;
+    for (key_type k : shuffled) {
+      missing += (m.find(k) == m.end()) ? 1 : 0;
+    }
+    if (missing != 0) {
+      std::fprintf(stderr, "lookup failed for %zu keys\n", missing);
+      std::exit(EXIT_FAILURE);
+    }
+  });
+  measure(name, "iterate", size, pc, [&] {
+    key_type sum = 0;
+    for (const auto &kv : m) {
+      sum += kv.second;
+    }
+    // keeps the loop from being removed
+    if (sum == 1) {
+      std::printf("\n");
+    }
+  });
+  measure(name, "rm", size, pc, [&] {
+    for (key_type k : shuffled) {
+      m.erase(k);
+    }
+  });
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::size_t max_entries =
+      (argc > 1) ? std::strtoul(argv[1], 0, 0) : MAX_ENTRIES;
+
+  perf_counters pc;
+  if (perf_counters_open(&pc) != PERF_COUNTER_COUNT) {
+    std::fprintf(stderr, "some hardware counters are unavailable, reported "
+                         "as \"-\"\n");
+  }
+
+  std::printf("%-15s %9s %-7s %9s", "map", "entries", "phase", "ns/op");
+  for (unsigned int i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    std::printf(" %10s", perf_counter_names[i]);
+  }
+  std::printf("\n");
+
+  std::mt19937_64 rng(SEED);
+  for (std::size_t size = MIN_ENTRIES; size <= max_entries; size *= 4) {
+    std::vector<key_type> keys(size);
+    for (key_type &k : keys) {
+      k = rng();
+    }
+    std::vector<key_type> shuffled(keys);
+    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+
+    {
+      lbtree_cpp::map<key_type, key_type> m;
+      bench("lbtree_cpp", m, keys, shuffled, pc);
+    }
+    {
+      std::pmr::unsynchronized_pool_resource pool;
+      lbtree_cpp::map<key_type, key_type> m(&pool);
+      bench("lbtree_cpp_pool", m, keys, shuffled, pc);
+    }
+    {
+      std::map<key_type, key_type> m;
+      bench("std::map", m, keys, shuffled, pc);
+    }
+    {
+      std::unordered_map<key_type, key_type> m;
+      bench("unordered_map", m, keys, shuffled, pc);
+    }
+  }
+
+  perf_counters_close(&pc);
+  return 0;
+}
@@ -0,0 +1,133 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perf_counters.h"
+
+#include <string.h>
+
+const char *const perf_counter_names[PERF_COUNTER_COUNT] = {
+    "cycles",   "instr",     "l1d-miss",
+    "llc-miss", "dtlb-miss", "br-miss"};
+
+#ifdef __linux__
+
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define HW_CACHE_READ_MISS(cache)                                              \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |                              \
+   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+} events[PERF_COUNTER_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HW_CACHE, HW_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}};
+
+static int event_open(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+unsigned int perf_counters_open(struct perf_counters *pc) {
+  unsigned int opened = 0;
+  unsigned int i;
+  for (i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    pc->fds[i] = event_open(events[i].type, events[i].config);
+    pc->valid[i] = 0;
+    if (pc->fds[i] >= 0) {
+      ++opened;
+    }
+  }
+  return opened;
+}
+
+void perf_counters_start(struct perf_counters *pc) {
+  unsigned int i;
+  for (i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    if (pc->fds[i] >= 0) {
+      ioctl(pc->fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(pc->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+void perf_counters_stop(struct perf_counters *pc) {
+  unsigned int i;
+  for (i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    if (pc->fds[i] >= 0) {
+      ioctl(pc->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+  for (i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    /* value, time enabled, time running */
+    uint64_t buf[3];
+    pc->valid[i] = 0;
+    if ((pc->fds[i] < 0) ||
+        (read(pc->fds[i], buf, sizeof(buf)) != sizeof(buf)) || (buf[2] == 0)) {
+      continue;
+    }
+    pc->values[i] = (buf[2] < buf[1])
+                        ? (uint64_t)((double)buf[0] * buf[1] / buf[2])
+                        : buf[0];
+    pc->valid[i] = 1;
+  }
+}
+
+void perf_counters_close(struct perf_counters *pc) {
+  unsigned int i;
+  for (i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    if (pc->fds[i] >= 0) {
+      close(pc->fds[i]);
+      pc->fds[i] = -1;
+    }
+  }
+}
+
+#else
+
+unsigned int perf_counters_open(struct perf_counters *pc) {
+  unsigned int i;
+  for (i = 0; i < PERF_COUNTER_COUNT; ++i) {
+    pc->fds[i] = -1;
+    pc->valid[i] = 0;
+  }
+  return 0;
+}
+
+void perf_counters_start(struct perf_counters *pc) { (void)pc; }
+
+void perf_counters_stop(struct perf_counters *pc) { (void)pc; }
+
+void perf_counters_close(struct perf_counters *pc) { (void)pc; }
+
+#endif
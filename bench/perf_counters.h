@@ -0,0 +1,56 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+enum perf_counter_id {
+  PERF_COUNTER_CYCLES,
+  PERF_COUNTER_INSTRUCTIONS,
+  PERF_COUNTER_L1D_MISSES,
+  PERF_COUNTER_LLC_MISSES,
+  PERF_COUNTER_DTLB_MISSES,
+  PERF_COUNTER_BRANCH_MISSES,
+  PERF_COUNTER_COUNT
+};
+
+struct perf_counters {
+  int fds[PERF_COUNTER_COUNT];
+  unsigned long long int values[PERF_COUNTER_COUNT];
+  /* non-zero where the matching entry in `values` was counted during the last
+    measured phase */
+  unsigned char valid[PERF_COUNTER_COUNT];
+};
+
+extern const char *const perf_counter_names[PERF_COUNTER_COUNT];
+
+/* Opens each hardware counter for the calling thread. Counters that cannot be
+  opened (no PMU, containers, `perf_event_paranoid`, non-Linux hosts) are left
+  closed and are never reported as valid. Returns the number of counters
+  opened.
+*/
+unsigned int perf_counters_open(struct perf_counters *pc);
+
+/* Resets and enables all open counters. */
+void perf_counters_start(struct perf_counters *pc);
+
+/* Disables all open counters and stores their values, scaled for any time the
+  kernel spent multiplexing them out.
+*/
+void perf_counters_stop(struct perf_counters *pc);
+
+void perf_counters_close(struct perf_counters *pc);
+
+#endif
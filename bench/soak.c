@@ -0,0 +1,208 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Churns an lbtree_d at a steady live-set size, replacing random entries with
+  freshly allocated keys and values, and periodically emits a CSV time series
+  of resident set size, allocator statistics and lookup latency so that
+  fragmentation and latency drift can be compared across allocators (for
+  example by running the same binary under different `LD_PRELOAD`s).
+
+  usage: lbtree_soak [seconds [live_entries [sample_seconds]]]
+*/
+
+#include "../lbtree_d.h"
+#include "./everand/everand.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define SEED (16)
+#define DURATION_S (60)
+#define LIVE_ENTRIES (1 << 18)
+#define SAMPLE_S (1)
+#define MIN_KEY_SIZE (4)
+#define MAX_KEY_SIZE (32)
+#define MIN_VAL_SIZE (16)
+#define MAX_VAL_SIZE (128)
+#define PROBE_COUNT (4096)
+/* churn operations between clock reads */
+#define CHURN_BATCH (1024)
+
+struct soak_entry {
+  unsigned char *key;
+  size_t key_size;
+  void *val;
+};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static void entry_new(struct lbtree_d *tree, struct soak_entry *entry) {
+  do {
+    entry->key_size = everand(MAX_KEY_SIZE - MIN_KEY_SIZE) + MIN_KEY_SIZE;
+    entry->key = malloc(entry->key_size);
+    if (entry->key == 0) {
+      fprintf(stderr, "out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    everand_arr(entry->key, entry->key_size);
+    if ((tree == 0) || (lbtree_dc(tree, entry->key, entry->key_size) == 0)) {
+      break;
+    }
+    /* already live in another entry */
+    free(entry->key);
+  } while (1);
+  entry->val = malloc(everand(MAX_VAL_SIZE - MIN_VAL_SIZE) + MIN_VAL_SIZE);
+  if (entry->val == 0) {
+    fprintf(stderr, "out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void entry_add(struct lbtree_d **tree, struct soak_entry *entry) {
+  if (lbtree_dc_add(tree, entry->key, entry->key_size, entry->val) != 0) {
+    fprintf(stderr, "add failed\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void entry_rm(struct lbtree_d **tree, struct soak_entry *entry) {
+  if (lbtree_dc_rm(tree, entry->key, entry->key_size) != entry->val) {
+    fprintf(stderr, "remove failed\n");
+    exit(EXIT_FAILURE);
+  }
+  free(entry->key);
+  free(entry->val);
+}
+
+static int cmp_double(const void *va, const void *vb) {
+  double a = *(const double *)va;
+  double b = *(const double *)vb;
+  return (a < b) ? -1 : ((a > b) ? 1 : 0);
+}
+
+static long int rss_kb(void) {
+  long int size;
+  long int pages;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f == 0) {
+    return -1;
+  }
+  if (fscanf(f, "%ld %ld", &size, &pages) != 2) {
+    pages = -1;
+  }
+  fclose(f);
+  return (pages < 0) ? -1 : (pages * (sysconf(_SC_PAGESIZE) / 1024));
+}
+
+static void print_heap(void) {
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+  struct mallinfo2 mi = mallinfo2();
+  printf(",%zu,%zu,%zu", (mi.arena + mi.hblkhd) / 1024,
+         (mi.uordblks + mi.hblkhd) / 1024, mi.fordblks / 1024);
+  return;
+#endif
+#endif
+  printf(",-,-,-");
+}
+
+static void sample(struct lbtree_d *tree, struct soak_entry *entries,
+                   size_t live, double elapsed_ns, unsigned long long int ops,
+                   double *probes) {
+  double total = 0;
+  size_t i;
+  for (i = 0; i < PROBE_COUNT; ++i) {
+    struct soak_entry *entry = &entries[everand(live - 1)];
+    double start = now_ns();
+    void *val = lbtree_dc(tree, entry->key, entry->key_size);
+    probes[i] = now_ns() - start;
+    if (val != entry->val) {
+      fprintf(stderr, "lookup failed\n");
+      exit(EXIT_FAILURE);
+    }
+    total += probes[i];
+  }
+  qsort(probes, PROBE_COUNT, sizeof(*probes), &cmp_double);
+
+  printf("%.1f,%llu,%zu,%ld", elapsed_ns / 1e9, ops, live, rss_kb());
+  print_heap();
+  printf(",%.1f,%.1f,%.1f\n", total / PROBE_COUNT, probes[PROBE_COUNT / 2],
+         probes[(PROBE_COUNT * 99) / 100]);
+  fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+  double duration_ns = ((argc > 1) ? strtod(argv[1], 0) : DURATION_S) * 1e9;
+  size_t live = (argc > 2) ? strtoul(argv[2], 0, 0) : LIVE_ENTRIES;
+  double sample_ns = ((argc > 3) ? strtod(argv[3], 0) : SAMPLE_S) * 1e9;
+  if (live == 0) {
+    fprintf(stderr, "live_entries must be non-zero\n");
+    return EXIT_FAILURE;
+  }
+
+  struct soak_entry *entries = malloc(live * sizeof(*entries));
+  double *probes = malloc(PROBE_COUNT * sizeof(*probes));
+  if ((entries == 0) || (probes == 0)) {
+    fprintf(stderr, "out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  everand_seed(SEED);
+  struct lbtree_d *tree = 0;
+  size_t i;
+  for (i = 0; i < live; ++i) {
+    entry_new(tree, &entries[i]);
+    entry_add(&tree, &entries[i]);
+  }
+
+  printf("elapsed_s,ops,live,rss_kb,heap_kb,heap_used_kb,heap_free_kb,"
+         "lookup_mean_ns,lookup_p50_ns,lookup_p99_ns\n");
+  double start = now_ns();
+  double next_sample = start;
+  unsigned long long int ops = 0;
+  double now;
+  do {
+    now = now_ns();
+    if (now >= next_sample) {
+      sample(tree, entries, live, now - start, ops, probes);
+      next_sample += sample_ns;
+    }
+    for (i = 0; i < CHURN_BATCH; ++i) {
+      struct soak_entry *entry = &entries[everand(live - 1)];
+      entry_rm(&tree, entry);
+      entry_new(tree, entry);
+      entry_add(&tree, entry);
+    }
+    ops += CHURN_BATCH;
+  } while ((now - start) < duration_ns);
+  sample(tree, entries, live, now_ns() - start, ops, probes);
+
+  for (i = 0; i < live; ++i) {
+    entry_rm(&tree, &entries[i]);
+  }
+  free(probes);
+  free(entries);
+  return 0;
+}
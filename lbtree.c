@@ -37,6 +37,57 @@ void lbtree_init(struct lbtree *node) {
   lbtree_index_init(&node->index);
 }
 
+void lbtree_count_init(struct lbtree *node, size_t *(*count)(void *node)) {
+  lbtree_init(node);
+  *count(node) = 1;
+}
+
+void lbtree_up_init(struct lbtree *node,
+                    struct lbtree_up *(*up)(void *node)) {
+  lbtree_init(node);
+  struct lbtree_up *node_up = up(node);
+  node_up->branch = 0;
+  node_up->leaf = node;
+}
+
+/* Points the parent ref of `child`, moved from a valid ref held by `from`, at
+  `parent`. The ref is to the key of `child` if `from` held that, otherwise to
+  the branch `child` makes (a node with no branch, whose key is its only child,
+  is removed through the same ref as one with a branch). */
+static void up_set(struct lbtree_up *(*up)(void *node), struct lbtree *from,
+                   struct lbtree *child, struct lbtree *parent) {
+  struct lbtree_up *child_up = up(child);
+  if (child_up->leaf == from) {
+    child_up->leaf = parent;
+  } else {
+    child_up->branch = parent;
+  }
+}
+
+/* Points the parent refs of the valid children of `node`, which it took from
+  `from`, at it */
+static void up_children(struct lbtree *node, struct lbtree *from,
+                        unsigned int (*sel_node)(void *node,
+                                                 lbtree_index_t index),
+                        struct lbtree_up *(*up)(void *node)) {
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree *child = node->children[i];
+    if (sel_node(child, node->index) == i) {
+      up_set(up, from, child, node);
+    }
+  }
+}
+
+/* Returns the ref to the branch `node` makes, held by `parent` */
+static struct lbtree **
+up_ref(struct lbtree **tree,
+       unsigned int (*sel_node)(void *node, lbtree_index_t index),
+       struct lbtree *parent, struct lbtree *node) {
+  return (parent == 0) ? tree
+                       : &parent->children[sel_node(node, parent->index)];
+}
+
 void lbtree_repl(struct lbtree **tree,
                  unsigned int (*sel_node)(void *node, lbtree_index_t index),
                  struct lbtree *match, struct lbtree *node) {
@@ -60,9 +111,47 @@ void lbtree_repl(struct lbtree **tree,
   *ref = node;
 }
 
-void lbtree_add(struct lbtree **tree,
-                unsigned int (*sel_node)(void *node, lbtree_index_t index),
-                struct lbtree *node) {
+void lbtree_up_repl(struct lbtree **tree,
+                    unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                    struct lbtree_up *(*up)(void *node), struct lbtree *match,
+                    struct lbtree *node) {
+  struct lbtree_up match_up = *up(match);
+  node_copy(node, match);
+  *up_ref(tree, sel_node, match_up.branch, match) = node;
+  if (match_up.leaf != match) {
+    /* otherwise the key is a child of the branch, copied above */
+    match_up.leaf->children[sel_node(match, match_up.leaf->index)] = node;
+  }
+  *up(node) = match_up;
+  up_children(node, match, sel_node, up);
+}
+
+/* Returns the number of keys below `node`'s branch, from the counts of the
+  branches among its children */
+static size_t branch_count(struct lbtree *node,
+                           unsigned int (*sel_node)(void *node,
+                                                    lbtree_index_t index),
+                           size_t *(*count)(void *node)) {
+  size_t n = 0;
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree *child = node->children[i];
+    if (sel_node(child, node->index) == i) {
+      n += (lbtree_index_gt(child->index, node->index) != 0) ? *count(child)
+                                                              : 1;
+    }
+  }
+  return n;
+}
+
+/* As `lbtree_add`, also counting the new key in each branch passed and setting
+  the count of `node` if `count` is not null, and setting the parent refs of
+  `node` and of the node it takes a ref to if `up` is not null */
+static inline struct lbtree *
+add(struct lbtree **tree,
+    unsigned int (*sel_node)(void *node, lbtree_index_t index),
+    size_t *(*count)(void *node), struct lbtree_up *(*up)(void *node),
+    struct lbtree *node) {
   struct lbtree *parent = *tree;
   lbtree_index_t index;
   lbtree_index_t parent_index;
@@ -75,6 +164,9 @@ void lbtree_add(struct lbtree **tree,
       break;
     }
     parent = next_parent;
+    if (count != 0) {
+      ++*count(parent);
+    }
     ref_sel = sel_node(node, parent_index);
     ref = &parent->children[ref_sel];
     next_parent = *ref;
@@ -82,11 +174,47 @@ void lbtree_add(struct lbtree **tree,
   } while (lbtree_index_gt(index, parent_index) != 0);
   struct lbtree *cut = *ref;
   children_init(node);
+  /* `ref` is still `tree` if `node` branches above the root */
+  struct lbtree *holder = (ref != tree) ? parent : 0;
+  if (up != 0) {
+    struct lbtree_up *node_up = up(node);
+    node_up->branch = holder;
+    node_up->leaf = node;
+  }
   /* add ref to upper tree */
   if (sel_node(cut, parent->index) == ref_sel) {
     node->children[sel_node(cut, node->index)] = cut;
+    if (up != 0) {
+      up_set(up, holder, cut, node);
+    }
+    cut = 0;
   }
   *ref = node;
+  if (count != 0) {
+    *count(node) = branch_count(node, sel_node, count);
+  }
+  return cut;
+}
+
+struct lbtree *
+lbtree_add(struct lbtree **tree,
+           unsigned int (*sel_node)(void *node, lbtree_index_t index),
+           struct lbtree *node) {
+  return add(tree, sel_node, 0, 0, node);
+}
+
+struct lbtree *
+lbtree_count_add(struct lbtree **tree,
+                 unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                 size_t *(*count)(void *node), struct lbtree *node) {
+  return add(tree, sel_node, count, 0, node);
+}
+
+struct lbtree *
+lbtree_up_add(struct lbtree **tree,
+              unsigned int (*sel_node)(void *node, lbtree_index_t index),
+              struct lbtree_up *(*up)(void *node), struct lbtree *node) {
+  return add(tree, sel_node, 0, up, node);
 }
 
 void *lbtree(struct lbtree *tree,
@@ -105,6 +233,41 @@ void *lbtree(struct lbtree *tree,
   return (struct lbtree *)tree;
 }
 
+static void *end(struct lbtree *tree,
+                 unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                 int last) {
+  if (tree == 0) {
+    return 0;
+  }
+  lbtree_index_t parent_index;
+  do {
+    parent_index = tree->index;
+    /* take the first (or last) valid child, every branch has at least one */
+    struct lbtree *child = 0;
+    unsigned int j;
+    for (j = 0; (child == 0) && (j < LBTREE_LUT_SIZE); ++j) {
+      unsigned int i = (last != 0) ? (LBTREE_LUT_SIZE - 1 - j) : j;
+      child = tree->children[i];
+      if (sel_node(child, parent_index) != i) {
+        child = 0;
+      }
+    }
+    tree = child;
+  } while (lbtree_index_gt(tree->index, parent_index) != 0);
+  return tree;
+}
+
+void *lbtree_first(struct lbtree *tree,
+                   unsigned int (*sel_node)(void *node,
+                                            lbtree_index_t index)) {
+  return end(tree, sel_node, 0);
+}
+
+void *lbtree_last(struct lbtree *tree,
+                  unsigned int (*sel_node)(void *node, lbtree_index_t index)) {
+  return end(tree, sel_node, 1);
+}
+
 struct lbtree_leaf_pos
 lbtree_leaf_pos(struct lbtree **tree,
                 unsigned int (*sel)(void *key, lbtree_index_t index), void *key,
@@ -143,29 +306,121 @@ lbtree_branch_pos(struct lbtree **tree,
   return pos;
 }
 
-void lbtree_cut(struct lbtree **branch_ref, struct lbtree_leaf_pos leaf_pos) {
+/* number of refs on the path to a leaf recorded by `lbtree_rm_pos`, beyond
+  which the branch is searched for from the last */
+#define RM_PATH_SIZE (64)
+
+/* As `lbtree_rm_pos`, also uncounting the key from each branch passed if
+  `count` is not null */
+static inline struct lbtree_rm_pos
+rm_pos(struct lbtree **tree,
+       unsigned int (*sel)(void *key, lbtree_index_t index),
+       size_t *(*count)(void *node), void *key) {
+  /* the refs to the branches passed, nearest the root first */
+  struct lbtree **path[RM_PATH_SIZE];
+  unsigned int depth = 0;
+  lbtree_index_t parent_index;
+  unsigned int child_sel;
+  struct lbtree **parent_ref;
+  struct lbtree *grandparent;
+  struct lbtree *leaf;
+  struct lbtree *parent = 0;
+  struct lbtree **ref = tree;
+  do {
+    parent_ref = ref;
+    if (depth < RM_PATH_SIZE) {
+      path[depth++] = parent_ref;
+    }
+    grandparent = parent;
+    parent = *parent_ref;
+    if (count != 0) {
+      /* the leaf's parent is passed too, but its branch is about to go */
+      --*count(parent);
+    }
+    parent_index = parent->index;
+    child_sel = sel(key, parent_index);
+    ref = &parent->children[child_sel];
+    leaf = *ref;
+  } while (lbtree_index_gt(leaf->index, parent_index) != 0);
+  struct lbtree_rm_pos pos = {.leaf = {.cut = parent->children[child_sel ^ 1],
+                                       .leaf = leaf,
+                                       .parent_ref = parent_ref,
+                                       .grandparent = grandparent},
+                              .branch = {.ref = ref, .parent = parent}};
+
+  /* the leaf's branch, if it has one, was passed on the way to it */
+  unsigned int i = depth;
+  while ((i != 0) && (*path[i - 1] != leaf)) {
+    --i;
+  }
+  if (i != 0) {
+    pos.branch.ref = path[i - 1];
+    pos.branch.parent = (i > 1) ? *path[i - 2] : 0;
+  } else if (depth == RM_PATH_SIZE) {
+    pos.branch = lbtree_branch_pos(path[depth - 1], sel, leaf, key);
+  }
+  return pos;
+}
+
+struct lbtree_rm_pos
+lbtree_rm_pos(struct lbtree **tree,
+              unsigned int (*sel)(void *key, lbtree_index_t index), void *key) {
+  return rm_pos(tree, sel, 0, key);
+}
+
+/* As `lbtree_cut`, also moving the count of the leaf's branch with it if
+  `count` is not null, and the parent refs of the nodes whose parents change if
+  `up` is not null */
+static inline void
+cut(struct lbtree **branch_ref, struct lbtree_leaf_pos leaf_pos,
+    size_t *(*count)(void *node),
+    unsigned int (*sel_node)(void *node, lbtree_index_t index),
+    struct lbtree_up *(*up)(void *node)) {
   struct lbtree *leaf_parent = *leaf_pos.parent_ref;
   /* replace free node with its non-key-ref child */
   if (leaf_pos.cut != leaf_pos.leaf) {
     *leaf_pos.parent_ref = leaf_pos.cut;
+    if (up != 0) {
+      /* the child is a branch or a key of the grandparent as it was of the
+        parent */
+      up_set(up, leaf_parent, leaf_pos.cut, leaf_pos.grandparent);
+    }
     if (leaf_parent != leaf_pos.leaf) {
       node_copy(leaf_parent, leaf_pos.leaf);
+      if (count != 0) {
+        *count(leaf_parent) = *count(leaf_pos.leaf);
+      }
       /* replace key branch with free node */
       *branch_ref = leaf_parent;
+      if (up != 0) {
+        up(leaf_parent)->branch = up(leaf_pos.leaf)->branch;
+        up_children(leaf_parent, leaf_pos.leaf, sel_node, up);
+      }
     }
   } else {
     *leaf_pos.parent_ref = leaf_pos.grandparent;
   }
 }
 
+void lbtree_cut(struct lbtree **branch_ref, struct lbtree_leaf_pos leaf_pos) {
+  cut(branch_ref, leaf_pos, 0, 0, 0);
+}
+
 void *lbtree_rm_key(struct lbtree **tree,
                     unsigned int (*sel_key)(void *key, lbtree_index_t index),
                     void *key) {
-  struct lbtree_leaf_pos leaf_pos = lbtree_leaf_pos(tree, sel_key, key, 0);
-  struct lbtree_branch_pos branch_pos =
-      lbtree_branch_pos(tree, sel_key, leaf_pos.leaf, key);
-  lbtree_cut(branch_pos.ref, leaf_pos);
-  return leaf_pos.leaf;
+  struct lbtree_rm_pos pos = lbtree_rm_pos(tree, sel_key, key);
+  lbtree_cut(pos.branch.ref, pos.leaf);
+  return pos.leaf.leaf;
+}
+
+void *lbtree_count_rm_key(struct lbtree **tree,
+                          unsigned int (*sel_key)(void *key,
+                                                  lbtree_index_t index),
+                          size_t *(*count)(void *node), void *key) {
+  struct lbtree_rm_pos pos = rm_pos(tree, sel_key, count, key);
+  cut(pos.branch.ref, pos.leaf, count, 0, 0);
+  return pos.leaf.leaf;
 }
 
 void lbtree_rm(struct lbtree **tree,
@@ -178,6 +433,201 @@ void lbtree_rm(struct lbtree **tree,
   lbtree_cut(branch_pos.ref, leaf_pos);
 }
 
+void lbtree_up_rm(struct lbtree **tree,
+                  unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                  struct lbtree_up *(*up)(void *node), struct lbtree *node) {
+  struct lbtree_up *node_up = up(node);
+  struct lbtree *leaf_parent = node_up->leaf;
+  struct lbtree *grandparent = up(leaf_parent)->branch;
+  struct lbtree_leaf_pos leaf_pos = {
+      .cut = leaf_parent->children[sel_node(node, leaf_parent->index) ^ 1],
+      .leaf = node,
+      .parent_ref = up_ref(tree, sel_node, grandparent, leaf_parent),
+      .grandparent = grandparent};
+  cut(up_ref(tree, sel_node, node_up->branch, node), leaf_pos, 0, sel_node,
+      up);
+}
+
+/* Returns non-zero if the bits of `node` with indices from `from` to below `to`
+  match those of `key` */
+static int
+bits_match(unsigned int (*sel_key)(void *key, lbtree_index_t index),
+           unsigned int (*sel_node)(void *node, lbtree_index_t index),
+           void *key, struct lbtree *node, lbtree_index_t from,
+           lbtree_index_t to) {
+  for (; lbtree_index_gt(to, from) != 0; ++from) {
+    if (sel_node(node, from) != sel_key(key, from)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+struct lbtree *
+lbtree_rm_prefix(struct lbtree **tree,
+                 unsigned int (*sel_key)(void *key, lbtree_index_t index),
+                 unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                 void *key, lbtree_index_t prefix_size) {
+  if (*tree == 0) {
+    return 0;
+  }
+  lbtree_index_t first;
+  lbtree_index_init(&first);
+  /* descend while the branches test bits of the prefix, noting the first
+    branch whose own key has the prefix */
+  struct lbtree **ref = tree;
+  struct lbtree **parent_ref = 0;
+  struct lbtree **doomed_ref = 0;
+  struct lbtree *parent = 0;
+  struct lbtree *grandparent = 0;
+  unsigned int ref_sel = 0;
+  while (lbtree_index_gt(prefix_size, (*ref)->index) != 0) {
+    parent_ref = ref;
+    grandparent = parent;
+    parent = *ref;
+    if ((doomed_ref == 0) && (bits_match(sel_key, sel_node, key, parent,
+                                         parent->index, prefix_size) != 0)) {
+      doomed_ref = ref;
+    }
+    ref_sel = sel_key(key, parent->index);
+    ref = &parent->children[ref_sel];
+    if (lbtree_index_gt((*ref)->index, parent->index) == 0) {
+      /* reached a leaf, the only node that can have the prefix */
+      struct lbtree *leaf = *ref;
+      if (bits_match(sel_key, sel_node, key, leaf, first, prefix_size) == 0) {
+        return 0;
+      }
+      lbtree_rm(tree, sel_node, leaf);
+      children_init(leaf);
+      return leaf;
+    }
+  }
+
+  /* every key below `sub` shares the bits below its index, so all of them have
+    the prefix if `sub`'s own key does */
+  struct lbtree *sub = *ref;
+  if (bits_match(sel_key, sel_node, key, sub, first, prefix_size) == 0) {
+    return 0;
+  }
+  if (parent == 0) {
+    *tree = 0;
+    return sub;
+  }
+
+  /* the branches in the subtree account for all but one of the keys in it, the
+    remaining key either floats in the subtree, has no branch (the subtree has
+    an empty slot) or has a branch above the subtree that must be replaced */
+  if (doomed_ref == 0) {
+    /* leave an empty slot */
+    *ref = parent;
+  } else if (*doomed_ref == parent) {
+    struct lbtree *other = parent->children[ref_sel ^ 1];
+    if (other != parent) {
+      *parent_ref = other;
+    } else {
+      /* both sides are now empty, and so is the slot that led to the parent
+        (or the tree, if the parent was the root) */
+      *parent_ref = grandparent;
+    }
+    /* the parent floats in the subtree */
+    children_init(parent);
+  } else {
+    /* the parent, which no longer branches, takes over the doomed branch */
+    struct lbtree *other = parent->children[ref_sel ^ 1];
+    if (other != parent) {
+      *parent_ref = other;
+    }
+    struct lbtree *doomed = *doomed_ref;
+    node_copy(parent, doomed);
+    *doomed_ref = parent;
+    children_init(doomed);
+  }
+  return sub;
+}
+
+size_t lbtree_count_prefix(
+    struct lbtree *tree,
+    unsigned int (*sel_key)(void *key, lbtree_index_t index),
+    unsigned int (*sel_node)(void *node, lbtree_index_t index),
+    size_t *(*count)(void *node), void *key, lbtree_index_t prefix_size) {
+  if (tree == 0) {
+    return 0;
+  }
+  lbtree_index_t first;
+  lbtree_index_init(&first);
+  /* descend while the branches test bits of the prefix */
+  while (lbtree_index_gt(prefix_size, tree->index) != 0) {
+    lbtree_index_t parent_index = tree->index;
+    unsigned int i = sel_key(key, parent_index);
+    struct lbtree *child = tree->children[i];
+    if (sel_node(child, parent_index) != i) {
+      return 0;
+    }
+    if (lbtree_index_gt(child->index, parent_index) == 0) {
+      /* reached a leaf, the only node that can have the prefix */
+      return bits_match(sel_key, sel_node, key, child, first, prefix_size);
+    }
+    tree = child;
+  }
+  /* every key below the branch shares the bits below its index */
+  return (bits_match(sel_key, sel_node, key, tree, first, prefix_size) != 0)
+             ? *count(tree)
+             : 0;
+}
+
+size_t lbtree_count_rank(struct lbtree *tree,
+                         unsigned int (*sel_node)(void *node,
+                                                  lbtree_index_t index),
+                         size_t *(*count)(void *node), struct lbtree *node) {
+  size_t rank = 0;
+  lbtree_index_t parent_index;
+  do {
+    parent_index = tree->index;
+    unsigned int sel = sel_node(node, parent_index);
+    /* the keys on the lower sides of the path come first */
+    unsigned int i;
+    for (i = 0; i < sel; ++i) {
+      struct lbtree *child = tree->children[i];
+      if (sel_node(child, parent_index) == i) {
+        rank += (lbtree_index_gt(child->index, parent_index) != 0)
+                    ? *count(child)
+                    : 1;
+      }
+    }
+    tree = tree->children[sel];
+  } while (lbtree_index_gt(tree->index, parent_index) != 0);
+  return rank;
+}
+
+void *lbtree_count_select(struct lbtree *tree,
+                          unsigned int (*sel_node)(void *node,
+                                                   lbtree_index_t index),
+                          size_t *(*count)(void *node), size_t rank) {
+  if ((tree == 0) || (rank >= *count(tree))) {
+    return 0;
+  }
+  for (;;) {
+    lbtree_index_t parent_index = tree->index;
+    unsigned int i;
+    for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+      struct lbtree *child = tree->children[i];
+      if (sel_node(child, parent_index) != i) {
+        continue;
+      }
+      int branch = lbtree_index_gt(child->index, parent_index);
+      size_t n = (branch != 0) ? *count(child) : 1;
+      if (rank < n) {
+        if (branch == 0) {
+          return child;
+        }
+        tree = child;
+        break;
+      }
+      rank -= n;
+    }
+  }
+}
+
 static void *walk(struct lbtree *tree,
                   unsigned int (*sel_node)(void *node, lbtree_index_t index),
                   void *(*action)(void *node, void *closure), void *closure) {
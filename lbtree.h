@@ -44,6 +44,11 @@ struct lbtree_branch_pos {
   struct lbtree **ref;
   struct lbtree *parent;
 };
+
+struct lbtree_rm_pos {
+  struct lbtree_leaf_pos leaf;
+  struct lbtree_branch_pos branch;
+};
 /* Initialises the tree with one node - `lbtree_add` below should not be called
 with a reference-to-zero `tree` parameter.
 */
@@ -57,10 +62,13 @@ void lbtree_repl(struct lbtree **tree,
 /* Adds an node to the tree. `node` must have index pre-populated, normal
   function of this add would include a lookup, compare to find the first index
   of divergence, and then add to insert into the tree.
+  Returns the target of the leaf reference that `node` displaced from the tree,
+  if any, otherwise zero.
 */
-void lbtree_add(struct lbtree **tree,
-                unsigned int (*sel_node)(void *node, lbtree_index_t index),
-                struct lbtree *node);
+struct lbtree *
+lbtree_add(struct lbtree **tree,
+           unsigned int (*sel_node)(void *node, lbtree_index_t index),
+           struct lbtree *node);
 
 /* Performs a lookup. Returns a pointer to the node associated with `key`.
  */
@@ -68,6 +76,17 @@ void *lbtree(struct lbtree *tree,
              unsigned int (*sel_key)(void *key, lbtree_index_t index),
              void *key);
 
+/* Return the first and last nodes in the order of `lbtree_walk`, in which keys
+ * are ordered by the lowest indexed bit in which they differ, the key that
+ * selects the lower child at that bit coming first. Return zero if the tree is
+ * empty.
+ */
+void *lbtree_first(struct lbtree *tree,
+                   unsigned int (*sel_node)(void *node, lbtree_index_t index));
+
+void *lbtree_last(struct lbtree *tree,
+                  unsigned int (*sel_node)(void *node, lbtree_index_t index));
+
 /* Returns information about the position of the leaf associated with `key` in
  * the tree */
 struct lbtree_leaf_pos
@@ -82,6 +101,13 @@ lbtree_branch_pos(struct lbtree **tree,
                   unsigned int (*sel)(void *key, lbtree_index_t index),
                   struct lbtree *node, void *key);
 
+/* retrives both of the above for the node found by `key`, which must be in the
+ * tree, from a single descent, the refs passed on the way to the leaf being
+ * kept to find the branch among */
+struct lbtree_rm_pos
+lbtree_rm_pos(struct lbtree **tree,
+              unsigned int (*sel)(void *key, lbtree_index_t index), void *key);
+
 void lbtree_cut(struct lbtree **branch_ref, struct lbtree_leaf_pos leaf_pos);
 
 /* Removes a node by key. Returns a pointer to that node. Assumes the node
@@ -97,6 +123,97 @@ void lbtree_rm(struct lbtree **tree,
                unsigned int (*sel_node)(void *node, lbtree_index_t index),
                struct lbtree *node);
 
+/* Removes every node whose key matches `key` in the bits with indices below
+ * `prefix_size`, detaching them together in time that depends on the depth of
+ * the tree and on `prefix_size` but not on the number of nodes removed. Returns
+ * the root of the removed nodes, or zero if none matched. The removed nodes
+ * form a tree of their own, which can be walked, added to or removed from, so a
+ * tree can be split in two at a prefix.
+ */
+struct lbtree *
+lbtree_rm_prefix(struct lbtree **tree,
+                 unsigned int (*sel_key)(void *key, lbtree_index_t index),
+                 unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                 void *key, lbtree_index_t prefix_size);
+
+/* Counted trees keep, for each branch, the number of keys below it, so that
+ * keys can be counted by prefix and found by their position in the order of
+ * `lbtree_walk` in time that depends on the depth of the tree rather than on
+ * the number of keys. `count` returns a pointer to the count stored in a node,
+ * which counts the keys below the branch the node makes, wherever that is in
+ * the tree. A counted tree must only be changed through the functions below,
+ * which otherwise behave as the functions they are named after.
+ */
+void lbtree_count_init(struct lbtree *node, size_t *(*count)(void *node));
+
+struct lbtree *
+lbtree_count_add(struct lbtree **tree,
+                 unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                 size_t *(*count)(void *node), struct lbtree *node);
+
+/* The key must be in the tree, as it is uncounted on the way to it. */
+void *lbtree_count_rm_key(struct lbtree **tree,
+                          unsigned int (*sel_key)(void *key,
+                                                  lbtree_index_t index),
+                          size_t *(*count)(void *node), void *key);
+
+/* Returns the number of keys in a counted tree that match `key` in the bits
+ * with indices below `prefix_size`.
+ */
+size_t lbtree_count_prefix(
+    struct lbtree *tree,
+    unsigned int (*sel_key)(void *key, lbtree_index_t index),
+    unsigned int (*sel_node)(void *node, lbtree_index_t index),
+    size_t *(*count)(void *node), void *key, lbtree_index_t prefix_size);
+
+/* Returns the number of keys before `node`, which must be in the counted tree,
+ * in the order of `lbtree_walk`.
+ */
+size_t lbtree_count_rank(struct lbtree *tree,
+                         unsigned int (*sel_node)(void *node,
+                                                  lbtree_index_t index),
+                         size_t *(*count)(void *node), struct lbtree *node);
+
+/* Returns the node with `rank` keys before it in the order of `lbtree_walk`,
+ * or zero if the counted tree has no more than `rank` keys.
+ */
+void *lbtree_count_select(struct lbtree *tree,
+                          unsigned int (*sel_node)(void *node,
+                                                   lbtree_index_t index),
+                          size_t *(*count)(void *node), size_t rank);
+
+/* Trees with parent refs keep, in each node, the nodes holding the refs to it,
+ * so that a node can be removed or replaced without a descent from the root.
+ * `up` returns a pointer to the `struct lbtree_up` stored in a node, in which
+ * `branch` is the node holding the ref to the branch the node makes (zero for
+ * the root) and `leaf` the node holding the ref to its key (which may be the
+ * node itself). A tree with parent refs must only be changed through the
+ * functions below, which otherwise behave as the functions they are named
+ * after.
+ */
+struct lbtree_up {
+  struct lbtree *branch;
+  struct lbtree *leaf;
+};
+
+void lbtree_up_init(struct lbtree *node, struct lbtree_up *(*up)(void *node));
+
+/* Replaces `match` with `node` without a lookup. */
+void lbtree_up_repl(struct lbtree **tree,
+                    unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                    struct lbtree_up *(*up)(void *node), struct lbtree *match,
+                    struct lbtree *node);
+
+struct lbtree *
+lbtree_up_add(struct lbtree **tree,
+              unsigned int (*sel_node)(void *node, lbtree_index_t index),
+              struct lbtree_up *(*up)(void *node), struct lbtree *node);
+
+/* Removes a node by pointer, reading and changing only the nodes around it. */
+void lbtree_up_rm(struct lbtree **tree,
+                  unsigned int (*sel_node)(void *node, lbtree_index_t index),
+                  struct lbtree_up *(*up)(void *node), struct lbtree *node);
+
 /* Calls `action` once for each node in the tree, with a pointer to the node as
 a first argument and `closure` as a second. The walk will stop when any action
 returns a non-null pointer. Returns the action return value causing the walk
@@ -0,0 +1,501 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_HPP
+#define LBTREE_HPP
+
+extern "C" {
+#include "lbtree.h"
+}
+
+#include <climits>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/*
+C++ map over the lbtree core. The lookup loop is in this header and reads the
+bits of keys through a traits class rather than through function pointers, so
+it is compiled for each key type, while adds and removals go through the core.
+Nodes hold their `value_type` in place and are allocated from `Allocator`,
+which defaults to a `std::pmr::polymorphic_allocator`.
+
+(The namespace is not `lbtree`, which is already the name of the lookup
+function.)
+*/
+namespace lbtree_cpp {
+
+/*
+Traits giving the bits of a key, which must be of one width for every key in
+a map. `bit` returns the bit at `index`, and `diff` the index of the first bit
+in which two different keys differ. A map iterates over its keys in order of
+the first bit in which they differ, the key with a zero there first.
+
+For integers, bit 0 is the most significant (with the sign bit inverted for
+signed types) so that keys are iterated in ascending order, as in a
+`std::map`.
+*/
+template <class Key, class = void> struct bit_traits;
+
+template <class Key>
+struct bit_traits<Key, std::enable_if_t<std::is_integral_v<Key>>> {
+  using bits_type = std::make_unsigned_t<Key>;
+  static constexpr unsigned int width = sizeof(Key) * CHAR_BIT;
+  static_assert(width <= 64, "keys wider than 64 bits need their own traits");
+
+  static constexpr bits_type bits(Key key) noexcept {
+    bits_type sign = std::is_signed_v<Key>
+                         ? static_cast<bits_type>(bits_type(1) << (width - 1))
+                         : bits_type(0);
+    return static_cast<bits_type>(static_cast<bits_type>(key) ^ sign);
+  }
+
+  static constexpr unsigned int bit(Key key, lbtree_index_t index) noexcept {
+    return static_cast<unsigned int>((bits(key) >> (width - 1 - index)) & 1u);
+  }
+
+  static constexpr lbtree_index_t diff(Key a, Key b) noexcept {
+    bits_type x = static_cast<bits_type>(bits(a) ^ bits(b));
+    unsigned long long wide = static_cast<unsigned long long>(x)
+                              << (64 - width);
+#if defined(__GNUC__)
+    return static_cast<lbtree_index_t>(__builtin_clzll(wide));
+#else
+    lbtree_index_t index = 0;
+    while ((wide & (1ull << 63)) == 0) {
+      wide <<= 1;
+      ++index;
+    }
+    return index;
+#endif
+  }
+};
+
+template <class Key, class Value, class BitTraits = bit_traits<Key>,
+          class Allocator =
+              std::pmr::polymorphic_allocator<std::pair<const Key, Value>>>
+class map {
+public:
+  using key_type = Key;
+  using mapped_type = Value;
+  using value_type = std::pair<const Key, Value>;
+  using size_type = std::size_t;
+  using difference_type = std::ptrdiff_t;
+  using allocator_type = Allocator;
+  using reference = value_type &;
+  using const_reference = const value_type &;
+
+private:
+  struct node : public ::lbtree {
+    value_type kv;
+
+    template <class... Args>
+    explicit node(Args &&...args) : kv(std::forward<Args>(args)...) {}
+  };
+
+  using alloc_traits = std::allocator_traits<Allocator>;
+  using node_allocator = typename alloc_traits::template rebind_alloc<node>;
+  using node_traits = std::allocator_traits<node_allocator>;
+
+  template <bool Const> class iterator_base {
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = typename map::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<Const, const value_type *, value_type *>;
+    using reference =
+        std::conditional_t<Const, const value_type &, value_type &>;
+
+    iterator_base() noexcept = default;
+
+    // iterators convert to const iterators
+    template <bool C = Const, class = std::enable_if_t<C>>
+    iterator_base(const iterator_base<false> &other) noexcept
+        : map_(other.map_), node_(other.node_) {}
+
+    reference operator*() const noexcept { return node_->kv; }
+    pointer operator->() const noexcept { return &node_->kv; }
+
+    iterator_base &operator++() noexcept {
+      node_ = map_->adjacent(node_, 1);
+      return *this;
+    }
+
+    iterator_base operator++(int) noexcept {
+      iterator_base it = *this;
+      ++*this;
+      return it;
+    }
+
+    iterator_base &operator--() noexcept {
+      node_ = (node_ == nullptr) ? map_->end_node(1) : map_->adjacent(node_, 0);
+      return *this;
+    }
+
+    iterator_base operator--(int) noexcept {
+      iterator_base it = *this;
+      --*this;
+      return it;
+    }
+
+    friend bool operator==(const iterator_base &a,
+                           const iterator_base &b) noexcept {
+      return a.node_ == b.node_;
+    }
+
+    friend bool operator!=(const iterator_base &a,
+                           const iterator_base &b) noexcept {
+      return a.node_ != b.node_;
+    }
+
+  private:
+    friend class map;
+    friend class iterator_base<!Const>;
+
+    iterator_base(const map *m, node *n) noexcept : map_(m), node_(n) {}
+
+    const map *map_ = nullptr;
+    node *node_ = nullptr;
+  };
+
+public:
+  using iterator = iterator_base<false>;
+  using const_iterator = iterator_base<true>;
+
+  map() : map(Allocator()) {}
+
+  explicit map(const Allocator &alloc) : alloc_(alloc) {}
+
+  map(const map &other)
+      : map(other, alloc_traits::select_on_container_copy_construction(
+                       other.get_allocator())) {}
+
+  map(const map &other, const Allocator &alloc) : alloc_(alloc) {
+    for (const value_type &kv : other) {
+      try_emplace(kv.first, kv.second);
+    }
+  }
+
+  map(map &&other) noexcept
+      : alloc_(std::move(other.alloc_)), root_(other.root_),
+        size_(other.size_) {
+    other.root_ = nullptr;
+    other.size_ = 0;
+  }
+
+  ~map() { clear(); }
+
+  map &operator=(const map &other) {
+    if (this != &other) {
+      // the nodes are freed by the allocator that made them before it changes
+      clear();
+      if constexpr (alloc_traits::propagate_on_container_copy_assignment::
+                        value) {
+        alloc_ = other.alloc_;
+      }
+      for (const value_type &kv : other) {
+        try_emplace(kv.first, kv.second);
+      }
+    }
+    return *this;
+  }
+
+  map &operator=(map &&other) noexcept(
+      alloc_traits::propagate_on_container_move_assignment::value ||
+      alloc_traits::is_always_equal::value) {
+    if (this == &other) {
+      return *this;
+    }
+    clear();
+    if constexpr (alloc_traits::propagate_on_container_move_assignment::
+                      value) {
+      alloc_ = other.alloc_;
+    }
+    if (alloc_ == other.alloc_) {
+      std::swap(root_, other.root_);
+      std::swap(size_, other.size_);
+    } else {
+      // nodes cannot change allocators, so the values are moved into new ones
+      for (value_type &kv : other) {
+        try_emplace(kv.first, std::move(kv.second));
+      }
+      other.clear();
+    }
+    return *this;
+  }
+
+  allocator_type get_allocator() const { return allocator_type(alloc_); }
+
+  iterator begin() noexcept { return iterator(this, end_node(0)); }
+  const_iterator begin() const noexcept {
+    return const_iterator(this, end_node(0));
+  }
+  const_iterator cbegin() const noexcept { return begin(); }
+  iterator end() noexcept { return iterator(this, nullptr); }
+  const_iterator end() const noexcept { return const_iterator(this, nullptr); }
+  const_iterator cend() const noexcept { return end(); }
+
+  bool empty() const noexcept { return size_ == 0; }
+  size_type size() const noexcept { return size_; }
+
+  iterator find(const Key &key) noexcept { return iterator(this, lookup(key)); }
+  const_iterator find(const Key &key) const noexcept {
+    return const_iterator(this, lookup(key));
+  }
+  size_type count(const Key &key) const noexcept {
+    return (lookup(key) != nullptr) ? 1 : 0;
+  }
+  bool contains(const Key &key) const noexcept {
+    return lookup(key) != nullptr;
+  }
+
+  Value &at(const Key &key) {
+    node *n = lookup(key);
+    if (n == nullptr) {
+      throw std::out_of_range("lbtree_cpp::map::at");
+    }
+    return n->kv.second;
+  }
+
+  const Value &at(const Key &key) const {
+    return const_cast<map *>(this)->at(key);
+  }
+
+  Value &operator[](const Key &key) { return try_emplace(key).first->second; }
+  Value &operator[](Key &&key) {
+    return try_emplace(std::move(key)).first->second;
+  }
+
+  /* Constructs a value from `args` if `key` is not in the map, otherwise
+    leaves `args` untouched. */
+  template <class K, class... Args>
+  std::pair<iterator, bool> try_emplace(K &&key, Args &&...args) {
+    lbtree_index_t index = 0;
+    if (root_ != nullptr) {
+      node *b = best(key);
+      if (b->kv.first == key) {
+        return {iterator(this, b), false};
+      }
+      index = BitTraits::diff(key, b->kv.first);
+    }
+    node *n = create(std::piecewise_construct,
+                     std::forward_as_tuple(std::forward<K>(key)),
+                     std::forward_as_tuple(std::forward<Args>(args)...));
+    link(n, index);
+    return {iterator(this, n), true};
+  }
+
+  std::pair<iterator, bool> insert(const value_type &kv) {
+    return try_emplace(kv.first, kv.second);
+  }
+
+  std::pair<iterator, bool> insert(value_type &&kv) {
+    return try_emplace(std::move(const_cast<Key &>(kv.first)),
+                       std::move(kv.second));
+  }
+
+  template <class M>
+  std::pair<iterator, bool> insert_or_assign(const Key &key, M &&val) {
+    std::pair<iterator, bool> r = try_emplace(key, std::forward<M>(val));
+    if (!r.second) {
+      r.first->second = std::forward<M>(val);
+    }
+    return r;
+  }
+
+  template <class... Args> std::pair<iterator, bool> emplace(Args &&...args) {
+    // the key is only known once the pair is built
+    node *n = create(std::forward<Args>(args)...);
+    lbtree_index_t index = 0;
+    if (root_ != nullptr) {
+      node *b = best(n->kv.first);
+      if (b->kv.first == n->kv.first) {
+        destroy(n);
+        return {iterator(this, b), false};
+      }
+      index = BitTraits::diff(n->kv.first, b->kv.first);
+    }
+    link(n, index);
+    return {iterator(this, n), true};
+  }
+
+  iterator erase(const_iterator pos) {
+    node *n = pos.node_;
+    node *next = adjacent(n, 1);
+    lbtree_rm(&root_, &sel_node, n);
+    --size_;
+    destroy(n);
+    return iterator(this, next);
+  }
+
+  iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+
+  size_type erase(const Key &key) {
+    node *n = lookup(key);
+    if (n == nullptr) {
+      return 0;
+    }
+    lbtree_rm(&root_, &sel_node, n);
+    --size_;
+    destroy(n);
+    return 1;
+  }
+
+  void clear() noexcept {
+    // safe as the walk reads the children of each node before any is freed
+    lbtree_walk(root_, &sel_node, &destroy_action, this);
+    root_ = nullptr;
+    size_ = 0;
+  }
+
+  void swap(map &other) noexcept {
+    using std::swap;
+    if constexpr (alloc_traits::propagate_on_container_swap::value) {
+      swap(alloc_, other.alloc_);
+    }
+    swap(root_, other.root_);
+    swap(size_, other.size_);
+  }
+
+private:
+  static unsigned int sel_node(void *v_node, lbtree_index_t index) {
+    node *n = static_cast<node *>(static_cast<struct lbtree *>(v_node));
+    return BitTraits::bit(n->kv.first, index);
+  }
+
+  static bool valid(struct lbtree *child, lbtree_index_t parent_index,
+                    unsigned int i) noexcept {
+    return BitTraits::bit(static_cast<node *>(child)->kv.first,
+                          parent_index) == i;
+  }
+
+  /* Returns the node reached by looking up `key` in a non-empty map, which
+    only has a matching key if there is one in the map. */
+  template <class K> node *best(const K &key) const noexcept {
+    struct lbtree *n = root_;
+    lbtree_index_t parent_index;
+    do {
+      parent_index = n->index;
+      n = n->children[BitTraits::bit(key, parent_index)];
+    } while (lbtree_index_gt(n->index, parent_index) != 0);
+    return static_cast<node *>(n);
+  }
+
+  node *lookup(const Key &key) const noexcept {
+    if (root_ == nullptr) {
+      return nullptr;
+    }
+    node *n = best(key);
+    return (n->kv.first == key) ? n : nullptr;
+  }
+
+  /* Returns the first (or last) node below the branch `tree` makes. */
+  static node *end_below(struct lbtree *tree, unsigned int last) noexcept {
+    lbtree_index_t parent_index;
+    do {
+      parent_index = tree->index;
+      // every branch has at least one valid child
+      struct lbtree *child = tree->children[last];
+      tree = valid(child, parent_index, last) ? child
+                                              : tree->children[last ^ 1];
+    } while (lbtree_index_gt(tree->index, parent_index) != 0);
+    return static_cast<node *>(tree);
+  }
+
+  node *end_node(unsigned int last) const noexcept {
+    return (root_ == nullptr) ? nullptr : end_below(root_, last);
+  }
+
+  /* Returns the node after (`next` is 1) or before `n`, which is in the map,
+    from the nearest subtree on that side of its path. */
+  node *adjacent(const node *n, unsigned int next) const noexcept {
+    struct lbtree *tree = root_;
+    struct lbtree *side = nullptr;
+    lbtree_index_t side_index = 0;
+    lbtree_index_t parent_index;
+    do {
+      parent_index = tree->index;
+      unsigned int i = BitTraits::bit(n->kv.first, parent_index);
+      if (i != next) {
+        struct lbtree *child = tree->children[next];
+        if (valid(child, parent_index, next)) {
+          side = child;
+          side_index = parent_index;
+        }
+      }
+      tree = tree->children[i];
+    } while (lbtree_index_gt(tree->index, parent_index) != 0);
+    if (side == nullptr) {
+      return nullptr;
+    }
+    return (lbtree_index_gt(side->index, side_index) != 0)
+               ? end_below(side, next ^ 1)
+               : static_cast<node *>(side);
+  }
+
+  /* Adds `n`, whose key first differs from that of the node its lookup
+    reaches at `index`. */
+  void link(node *n, lbtree_index_t index) noexcept {
+    if (root_ == nullptr) {
+      lbtree_init(n);
+      root_ = n;
+    } else {
+      n->index = index;
+      lbtree_add(&root_, &sel_node, n);
+    }
+    ++size_;
+  }
+
+  template <class... Args> node *create(Args &&...args) {
+    node *n = node_traits::allocate(alloc_, 1);
+    try {
+      node_traits::construct(alloc_, n, std::forward<Args>(args)...);
+    } catch (...) {
+      node_traits::deallocate(alloc_, n, 1);
+      throw;
+    }
+    return n;
+  }
+
+  void destroy(node *n) noexcept {
+    node_traits::destroy(alloc_, n);
+    node_traits::deallocate(alloc_, n, 1);
+  }
+
+  static void *destroy_action(void *v_node, void *v_map) {
+    static_cast<map *>(v_map)->destroy(
+        static_cast<node *>(static_cast<struct lbtree *>(v_node)));
+    return nullptr;
+  }
+
+  node_allocator alloc_;
+  struct lbtree *root_ = nullptr;
+  size_type size_ = 0;
+};
+
+template <class Key, class Value, class BitTraits, class Allocator>
+void swap(map<Key, Value, BitTraits, Allocator> &a,
+          map<Key, Value, BitTraits, Allocator> &b) noexcept {
+  a.swap(b);
+}
+
+} // namespace lbtree_cpp
+
+#endif
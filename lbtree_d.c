@@ -18,18 +18,13 @@
 
 #include "lbtree_d.h"
 
-struct lbtree_d_size {
-  struct lbtree_d base;
-  lbtree_index_t key_size_bits;
-};
-
-static unsigned int sel_key(void *key, lbtree_index_t index) {
+unsigned int lbtree_d_sel_key(void *key, lbtree_index_t index) {
   return (((unsigned char *)key)[index / CHAR_BIT] >> (index % CHAR_BIT)) & 1;
 }
 
-static unsigned int sel_node(void *v_node, lbtree_index_t index) {
+unsigned int lbtree_d_sel_node(void *v_node, lbtree_index_t index) {
   struct lbtree_d *node = v_node;
-  return sel_key(node->key, index);
+  return lbtree_d_sel_key(node->key, index);
 }
 
 static inline unsigned int get_shift(unsigned char a, unsigned char b) {
@@ -42,115 +37,148 @@ static inline unsigned int get_shift(unsigned char a, unsigned char b) {
   return shift;
 }
 
-void *lbtree_d_add(struct lbtree_d **size_tree, void *key,
-                   lbtree_index_t key_size_bits, void *val) {
-  if (*size_tree == 0) {
-    struct lbtree_d_size *size_node = malloc(sizeof(*size_node));
-    if (size_node == 0) {
-      return val;
-    }
-    size_node->key_size_bits = key_size_bits;
-    size_node->base.key = (unsigned char *)&size_node->key_size_bits;
-    size_node->base.val = 0;
-    lbtree_init(&size_node->base.base);
-    *size_tree = &size_node->base;
-
-    struct lbtree_d *key_node = malloc(sizeof(*key_node));
-    if (key_node == 0) {
-      free(size_node);
-      return val;
-    }
-    key_node->key = key;
-    key_node->val = val;
-    lbtree_init(&key_node->base);
-    size_node->base.val = &key_node->base;
-    return 0;
+lbtree_index_t lbtree_d_index(const void *a, const void *b,
+                              lbtree_index_t size_bits) {
+  const unsigned char *ka = a;
+  const unsigned char *kb = b;
+  lbtree_index_t index = 0;
+  lbtree_index_t whole_char_size = size_bits / CHAR_BIT;
+  while ((index < whole_char_size) && (*ka == *kb)) {
+    ++ka;
+    ++kb;
+    ++index;
   }
 
-  struct lbtree_d_size *size_best =
-      lbtree(&(*size_tree)->base, &sel_key, &key_size_bits);
+  index *= CHAR_BIT;
 
-  unsigned char *ka;
-  unsigned char *kb;
-  if (size_best->key_size_bits == key_size_bits) {
-    /* key_size already exists in size tree, add to key tree only */
-    if (key_size_bits == 0) {
-      struct lbtree_d *key_best = size_best->base.val;
-      void *old_val = key_best->val;
-      key_best->key = key;
-      key_best->val = val;
-      return old_val;
-    }
+  if (index != size_bits) {
+    index += get_shift(*ka, *kb);
+  }
+  return index;
+}
 
-    struct lbtree_d *key_best = lbtree(size_best->base.val, &sel_key, key);
+/* Adds `size_node`, whose key size is not yet in the size tree and whose key
+  tree has been set, `size_best` being the size node reached by a lookup of its
+  key size, or zero if the size tree is empty */
+static void size_add(struct lbtree_d **size_tree,
+                     struct lbtree_d_size *size_node,
+                     struct lbtree_d_size *size_best) {
+  size_node->base.key = (unsigned char *)&size_node->key_size_bits;
+  if (size_best == 0) {
+    lbtree_init(&size_node->base.base);
+    *size_tree = &size_node->base;
+    return;
+  }
+  size_node->base.base.index =
+      lbtree_d_index(size_node->base.key, size_best->base.key,
+                     sizeof(lbtree_index_t) * CHAR_BIT);
+  lbtree_add((struct lbtree **)size_tree, &lbtree_d_sel_node,
+             &size_node->base.base);
+}
 
-    ka = key;
-    kb = key_best->key;
-    lbtree_index_t index = 0;
-    lbtree_index_t whole_char_size = key_size_bits / CHAR_BIT;
-    while ((index < whole_char_size) && (*ka == *kb)) {
-      ++ka;
-      ++kb;
-      ++index;
-    }
+static size_t *key_count(void *node) {
+  return &((struct lbtree_d_count *)node)->count;
+}
 
-    index *= CHAR_BIT;
+/* Finds the node whose key matches `key`, or adds one with `key` and a zero
+  value, setting `found` to non-zero in the former case, counted if `count` is
+  not null. Returns zero on memory allocation error, in which case the tree is
+  unchanged. */
+static struct lbtree_d *node_get(struct lbtree_d **size_tree, void *key,
+                                 lbtree_index_t key_size_bits,
+                                 size_t *(*count)(void *node), int *found) {
+  size_t key_node_size = (count != 0) ? sizeof(struct lbtree_d_count)
+                                      : sizeof(struct lbtree_d);
+  struct lbtree_d_size *size_best = 0;
+  if (*size_tree != 0) {
+    size_best = lbtree(&(*size_tree)->base, &lbtree_d_sel_key, &key_size_bits);
+  }
 
-    if (index != key_size_bits) {
-      index += get_shift(*ka, *kb);
+  if ((size_best != 0) && (size_best->key_size_bits == key_size_bits)) {
+    /* key_size already exists in size tree, add to key tree only */
+    struct lbtree_d *key_best = size_best->base.val;
+    lbtree_index_t index = key_size_bits;
+    if (key_size_bits != 0) {
+      key_best = lbtree(size_best->base.val, &lbtree_d_sel_key, key);
+      index = lbtree_d_index(key, key_best->key, key_size_bits);
     }
-
     if (index == key_size_bits) {
-      void *old_val = key_best->val;
-      key_best->key = key;
-      key_best->val = val;
-      return old_val;
+      *found = 1;
+      return key_best;
     }
 
-    struct lbtree_d *key_node = malloc(sizeof(*key_node));
+    struct lbtree_d *key_node = malloc(key_node_size);
     if (key_node == 0) {
-      return val;
+      return 0;
     }
     key_node->key = key;
-    key_node->val = val;
+    key_node->val = 0;
 
     key_node->base.index = index;
-    lbtree_add((struct lbtree **)&size_best->base.val, &sel_node,
-               &key_node->base);
-  } else {
-    /* key_size_bits not yet in size tree, add to size tree and to key tree */
-    struct lbtree_d_size *size_node = malloc(sizeof(*size_node));
-    if (size_node == 0) {
-      return val;
+    if (count != 0) {
+      lbtree_count_add((struct lbtree **)&size_best->base.val,
+                       &lbtree_d_sel_node, count, &key_node->base);
+    } else {
+      lbtree_add((struct lbtree **)&size_best->base.val, &lbtree_d_sel_node,
+                 &key_node->base);
     }
-    size_node->key_size_bits = key_size_bits;
-    size_node->base.key = (unsigned char *)&size_node->key_size_bits;
-    size_node->base.val = 0;
+    *found = 0;
+    return key_node;
+  }
 
-    ka = size_node->base.key;
-    kb = size_best->base.key;
-    lbtree_index_t index = 0;
-    while (*ka == *kb) {
-      ++ka;
-      ++kb;
-      index += CHAR_BIT;
-    }
+  /* key_size_bits not yet in size tree, add to size tree and to key tree */
+  struct lbtree_d_size *size_node = malloc(sizeof(*size_node));
+  struct lbtree_d *key_node = malloc(key_node_size);
+  if ((size_node == 0) || (key_node == 0)) {
+    free(key_node);
+    free(size_node);
+    return 0;
+  }
+  key_node->key = key;
+  key_node->val = 0;
+  if (count != 0) {
+    lbtree_count_init(&key_node->base, count);
+  } else {
+    lbtree_init(&key_node->base);
+  }
 
-    index += get_shift(*ka, *kb);
+  size_node->key_size_bits = key_size_bits;
+  size_node->base.val = &key_node->base;
+  size_add(size_tree, size_node, size_best);
+  *found = 0;
+  return key_node;
+}
 
-    struct lbtree_d *key_node = malloc(sizeof(*key_node));
-    if (key_node == 0) {
-      return val;
-    }
-    key_node->key = key;
-    key_node->val = val;
+void *lbtree_d_add(struct lbtree_d **size_tree, void *key,
+                   lbtree_index_t key_size_bits, void *val) {
+  int found;
+  struct lbtree_d *node = node_get(size_tree, key, key_size_bits, 0, &found);
+  if (node == 0) {
+    return val;
+  }
+  void *old_val = (found != 0) ? node->val : 0;
+  node->key = key;
+  node->val = val;
+  return old_val;
+}
 
-    size_node->base.base.index = index;
-    lbtree_add((struct lbtree **)size_tree, &sel_node, &size_node->base.base);
+void **lbtree_d_slot(struct lbtree_d **size_tree, void *key,
+                     lbtree_index_t key_size_bits) {
+  int found;
+  struct lbtree_d *node = node_get(size_tree, key, key_size_bits, 0, &found);
+  return (node == 0) ? 0 : &node->val;
+}
 
-    lbtree_init(&key_node->base);
-    size_node->base.val = &key_node->base;
+int lbtree_d_upsert(struct lbtree_d **size_tree, void *key,
+                    lbtree_index_t key_size_bits,
+                    void *(*merge)(void *val, int found, void *closure),
+                    void *closure) {
+  int found;
+  struct lbtree_d *node = node_get(size_tree, key, key_size_bits, 0, &found);
+  if (node == 0) {
+    return -1;
   }
+  node->val = merge(node->val, found, closure);
   return 0;
 }
 
@@ -168,74 +196,925 @@ static int match(unsigned char *ka, unsigned char *kb,
   return ((*ka & mask) == (*kb & mask)) ? 0 : -1;
 }
 
-void *lbtree_d(struct lbtree_d *size_tree, void *key,
-               lbtree_index_t key_size_bits) {
+struct lbtree_d *lbtree_d_node_find(struct lbtree_d *size_tree, void *key,
+                                    lbtree_index_t key_size_bits) {
+  if (size_tree == 0) {
+    return 0;
+  }
   struct lbtree_d *size_best =
-      lbtree(&size_tree->base, &sel_key, &key_size_bits);
+      lbtree(&size_tree->base, &lbtree_d_sel_key, &key_size_bits);
   if ((*(lbtree_index_t *)size_best->key) != key_size_bits) {
     return 0;
   }
+  struct lbtree_d *key_best = size_best->val;
   if (key_size_bits == 0) {
-    struct lbtree_d *key_best = size_best->val;
-    return key_best->val;
+    return key_best;
   }
-  struct lbtree_d *key_best = lbtree(size_best->val, &sel_key, key);
-  return (match(key_best->key, key, key_size_bits) == 0) ? key_best->val : 0;
+  key_best = lbtree(&key_best->base, &lbtree_d_sel_key, key);
+  return (match(key_best->key, key, key_size_bits) == 0) ? key_best : 0;
 }
 
-static void rm_leaf_pos(struct lbtree **tree,
-                        unsigned int (*sel)(void *tree, lbtree_index_t index),
-                        void *key, struct lbtree_leaf_pos leaf_pos) {
-  struct lbtree_branch_pos branch_pos =
-      lbtree_branch_pos(tree, sel, leaf_pos.leaf, key);
-  lbtree_cut(branch_pos.ref, leaf_pos);
+void *lbtree_d(struct lbtree_d *size_tree, void *key,
+               lbtree_index_t key_size_bits) {
+  struct lbtree_d *node = lbtree_d_node_find(size_tree, key, key_size_bits);
+  return (node == 0) ? 0 : node->val;
 }
 
-void *lbtree_d_rm(struct lbtree_d **size_tree, void *key,
-                  lbtree_index_t key_size_bits) {
+/* Returns the size node for keys `key_size_bits` long, or zero if there is
+  none, using the one `finger` was last used with if it matches */
+static struct lbtree_d_size *finger_size(struct lbtree_d *size_tree,
+                                         struct lbtree_d_finger *finger,
+                                         lbtree_index_t key_size_bits) {
+  if ((finger->size_node != 0) &&
+      (finger->size_node->key_size_bits == key_size_bits)) {
+    return finger->size_node;
+  }
+  if (size_tree == 0) {
+    return 0;
+  }
+  struct lbtree_d_size *size_node =
+      lbtree(&size_tree->base, &lbtree_d_sel_key, &key_size_bits);
+  return (size_node->key_size_bits == key_size_bits) ? size_node : 0;
+}
+
+/* Returns the number of branches on the finger's path with indices at most
+  `index`, or below it if not `inclusive` */
+static unsigned int finger_count(struct lbtree_d_finger *finger,
+                                 lbtree_index_t index, int inclusive) {
+  unsigned int lo = 0;
+  unsigned int hi = finger->depth;
+  while (lo != hi) {
+    unsigned int mid = lo + ((hi - lo) / 2);
+    lbtree_index_t mid_index = finger->path[mid]->base.index;
+    if ((lbtree_index_gt(index, mid_index) != 0) ||
+        ((inclusive != 0) && (mid_index == index))) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Descends the key tree of `size_node`, a tree of keys more than zero bits
+  long, recording the branches passed in `finger`. Returns the leaf reached. */
+static struct lbtree_d *finger_descend(struct lbtree_d_size *size_node,
+                                       struct lbtree_d_finger *finger,
+                                       void *key) {
+  struct lbtree *node = size_node->base.val;
+  unsigned int depth = 0;
+  if ((finger->size_node == size_node) && (finger->depth != 0)) {
+    /* the keys below a branch all match its key in the bits below its index,
+      so `key` passes every branch on the path whose index is no greater than
+      the first bit in which it differs from the deepest */
+    struct lbtree_d *deepest = finger->path[finger->depth - 1];
+    lbtree_index_t index =
+        lbtree_d_index(key, deepest->key, deepest->base.index);
+    depth = finger_count(finger, index, 1);
+    if (depth != 0) {
+      node = &finger->path[--depth]->base;
+    }
+  }
+  finger->size_node = size_node;
+
+  struct lbtree *parent;
+  do {
+    parent = node;
+    if (depth < LBTREE_D_FINGER_SIZE) {
+      finger->path[depth++] = (struct lbtree_d *)parent;
+    }
+    node = parent->children[lbtree_d_sel_key(key, parent->index)];
+  } while (lbtree_index_gt(node->index, parent->index) != 0);
+  finger->depth = depth;
+  return (struct lbtree_d *)node;
+}
+
+void *lbtree_d_finger(struct lbtree_d *size_tree,
+                      struct lbtree_d_finger *finger, void *key,
+                      lbtree_index_t key_size_bits) {
+  struct lbtree_d_size *size_node =
+      finger_size(size_tree, finger, key_size_bits);
+  if (size_node == 0) {
+    return 0;
+  }
+  if (key_size_bits == 0) {
+    struct lbtree_d *key_node = size_node->base.val;
+    return key_node->val;
+  }
+  struct lbtree_d *leaf = finger_descend(size_node, finger, key);
+  return (match(leaf->key, key, key_size_bits) == 0) ? leaf->val : 0;
+}
+
+/* As `node_get`, resuming the descent where `finger` allows */
+static struct lbtree_d *finger_get(struct lbtree_d **size_tree,
+                                   struct lbtree_d_finger *finger, void *key,
+                                   lbtree_index_t key_size_bits, int *found) {
+  struct lbtree_d_size *size_node =
+      finger_size(*size_tree, finger, key_size_bits);
+  if ((size_node == 0) || (key_size_bits == 0)) {
+    return node_get(size_tree, key, key_size_bits, 0, found);
+  }
+  struct lbtree_d *leaf = finger_descend(size_node, finger, key);
+  lbtree_index_t index = lbtree_d_index(key, leaf->key, key_size_bits);
+  if (index == key_size_bits) {
+    *found = 1;
+    return leaf;
+  }
+
+  struct lbtree_d *key_node = malloc(sizeof(*key_node));
+  if (key_node == 0) {
+    return 0;
+  }
+  key_node->key = key;
+  key_node->val = 0;
+  key_node->base.index = index;
+  /* the new branch goes below the branches passed with lower indices, so the
+    add can start from the deepest of them, which it passes rather than
+    replaces, and only needs the real ref to the root if there are none */
+  unsigned int depth = finger_count(finger, index, 0);
+  /* a key differing from its leaf in the bit of the branch holding the leaf
+    takes the branch's invalid ref as a floating node rather than a branch */
+  int floating = (finger_count(finger, index, 1) != depth) ? 1 : 0;
+  struct lbtree *start;
+  struct lbtree **ref = (struct lbtree **)&size_node->base.val;
+  if (depth != 0) {
+    start = &finger->path[depth - 1]->base;
+    ref = &start;
+  }
+  lbtree_add(ref, &lbtree_d_sel_node, &key_node->base);
+  if ((floating == 0) && (depth < LBTREE_D_FINGER_SIZE)) {
+    finger->path[depth] = key_node;
+    finger->depth = depth + 1;
+  }
+  *found = 0;
+  return key_node;
+}
+
+void *lbtree_d_finger_add(struct lbtree_d **size_tree,
+                          struct lbtree_d_finger *finger, void *key,
+                          lbtree_index_t key_size_bits, void *val) {
+  int found;
+  struct lbtree_d *node =
+      finger_get(size_tree, finger, key, key_size_bits, &found);
+  if (node == 0) {
+    return val;
+  }
+  void *old_val = (found != 0) ? node->val : 0;
+  node->key = key;
+  node->val = val;
+  return old_val;
+}
+
+/* bytes from the start of each key that the batch is sorted by, keys that
+  share them being added in the order given */
+#define BATCH_SORT_BYTES (32)
+#define BATCH_DIGIT_COUNT (UCHAR_MAX + 1)
+
+/* Returns the digit of `pair` at byte `pos` of its size followed by its key, as
+  a value whose numeric order is that of the tree. `rev` reverses the bits of a
+  byte, so that the first bit selected becomes the most significant. */
+static unsigned int batch_digit(const struct lbtree_d_pair *pair, size_t pos,
+                                const unsigned char *rev) {
+  if (pos < sizeof(lbtree_index_t)) {
+    return rev[((const unsigned char *)&pair->key_size_bits)[pos]];
+  }
+  pos -= sizeof(lbtree_index_t);
+  lbtree_index_t key_size_bits = pair->key_size_bits;
+  if (pos >= (key_size_bits / CHAR_BIT) + ((key_size_bits % CHAR_BIT) != 0)) {
+    return 0;
+  }
+  unsigned int c = ((const unsigned char *)pair->key)[pos];
+  if (pos == key_size_bits / CHAR_BIT) {
+    /* bits past the end of the key are ignored */
+    c &= (1u << (key_size_bits % CHAR_BIT)) - 1;
+  }
+  return rev[c];
+}
+
+/* Sorts the indices of `pairs` into the order of `lbtree_d_walk` by their sizes
+  and first `BATCH_SORT_BYTES` bytes, with a least significant digit first
+  radix sort that keeps pairs with equal digits in order. `order` and `tmp`
+  have room for `count` indices. Returns the one holding the sorted indices. */
+static size_t *batch_sort(const struct lbtree_d_pair *pairs, size_t count,
+                          size_t *order, size_t *tmp) {
+  unsigned char rev[BATCH_DIGIT_COUNT];
+  unsigned int c;
+  for (c = 0; c < BATCH_DIGIT_COUNT; ++c) {
+    unsigned int r = 0;
+    unsigned int i;
+    for (i = 0; i < CHAR_BIT; ++i) {
+      r |= ((c >> i) & 1) << (CHAR_BIT - 1 - i);
+    }
+    rev[c] = (unsigned char)r;
+  }
+
+  size_t key_bytes = 0;
+  size_t i;
+  for (i = 0; i < count; ++i) {
+    lbtree_index_t key_size_bits = pairs[i].key_size_bits;
+    lbtree_index_t size =
+        (key_size_bits / CHAR_BIT) + ((key_size_bits % CHAR_BIT) != 0);
+    if (size > key_bytes) {
+      key_bytes = (size > BATCH_SORT_BYTES) ? BATCH_SORT_BYTES : (size_t)size;
+    }
+    order[i] = i;
+  }
+
+  /* the size is the most significant, as in the size tree */
+  size_t pos = sizeof(lbtree_index_t) + key_bytes;
+  while (pos-- != 0) {
+    size_t counts[BATCH_DIGIT_COUNT] = {0};
+    for (i = 0; i < count; ++i) {
+      ++counts[batch_digit(&pairs[order[i]], pos, rev)];
+    }
+    /* nothing to do if every pair has the same digit, as is usual for sizes
+      and for the bytes of keys that share a prefix */
+    if (counts[batch_digit(&pairs[order[0]], pos, rev)] == count) {
+      continue;
+    }
+    size_t total = 0;
+    for (c = 0; c < BATCH_DIGIT_COUNT; ++c) {
+      size_t n = counts[c];
+      counts[c] = total;
+      total += n;
+    }
+    for (i = 0; i < count; ++i) {
+      size_t index = order[i];
+      tmp[counts[batch_digit(&pairs[index], pos, rev)]++] = index;
+    }
+    size_t *swap = order;
+    order = tmp;
+    tmp = swap;
+  }
+  return order;
+}
+
+int lbtree_d_add_batch(struct lbtree_d **size_tree, struct lbtree_d_pair *pairs,
+                       size_t count,
+                       void (*action)(const void *key, void *val,
+                                      void *closure),
+                       void *closure) {
+  if (count == 0) {
+    return 0;
+  }
+  /* unsorted pairs are still added correctly, only more slowly */
+  size_t *buf = malloc(count * 2 * sizeof(*buf));
+  size_t *order = (buf == 0) ? 0 : batch_sort(pairs, count, buf, &buf[count]);
+  struct lbtree_d_finger finger;
+  lbtree_d_finger_init(&finger);
+  size_t i;
+  for (i = 0; i < count; ++i) {
+    struct lbtree_d_pair *pair = &pairs[(order == 0) ? i : order[i]];
+    int found;
+    struct lbtree_d *node =
+        finger_get(size_tree, &finger, pair->key, pair->key_size_bits, &found);
+    if (node == 0) {
+      free(buf);
+      return -1;
+    }
+    if ((found != 0) && (action != 0)) {
+      action(node->key, node->val, closure);
+    }
+    node->key = pair->key;
+    node->val = pair->val;
+  }
+  free(buf);
+  return 0;
+}
+
+void *lbtree_d_unlink(struct lbtree_d **size_tree, void *key,
+                      lbtree_index_t key_size_bits, struct lbtree_d **key_node,
+                      struct lbtree_d **size_node) {
+  *key_node = 0;
+  *size_node = 0;
   if (*size_tree == 0) {
     return 0;
   }
-  struct lbtree_leaf_pos size_best_family =
-      lbtree_leaf_pos((struct lbtree **)size_tree, &sel_key, &key_size_bits, 0);
-  struct lbtree_d_size *size_best =
-      (struct lbtree_d_size *)size_best_family.leaf;
+  struct lbtree_rm_pos size_pos = lbtree_rm_pos(
+      (struct lbtree **)size_tree, &lbtree_d_sel_key, &key_size_bits);
+  struct lbtree_d_size *size_best = (struct lbtree_d_size *)size_pos.leaf.leaf;
 
   if (size_best->key_size_bits != key_size_bits) {
     return 0;
   }
 
   if (key_size_bits == 0) {
-    struct lbtree_d *key_best = size_best->base.val;
-    void *old_val = key_best->val;
-    free(key_best);
-    rm_leaf_pos((struct lbtree **)size_tree, &sel_key, &key_size_bits,
-                size_best_family);
-    free(size_best);
-    return old_val;
+    *key_node = size_best->base.val;
+    lbtree_cut(size_pos.branch.ref, size_pos.leaf);
+    *size_node = &size_best->base;
+    return (*key_node)->val;
   }
 
   struct lbtree **key_tree = (struct lbtree **)&size_best->base.val;
-  struct lbtree_leaf_pos key_best_family =
-      lbtree_leaf_pos(key_tree, &sel_key, key, 0);
-  struct lbtree_d *leaf = (struct lbtree_d *)key_best_family.leaf;
+  struct lbtree_rm_pos key_pos =
+      lbtree_rm_pos(key_tree, &lbtree_d_sel_key, key);
+  struct lbtree_d *leaf = (struct lbtree_d *)key_pos.leaf.leaf;
   if (match(leaf->key, key, key_size_bits) != 0) {
     return 0;
   }
-  rm_leaf_pos(key_tree, &sel_key, key, key_best_family);
-
-  void *val = leaf->val;
-  free(leaf);
+  lbtree_cut(key_pos.branch.ref, key_pos.leaf);
+  *key_node = leaf;
 
   if (*key_tree == 0) {
     /* key tree empty, also remove from size_tree */
-    rm_leaf_pos((struct lbtree **)size_tree, &sel_key, &key_size_bits,
-                size_best_family);
-    free(size_best);
+    lbtree_cut(size_pos.branch.ref, size_pos.leaf);
+    *size_node = &size_best->base;
+  }
+  return leaf->val;
+}
+
+void *lbtree_d_rm_node(struct lbtree_d **size_tree, struct lbtree_d *key_node,
+                       lbtree_index_t key_size_bits) {
+  struct lbtree_d_size *size_node =
+      lbtree(&(*size_tree)->base, &lbtree_d_sel_key, &key_size_bits);
+  if (key_size_bits == 0) {
+    /* a lone node whose key must not be read */
+    size_node->base.val = 0;
+  } else {
+    lbtree_rm((struct lbtree **)&size_node->base.val, &lbtree_d_sel_node,
+              &key_node->base);
+  }
+  void *val = key_node->val;
+  free(key_node);
+  if (size_node->base.val == 0) {
+    lbtree_rm((struct lbtree **)size_tree, &lbtree_d_sel_node,
+              &size_node->base.base);
+    free(size_node);
   }
   return val;
 }
 
+void *lbtree_d_rm(struct lbtree_d **size_tree, void *key,
+                  lbtree_index_t key_size_bits) {
+  struct lbtree_d *key_node;
+  struct lbtree_d *size_node;
+  void *val =
+      lbtree_d_unlink(size_tree, key, key_size_bits, &key_node, &size_node);
+  free(key_node);
+  free(size_node);
+  return val;
+}
+
+/* A key whose byte at `char_index` reads as `c`, so that the prefixes making up
+  a range can be formed without copying its bounds */
+struct prefix_key {
+  const unsigned char *key;
+  lbtree_index_t char_index;
+  unsigned char c;
+};
+
+static unsigned int sel_prefix_key(void *v_key, lbtree_index_t index) {
+  struct prefix_key *key = v_key;
+  lbtree_index_t char_index = index / CHAR_BIT;
+  unsigned char c =
+      (char_index == key->char_index) ? key->c : key->key[char_index];
+  return (c >> (index % CHAR_BIT)) & 1;
+}
+
+struct rm_closure {
+  void (*action)(const void *key, void *val, void *closure);
+  void *closure;
+  size_t count;
+};
+
+static void *rm_action(void *node, void *v_closure) {
+  struct lbtree_d *key_node = node;
+  struct rm_closure *closure = v_closure;
+  if (closure->action != 0) {
+    closure->action(key_node->key, key_node->val, closure->closure);
+  }
+  ++closure->count;
+  free(node);
+  return 0;
+}
+
+/* Removes the keys with the prefix from the key tree of `size_node`, which
+  holds keys at least `prefix_size_bits` long */
+static void key_tree_rm_prefix(struct lbtree_d_size *size_node,
+                               struct prefix_key *prefix,
+                               lbtree_index_t prefix_size_bits,
+                               struct rm_closure *closure) {
+  if (size_node->base.val == 0) {
+    return;
+  }
+  if (size_node->key_size_bits == 0) {
+    /* a lone node whose key must not be read */
+    rm_action(size_node->base.val, closure);
+    size_node->base.val = 0;
+    return;
+  }
+  struct lbtree *removed =
+      lbtree_rm_prefix((struct lbtree **)&size_node->base.val, &sel_prefix_key,
+                       &lbtree_d_sel_node, prefix, prefix_size_bits);
+  lbtree_walk(removed, &lbtree_d_sel_node, &rm_action, closure);
+}
+
+/* Links the size nodes whose key trees have been emptied into a list through
+  their values, which are otherwise zero */
+static void *empty_size_action(void *node, void *v_head) {
+  struct lbtree_d *size_node = node;
+  struct lbtree_d **head = v_head;
+  if (size_node->val == 0) {
+    size_node->val = *head;
+    *head = size_node;
+  }
+  return 0;
+}
+
+/* Removes the size nodes whose key trees have been emptied, found in a single
+  walk of the size tree */
+static void rm_empty_sizes(struct lbtree_d **size_tree) {
+  struct lbtree_d *empty = 0;
+  lbtree_walk((struct lbtree *)*size_tree, &lbtree_d_sel_node,
+              &empty_size_action, &empty);
+  while (empty != 0) {
+    struct lbtree_d *next = empty->val;
+    lbtree_rm((struct lbtree **)size_tree, &lbtree_d_sel_node, &empty->base);
+    free(empty);
+    empty = next;
+  }
+}
+
+struct rm_prefix_closure {
+  struct prefix_key prefix;
+  lbtree_index_t prefix_size_bits;
+  struct rm_closure rm;
+};
+
+static void *rm_prefix_size_action(void *node, void *v_closure) {
+  struct lbtree_d_size *size_node = node;
+  struct rm_prefix_closure *closure = v_closure;
+  if (lbtree_index_gt(closure->prefix_size_bits, size_node->key_size_bits) ==
+      0) {
+    key_tree_rm_prefix(size_node, &closure->prefix, closure->prefix_size_bits,
+                       &closure->rm);
+  }
+  return 0;
+}
+
+size_t lbtree_d_rm_prefix(struct lbtree_d **size_tree, void *prefix,
+                          lbtree_index_t prefix_size_bits,
+                          void (*action)(const void *key, void *val,
+                                         void *closure),
+                          void *closure) {
+  struct rm_prefix_closure rm_prefix = {
+      .prefix = {.key = prefix,
+                 .char_index = (prefix_size_bits / CHAR_BIT) + 1,
+                 .c = 0},
+      .prefix_size_bits = prefix_size_bits,
+      .rm = {.action = action, .closure = closure, .count = 0}};
+  lbtree_walk((struct lbtree *)*size_tree, &lbtree_d_sel_node,
+              &rm_prefix_size_action, &rm_prefix);
+  rm_empty_sizes(size_tree);
+  return rm_prefix.rm.count;
+}
+
+/* Removes the keys that match `key` up to byte `char_index`, which reads as
+  each value from `from` to `to` inclusive in turn */
+static void rm_byte_range(struct lbtree_d_size *size_node,
+                          const unsigned char *key, lbtree_index_t char_index,
+                          unsigned int from, unsigned int to,
+                          struct rm_closure *closure) {
+  lbtree_index_t prefix_size_bits = (char_index + 1) * CHAR_BIT;
+  if (lbtree_index_gt(prefix_size_bits, size_node->key_size_bits) != 0) {
+    prefix_size_bits = size_node->key_size_bits;
+  }
+  struct prefix_key prefix = {.key = key, .char_index = char_index, .c = 0};
+  for (; from <= to; ++from) {
+    prefix.c = (unsigned char)from;
+    key_tree_rm_prefix(size_node, &prefix, prefix_size_bits, closure);
+  }
+}
+
+size_t lbtree_d_rm_range(struct lbtree_d **size_tree, void *lo, void *hi,
+                         lbtree_index_t key_size_bits,
+                         void (*action)(const void *key, void *val,
+                                        void *closure),
+                         void *closure) {
+  if (*size_tree == 0) {
+    return 0;
+  }
+  struct lbtree_d_size *size_node =
+      lbtree(&(*size_tree)->base, &lbtree_d_sel_key, &key_size_bits);
+  if (size_node->key_size_bits != key_size_bits) {
+    return 0;
+  }
+
+  struct rm_closure rm = {.action = action, .closure = closure, .count = 0};
+  if (key_size_bits == 0) {
+    key_tree_rm_prefix(size_node, 0, 0, &rm);
+    rm_empty_sizes(size_tree);
+    return rm.count;
+  }
+
+  const unsigned char *l = lo;
+  const unsigned char *h = hi;
+  lbtree_index_t last = (key_size_bits - 1) / CHAR_BIT;
+  /* the largest value of each byte, with only the used bits of the last */
+  unsigned int last_max = (1u << (key_size_bits - (last * CHAR_BIT))) - 1;
+  unsigned int l_last = l[last] & last_max;
+  unsigned int h_last = h[last] & last_max;
+
+  lbtree_index_t c = 0;
+  while ((c < last) && (l[c] == h[c])) {
+    ++c;
+  }
+  unsigned int l_c = (c == last) ? l_last : l[c];
+  unsigned int h_c = (c == last) ? h_last : h[c];
+  if (l_c > h_c) {
+    return 0;
+  }
+  if (l_c == h_c) {
+    /* the bounds are equal */
+    rm_byte_range(size_node, l, c, l_c, l_c, &rm);
+  } else {
+    /* keys whose first differing byte lies strictly between the bounds' */
+    if ((l_c + 1) < h_c) {
+      rm_byte_range(size_node, l, c, l_c + 1, h_c - 1, &rm);
+    }
+    /* keys that share a longer prefix with one of the bounds, and the bounds
+      themselves */
+    lbtree_index_t i;
+    for (i = c + 1; i <= last; ++i) {
+      unsigned int max = (i == last) ? last_max : UCHAR_MAX;
+      unsigned int l_i = (i == last) ? l_last : l[i];
+      unsigned int h_i = (i == last) ? h_last : h[i];
+      if (l_i < max) {
+        rm_byte_range(size_node, l, i, l_i + 1, max, &rm);
+      }
+      if (h_i > 0) {
+        rm_byte_range(size_node, h, i, 0, h_i - 1, &rm);
+      }
+    }
+    rm_byte_range(size_node, l, last, l_last, l_last, &rm);
+    rm_byte_range(size_node, h, last, h_last, h_last, &rm);
+  }
+  rm_empty_sizes(size_tree);
+  return rm.count;
+}
+
+struct split_closure {
+  struct prefix_key prefix;
+  lbtree_index_t prefix_size_bits;
+  struct lbtree_d **dst;
+};
+
+static void *split_size_action(void *node, void *v_closure) {
+  struct lbtree_d_size *size_node = node;
+  struct split_closure *closure = v_closure;
+  if ((size_node->base.val == 0) ||
+      (lbtree_index_gt(closure->prefix_size_bits, size_node->key_size_bits) !=
+       0)) {
+    return 0;
+  }
+  struct lbtree_d_size *split = malloc(sizeof(*split));
+  if (split == 0) {
+    return node;
+  }
+  split->key_size_bits = size_node->key_size_bits;
+  if (size_node->key_size_bits == 0) {
+    /* a lone node whose key must not be read */
+    split->base.val = size_node->base.val;
+    size_node->base.val = 0;
+  } else {
+    split->base.val = lbtree_rm_prefix(
+        (struct lbtree **)&size_node->base.val, &sel_prefix_key,
+        &lbtree_d_sel_node, &closure->prefix, closure->prefix_size_bits);
+  }
+  if (split->base.val == 0) {
+    free(split);
+  } else {
+    struct lbtree_d_size *size_best = 0;
+    if (*closure->dst != 0) {
+      size_best = lbtree(&(*closure->dst)->base, &lbtree_d_sel_key,
+                         &split->key_size_bits);
+    }
+    size_add(closure->dst, split, size_best);
+  }
+  return 0;
+}
+
+int lbtree_d_split(struct lbtree_d **size_tree, struct lbtree_d **dst,
+                   void *prefix, lbtree_index_t prefix_size_bits) {
+  struct split_closure split = {
+      .prefix = {.key = prefix,
+                 .char_index = (prefix_size_bits / CHAR_BIT) + 1,
+                 .c = 0},
+      .prefix_size_bits = prefix_size_bits,
+      .dst = dst};
+  void *error = lbtree_walk((struct lbtree *)*size_tree, &lbtree_d_sel_node,
+                            &split_size_action, &split);
+  rm_empty_sizes(size_tree);
+  return (error != 0) ? -1 : 0;
+}
+
+/* A node of one key tree at or below which are all of that tree's keys with a
+  given prefix, or zero if there are none */
+struct cursor {
+  struct lbtree_d *node;
+  /* non-zero if `node` was reached through a leaf ref, so is the only key */
+  int leaf;
+};
+
+/* Moves the cursor down to the keys with the first `prefix_size_bits` bits of
+  `key`, which must extend the prefix the cursor was at */
+static struct cursor cursor_descend(struct cursor cursor, unsigned char *key,
+                                    lbtree_index_t prefix_size_bits) {
+  if (cursor.node == 0) {
+    return cursor;
+  }
+  while ((cursor.leaf == 0) &&
+         (lbtree_index_gt(prefix_size_bits, cursor.node->base.index) != 0)) {
+    lbtree_index_t index = cursor.node->base.index;
+    struct lbtree_d *next =
+        (struct lbtree_d *)
+            cursor.node->base.children[lbtree_d_sel_key(key, index)];
+    cursor.leaf = (lbtree_index_gt(next->base.index, index) == 0) ? 1 : 0;
+    cursor.node = next;
+  }
+  /* the keys at or below the cursor share the bits below its index */
+  if (lbtree_index_gt(prefix_size_bits,
+                      lbtree_d_index(cursor.node->key, key,
+                                     prefix_size_bits)) != 0) {
+    cursor.node = 0;
+  }
+  return cursor;
+}
+
+struct set_entry {
+  struct lbtree_d_size *size_node;
+  struct lbtree_d *node;
+  /* the bits of the node's key that the keys to remove share, all of them for
+    the node alone */
+  lbtree_index_t prefix_size_bits;
+};
+
+#define SET_ENTRIES_MIN_SIZE (16)
+
+/* A set operation, which recurses over the key tree of one operand with a
+  cursor into the matching key tree of the other */
+struct set_op {
+  /* called with a node of the recursed tree whose subtree has no keys in common
+    with the other tree */
+  int (*region)(struct set_op *op, struct lbtree_d *node);
+  /* called with each other key of the recursed tree and the node with the same
+    key in the other tree, if any */
+  int (*key)(struct set_op *op, struct lbtree_d *node, struct lbtree_d *match);
+  struct lbtree_d **dst;
+  struct lbtree_d *src;
+  /* the destination's size node for the key trees being recursed over */
+  struct lbtree_d_size *size_node;
+  lbtree_index_t key_size_bits;
+  /* removals from the destination, applied once the recursion is over */
+  struct set_entry *entries;
+  size_t entries_size;
+  size_t entries_used;
+  void (*action)(const void *key, void *val, void *closure);
+  void *closure;
+};
+
+static int set_rec(struct set_op *op, struct lbtree_d *node,
+                   struct cursor cursor) {
+  lbtree_index_t index = node->base.index;
+  cursor = cursor_descend(cursor, node->key, index);
+  if (cursor.node == 0) {
+    return op->region(op, node);
+  }
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree_d *child = (struct lbtree_d *)node->base.children[i];
+    if (lbtree_d_sel_node(child, index) != i) {
+      continue;
+    }
+    int r;
+    if (lbtree_index_gt(child->base.index, index) != 0) {
+      r = set_rec(op, child, cursor);
+    } else {
+      r = op->key(op, child,
+                  cursor_descend(cursor, child->key, op->key_size_bits).node);
+    }
+    if (r != 0) {
+      return r;
+    }
+  }
+  return 0;
+}
+
+/* Runs the operation over the key tree `tree` and the other operand's key tree
+  for the same key size, `other`, which may be empty */
+static int set_key_tree(struct set_op *op, struct lbtree_d *tree,
+                        struct lbtree_d *other) {
+  if (op->key_size_bits == 0) {
+    /* lone nodes whose keys must not be read */
+    return (other == 0) ? op->region(op, tree) : op->key(op, tree, other);
+  }
+  struct cursor cursor = {.node = other, .leaf = 0};
+  return set_rec(op, tree, cursor);
+}
+
+/* Returns the size node for `key_size_bits` long keys, or zero if there is
+  none */
+static struct lbtree_d_size *size_find(struct lbtree_d *size_tree,
+                                       lbtree_index_t key_size_bits) {
+  if (size_tree == 0) {
+    return 0;
+  }
+  struct lbtree_d_size *size_node =
+      lbtree(&size_tree->base, &lbtree_d_sel_key, &key_size_bits);
+  return (size_node->key_size_bits == key_size_bits) ? size_node : 0;
+}
+
+static int set_push(struct set_op *op, struct lbtree_d *node,
+                    lbtree_index_t prefix_size_bits) {
+  if (op->entries_used == op->entries_size) {
+    size_t size = (op->entries_size == 0) ? SET_ENTRIES_MIN_SIZE
+                                          : (op->entries_size * 2);
+    struct set_entry *entries = realloc(op->entries, size * sizeof(*entries));
+    if (entries == 0) {
+      return -1;
+    }
+    op->entries = entries;
+    op->entries_size = size;
+  }
+  struct set_entry *entry = &op->entries[op->entries_used++];
+  entry->size_node = op->size_node;
+  entry->node = node;
+  entry->prefix_size_bits = prefix_size_bits;
+  return 0;
+}
+
+/* Applies the removals collected by the recursion and frees the entries */
+static int set_apply(struct set_op *op, int error) {
+  if (error == 0) {
+    struct rm_closure closure = {
+        .action = op->action, .closure = op->closure, .count = 0};
+    size_t i;
+    for (i = 0; i < op->entries_used; ++i) {
+      struct set_entry *entry = &op->entries[i];
+      lbtree_index_t key_size_bits = entry->size_node->key_size_bits;
+      if ((entry->prefix_size_bits == key_size_bits) && (key_size_bits != 0)) {
+        lbtree_rm((struct lbtree **)&entry->size_node->base.val,
+                  &lbtree_d_sel_node, &entry->node->base);
+        rm_action(entry->node, &closure);
+      } else {
+        struct prefix_key prefix = {
+            .key = entry->node->key,
+            .char_index = (entry->prefix_size_bits / CHAR_BIT) + 1,
+            .c = 0};
+        key_tree_rm_prefix(entry->size_node, &prefix, entry->prefix_size_bits,
+                           &closure);
+      }
+    }
+    rm_empty_sizes(op->dst);
+  }
+  free(op->entries);
+  return (error != 0) ? -1 : 0;
+}
+
+static int union_add(struct set_op *op, struct lbtree_d *node) {
+  /* the key is not in the destination, so a non-zero return is an allocation
+    error */
+  return (lbtree_d_add(op->dst, node->key, op->key_size_bits, node->val) != 0)
+             ? -1
+             : 0;
+}
+
+static void *union_add_action(void *node, void *op) {
+  return (union_add(op, node) != 0) ? node : 0;
+}
+
+static int union_region(struct set_op *op, struct lbtree_d *node) {
+  if (op->key_size_bits == 0) {
+    return union_add(op, node);
+  }
+  return (lbtree_walk(&node->base, &lbtree_d_sel_node, &union_add_action,
+                      op) != 0)
+             ? -1
+             : 0;
+}
+
+static int union_key(struct set_op *op, struct lbtree_d *node,
+                     struct lbtree_d *match) {
+  if (match == 0) {
+    return union_add(op, node);
+  }
+  if (op->action != 0) {
+    op->action(match->key, match->val, op->closure);
+  }
+  match->key = node->key;
+  match->val = node->val;
+  return 0;
+}
+
+static void *union_size_action(void *node, void *v_op) {
+  struct lbtree_d_size *size_node = node;
+  struct set_op *op = v_op;
+  struct lbtree_d_size *dst_size_node =
+      size_find(*op->dst, size_node->key_size_bits);
+  op->key_size_bits = size_node->key_size_bits;
+  return (set_key_tree(op, size_node->base.val,
+                       (dst_size_node == 0) ? 0 : dst_size_node->base.val) !=
+          0)
+             ? node
+             : 0;
+}
+
+int lbtree_d_union(struct lbtree_d **dst, struct lbtree_d *src,
+                   void (*action)(const void *key, void *val, void *closure),
+                   void *closure) {
+  struct set_op op = {.region = &union_region,
+                      .key = &union_key,
+                      .dst = dst,
+                      .src = src,
+                      .action = action,
+                      .closure = closure};
+  return (lbtree_walk((struct lbtree *)src, &lbtree_d_sel_node,
+                      &union_size_action, &op) != 0)
+             ? -1
+             : 0;
+}
+
+static int intersect_region(struct set_op *op, struct lbtree_d *node) {
+  return set_push(op, node, node->base.index);
+}
+
+static int intersect_key(struct set_op *op, struct lbtree_d *node,
+                         struct lbtree_d *match) {
+  return (match == 0) ? set_push(op, node, op->key_size_bits) : 0;
+}
+
+static void *intersect_size_action(void *node, void *v_op) {
+  struct lbtree_d_size *size_node = node;
+  struct set_op *op = v_op;
+  struct lbtree_d_size *src_size_node =
+      size_find(op->src, size_node->key_size_bits);
+  op->size_node = size_node;
+  op->key_size_bits = size_node->key_size_bits;
+  return (set_key_tree(op, size_node->base.val,
+                       (src_size_node == 0) ? 0 : src_size_node->base.val) !=
+          0)
+             ? node
+             : 0;
+}
+
+int lbtree_d_intersect(struct lbtree_d **dst, struct lbtree_d *src,
+                       void (*action)(const void *key, void *val,
+                                      void *closure),
+                       void *closure) {
+  struct set_op op = {.region = &intersect_region,
+                      .key = &intersect_key,
+                      .dst = dst,
+                      .src = src,
+                      .action = action,
+                      .closure = closure};
+  return set_apply(&op, (lbtree_walk((struct lbtree *)*dst, &lbtree_d_sel_node,
+                                     &intersect_size_action, &op) != 0)
+                            ? -1
+                            : 0);
+}
+
+static int diff_region(struct set_op *op, struct lbtree_d *node) {
+  (void)op;
+  (void)node;
+  return 0;
+}
+
+static int diff_key(struct set_op *op, struct lbtree_d *node,
+                    struct lbtree_d *match) {
+  (void)node;
+  return (match != 0) ? set_push(op, match, op->key_size_bits) : 0;
+}
+
+static void *diff_size_action(void *node, void *v_op) {
+  struct lbtree_d_size *size_node = node;
+  struct set_op *op = v_op;
+  struct lbtree_d_size *dst_size_node =
+      size_find(*op->dst, size_node->key_size_bits);
+  if (dst_size_node == 0) {
+    return 0;
+  }
+  op->size_node = dst_size_node;
+  op->key_size_bits = size_node->key_size_bits;
+  return (set_key_tree(op, size_node->base.val, dst_size_node->base.val) != 0)
+             ? node
+             : 0;
+}
+
+int lbtree_d_diff(struct lbtree_d **dst, struct lbtree_d *src,
+                  void (*action)(const void *key, void *val, void *closure),
+                  void *closure) {
+  struct set_op op = {.region = &diff_region,
+                      .key = &diff_key,
+                      .dst = dst,
+                      .src = src,
+                      .action = action,
+                      .closure = closure};
+  return set_apply(&op, (lbtree_walk((struct lbtree *)src, &lbtree_d_sel_node,
+                                     &diff_size_action, &op) != 0)
+                            ? -1
+                            : 0);
+}
+
 struct walk_closure {
   void *(*action)(const void *key, void **val, void *closure);
   void *closure;
@@ -250,39 +1129,337 @@ static void *walk_key_action(void *node, void *v_closure) {
 static void *walk_size_action(void *node, void *v_closure) {
   struct lbtree_d_size *dyn_size = node;
   struct lbtree_d *key_tree = dyn_size->base.val;
-  if (dyn_size->key_size_bits == 0) {
+  /* read through the key pointer so that layout compatible wrappers can share
+    the walk */
+  if (*(lbtree_index_t *)dyn_size->base.key == 0) {
     struct walk_closure *closure = v_closure;
     return closure->action(key_tree->key, &key_tree->val, closure->closure);
   }
-  return lbtree_walk(&key_tree->base, &sel_node, &walk_key_action, v_closure);
+  return lbtree_walk(&key_tree->base, &lbtree_d_sel_node, &walk_key_action,
+                     v_closure);
+}
+
+/* Returns the first or last node of the key tree of `size_node` */
+static struct lbtree_d *key_tree_end(struct lbtree_d_size *size_node,
+                                     int last) {
+  if (size_node->key_size_bits == 0) {
+    /* the lone node's key must not be read */
+    return size_node->base.val;
+  }
+  return (last != 0) ? lbtree_last(size_node->base.val, &lbtree_d_sel_node)
+                     : lbtree_first(size_node->base.val, &lbtree_d_sel_node);
+}
+
+/* Returns the node of `tree`, a tree of keys more than zero bits long, that
+  precedes `key` if `pred`, otherwise the one that follows it, or zero if none
+  does */
+static struct lbtree_d *key_tree_adjacent(struct lbtree *tree, void *key,
+                                          lbtree_index_t key_size_bits,
+                                          int pred) {
+  struct lbtree_d *best = lbtree(tree, &lbtree_d_sel_key, key);
+  lbtree_index_t index = lbtree_d_index(key, best->key, key_size_bits);
+  /* the child on the side of `key` that is sought */
+  unsigned int side = (pred != 0) ? 0 : 1;
+
+  /* follow `key` through the branches below the first bit in which it differs
+    from the tree, keeping the nearest subtree passed on the sought side, to
+    the subtree of keys that share those bits */
+  struct lbtree *near = 0;
+  int near_leaf = 0;
+  struct lbtree *node = tree;
+  int leaf = 0;
+  while (lbtree_index_gt(index, node->index) != 0) {
+    lbtree_index_t parent_index = node->index;
+    unsigned int key_sel = lbtree_d_sel_key(key, parent_index);
+    struct lbtree *other = node->children[side];
+    if ((key_sel != side) && (lbtree_d_sel_node(other, parent_index) == side)) {
+      near = other;
+      near_leaf = (lbtree_index_gt(other->index, parent_index) != 0) ? 0 : 1;
+    }
+    node = node->children[key_sel];
+    if (lbtree_index_gt(node->index, parent_index) == 0) {
+      leaf = 1;
+      break;
+    }
+  }
+
+  /* every key in that subtree differs from `key` in the bit `index`, so they
+    are all on the sought side of it or none are */
+  if ((index != key_size_bits) && (lbtree_d_sel_key(key, index) != side)) {
+    return (leaf != 0) ? (struct lbtree_d *)node
+                       : ((pred != 0) ? lbtree_last(node, &lbtree_d_sel_node)
+                                      : lbtree_first(node, &lbtree_d_sel_node));
+  }
+  if ((near == 0) || (near_leaf != 0)) {
+    return (struct lbtree_d *)near;
+  }
+  return (pred != 0) ? lbtree_last(near, &lbtree_d_sel_node)
+                     : lbtree_first(near, &lbtree_d_sel_node);
+}
+
+struct lbtree_d *lbtree_d_first(struct lbtree_d *size_tree,
+                                lbtree_index_t *node_key_size_bits) {
+  if (size_tree == 0) {
+    return 0;
+  }
+  struct lbtree_d_size *size_node =
+      lbtree_first(&size_tree->base, &lbtree_d_sel_node);
+  *node_key_size_bits = size_node->key_size_bits;
+  return key_tree_end(size_node, 0);
+}
+
+struct lbtree_d *lbtree_d_last(struct lbtree_d *size_tree,
+                               lbtree_index_t *node_key_size_bits) {
+  if (size_tree == 0) {
+    return 0;
+  }
+  struct lbtree_d_size *size_node =
+      lbtree_last(&size_tree->base, &lbtree_d_sel_node);
+  *node_key_size_bits = size_node->key_size_bits;
+  return key_tree_end(size_node, 1);
+}
+
+static struct lbtree_d *adjacent(struct lbtree_d *size_tree, void *key,
+                                 lbtree_index_t key_size_bits,
+                                 lbtree_index_t *node_key_size_bits,
+                                 int pred) {
+  if (size_tree == 0) {
+    return 0;
+  }
+  struct lbtree_d_size *size_node =
+      lbtree(&size_tree->base, &lbtree_d_sel_key, &key_size_bits);
+  if ((size_node->key_size_bits == key_size_bits) && (key_size_bits != 0)) {
+    struct lbtree_d *node =
+        key_tree_adjacent(size_node->base.val, key, key_size_bits, pred);
+    if (node != 0) {
+      *node_key_size_bits = key_size_bits;
+      return node;
+    }
+  }
+  /* otherwise the nearest key of the nearest size, which as keys of the size
+    tree are never zero bits long */
+  size_node = (struct lbtree_d_size *)key_tree_adjacent(
+      &size_tree->base, &key_size_bits, sizeof(key_size_bits) * CHAR_BIT,
+      pred);
+  if (size_node == 0) {
+    return 0;
+  }
+  *node_key_size_bits = size_node->key_size_bits;
+  return key_tree_end(size_node, pred);
+}
+
+struct lbtree_d *lbtree_d_succ(struct lbtree_d *size_tree, void *key,
+                               lbtree_index_t key_size_bits,
+                               lbtree_index_t *node_key_size_bits) {
+  return adjacent(size_tree, key, key_size_bits, node_key_size_bits, 0);
+}
+
+struct lbtree_d *lbtree_d_pred(struct lbtree_d *size_tree, void *key,
+                               lbtree_index_t key_size_bits,
+                               lbtree_index_t *node_key_size_bits) {
+  return adjacent(size_tree, key, key_size_bits, node_key_size_bits, 1);
+}
+
+void *lbtree_d_count_add(struct lbtree_d **size_tree, void *key,
+                         lbtree_index_t key_size_bits, void *val) {
+  int found;
+  struct lbtree_d *node =
+      node_get(size_tree, key, key_size_bits, &key_count, &found);
+  if (node == 0) {
+    return val;
+  }
+  void *old_val = (found != 0) ? node->val : 0;
+  node->key = key;
+  node->val = val;
+  return old_val;
+}
+
+void *lbtree_d_count_rm(struct lbtree_d **size_tree, void *key,
+                        lbtree_index_t key_size_bits) {
+  struct lbtree_d_size *size_node = size_find(*size_tree, key_size_bits);
+  if (size_node == 0) {
+    return 0;
+  }
+  struct lbtree **key_tree = (struct lbtree **)&size_node->base.val;
+  struct lbtree_d *leaf = (struct lbtree_d *)*key_tree;
+  if (key_size_bits != 0) {
+    /* only a key in the tree can be uncounted on the way to it */
+    leaf = lbtree(*key_tree, &lbtree_d_sel_key, key);
+    if (match(leaf->key, key, key_size_bits) != 0) {
+      return 0;
+    }
+    lbtree_count_rm_key(key_tree, &lbtree_d_sel_key, &key_count, key);
+  } else {
+    *key_tree = 0;
+  }
+  void *val = leaf->val;
+  free(leaf);
+
+  if (*key_tree == 0) {
+    lbtree_rm((struct lbtree **)size_tree, &lbtree_d_sel_node,
+              &size_node->base.base);
+    free(size_node);
+  }
+  return val;
+}
+
+/* Returns the number of keys in the key tree of `size_node` */
+static size_t key_tree_count(struct lbtree_d_size *size_node) {
+  return *key_count(size_node->base.val);
+}
+
+static void *count_size_action(void *node, void *closure) {
+  *(size_t *)closure += key_tree_count(node);
+  return 0;
+}
+
+size_t lbtree_d_count(struct lbtree_d *size_tree) {
+  size_t count = 0;
+  lbtree_walk((struct lbtree *)size_tree, &lbtree_d_sel_node,
+              &count_size_action, &count);
+  return count;
+}
+
+struct count_prefix_closure {
+  void *prefix;
+  lbtree_index_t prefix_size_bits;
+  size_t count;
+};
+
+static void *count_prefix_size_action(void *node, void *v_closure) {
+  struct lbtree_d_size *size_node = node;
+  struct count_prefix_closure *closure = v_closure;
+  if (lbtree_index_gt(closure->prefix_size_bits, size_node->key_size_bits) !=
+      0) {
+    return 0;
+  }
+  if (size_node->key_size_bits == 0) {
+    /* a lone node whose key must not be read, which only an empty prefix
+      matches */
+    ++closure->count;
+    return 0;
+  }
+  closure->count += lbtree_count_prefix(
+      size_node->base.val, &lbtree_d_sel_key, &lbtree_d_sel_node, &key_count,
+      closure->prefix, closure->prefix_size_bits);
+  return 0;
+}
+
+size_t lbtree_d_count_prefix(struct lbtree_d *size_tree, void *prefix,
+                             lbtree_index_t prefix_size_bits) {
+  struct count_prefix_closure closure = {
+      .prefix = prefix, .prefix_size_bits = prefix_size_bits, .count = 0};
+  lbtree_walk((struct lbtree *)size_tree, &lbtree_d_sel_node,
+              &count_prefix_size_action, &closure);
+  return closure.count;
+}
+
+struct rank_closure {
+  lbtree_index_t key_size_bits;
+  size_t rank;
+};
+
+/* Stops at the size node for the sought size, having counted the keys of the
+  sizes before it */
+static void *rank_size_action(void *node, void *v_closure) {
+  struct lbtree_d_size *size_node = node;
+  struct rank_closure *closure = v_closure;
+  if (size_node->key_size_bits == closure->key_size_bits) {
+    return node;
+  }
+  closure->rank += key_tree_count(size_node);
+  return 0;
+}
+
+size_t lbtree_d_rank(struct lbtree_d *size_tree, void *key,
+                     lbtree_index_t key_size_bits) {
+  struct lbtree_d_size *size_node = size_find(size_tree, key_size_bits);
+  struct lbtree_d *node = 0;
+  if (size_node != 0) {
+    node = size_node->base.val;
+    if (key_size_bits != 0) {
+      node = lbtree(&node->base, &lbtree_d_sel_key, key);
+      if (match(node->key, key, key_size_bits) != 0) {
+        node = 0;
+      }
+    }
+  }
+  if (node == 0) {
+    /* a key not in the tree has the rank of the key after it */
+    node = lbtree_d_succ(size_tree, key, key_size_bits, &key_size_bits);
+    if (node == 0) {
+      return lbtree_d_count(size_tree);
+    }
+  }
+
+  struct rank_closure closure = {.key_size_bits = key_size_bits, .rank = 0};
+  size_node = lbtree_walk((struct lbtree *)size_tree, &lbtree_d_sel_node,
+                          &rank_size_action, &closure);
+  if (key_size_bits != 0) {
+    closure.rank += lbtree_count_rank(size_node->base.val, &lbtree_d_sel_node,
+                                      &key_count, &node->base);
+  }
+  return closure.rank;
+}
+
+/* Stops at the size node holding the key of the sought rank, leaving its rank
+  among the keys of that size */
+static void *select_size_action(void *node, void *v_rank) {
+  size_t *rank = v_rank;
+  size_t count = key_tree_count(node);
+  if (*rank < count) {
+    return node;
+  }
+  *rank -= count;
+  return 0;
+}
+
+struct lbtree_d *lbtree_d_select(struct lbtree_d *size_tree, size_t rank,
+                                 lbtree_index_t *node_key_size_bits) {
+  struct lbtree_d_size *size_node =
+      lbtree_walk((struct lbtree *)size_tree, &lbtree_d_sel_node,
+                  &select_size_action, &rank);
+  if (size_node == 0) {
+    return 0;
+  }
+  *node_key_size_bits = size_node->key_size_bits;
+  return (size_node->key_size_bits == 0)
+             ? size_node->base.val
+             : lbtree_count_select(size_node->base.val, &lbtree_d_sel_node,
+                                   &key_count, rank);
 }
 
 void *lbtree_d_walk(struct lbtree_d *size_tree,
                     void *(*action)(const void *key, void **val, void *closure),
                     void *v_closure) {
   struct walk_closure closure = {.action = action, .closure = v_closure};
-  return lbtree_walk(&size_tree->base, &sel_node, &walk_size_action, &closure);
-}
-
-static void *free_key_action(void *node, void *closure) {
-  (void)closure;
-  free(node);
-  return 0;
+  return lbtree_walk(&size_tree->base, &lbtree_d_sel_node, &walk_size_action,
+                     &closure);
 }
 
 static void *free_size_action(void *node, void *closure) {
-  (void)closure;
-  struct lbtree_d_size *dyn_size = node;
-  struct lbtree_d *key_tree = dyn_size->base.val;
-  if (dyn_size->key_size_bits == 0) {
-    free(key_tree);
+  struct lbtree_d_size *size_node = node;
+  struct lbtree_d *key_tree = size_node->base.val;
+  if (size_node->key_size_bits == 0) {
+    rm_action(key_tree, closure);
   } else {
-    lbtree_walk(&key_tree->base, &sel_node, &free_key_action, 0);
+    lbtree_walk(&key_tree->base, &lbtree_d_sel_node, &rm_action, closure);
   }
   free(node);
   return 0;
 }
 
+void lbtree_d_free_action(struct lbtree_d *size_tree,
+                          void (*action)(const void *key, void *val,
+                                         void *closure),
+                          void *closure) {
+  if (size_tree == 0) {
+    return;
+  }
+  struct rm_closure rm = {.action = action, .closure = closure, .count = 0};
+  lbtree_walk(&size_tree->base, &lbtree_d_sel_node, &free_size_action, &rm);
+}
+
 void lbtree_d_free(struct lbtree_d *size_tree) {
-  lbtree_walk(&size_tree->base, &sel_node, &free_size_action, 0);
+  lbtree_d_free_action(size_tree, 0, 0);
 }
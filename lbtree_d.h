@@ -19,6 +19,7 @@
 #include "lbtree.h"
 
 #include <limits.h>
+#include <stddef.h>
 
 struct lbtree_d {
   struct lbtree base;
@@ -26,6 +27,27 @@ struct lbtree_d {
   void *val;
 };
 
+/* Node of the size tree, whose key points at its own `key_size_bits` and whose
+  value is the key tree for keys of that size */
+struct lbtree_d_size {
+  struct lbtree_d base;
+  lbtree_index_t key_size_bits;
+};
+
+/*
+Bit selectors used by both the size tree and the key trees, exposed for wrappers
+that manipulate lbtree_d nodes directly.
+*/
+unsigned int lbtree_d_sel_key(void *key, lbtree_index_t index);
+unsigned int lbtree_d_sel_node(void *node, lbtree_index_t index);
+
+/*
+Returns the index of the first bit that differs between keys `a` and `b`, both
+`size_bits` long, or `size_bits` if they are equal.
+*/
+lbtree_index_t lbtree_d_index(const void *a, const void *b,
+                              lbtree_index_t size_bits);
+
 /*
 Adds a key value pair to the tree, the value pointed to by `key` must persist
 through any key value pair's lifetime as part of the tree.
@@ -44,6 +66,55 @@ static inline void *lbtree_dc_add(struct lbtree_d **size_tree, void *key,
              : lbtree_d_add(size_tree, key, key_size_bits, val);
 }
 
+/*
+Finds the value associated with `key`, adding a key value pair with a zero value
+if there is none, in a single descent of the tree. The key of an existing pair
+is not replaced, while the value pointed to by `key` must persist as for
+`lbtree_d_add` if a pair is added.
+Returns a pointer to the value, valid until the pair is removed, or zero on
+memory allocation error.
+*/
+void **lbtree_d_slot(struct lbtree_d **size_tree, void *key,
+                     lbtree_index_t key_size_bits);
+
+static inline void **lbtree_dc_slot(struct lbtree_d **size_tree, void *key,
+                                    lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_d_slot(size_tree, key, key_size_bits);
+}
+
+/* Returns the key node holding the value pointed to by `slot` */
+static inline struct lbtree_d *lbtree_d_slot_node(void **slot) {
+  return (struct lbtree_d *)((unsigned char *)slot -
+                             offsetof(struct lbtree_d, val));
+}
+
+/*
+Sets the value associated with `key` to the result of `merge`, which is passed
+the current value and non-zero as `found` if the key is in the tree, otherwise
+zero for both, in which case a key value pair is added as by `lbtree_d_slot`.
+Returns non-zero on memory allocation error, in which case `merge` is not called
+and the tree is unchanged.
+*/
+int lbtree_d_upsert(struct lbtree_d **size_tree, void *key,
+                    lbtree_index_t key_size_bits,
+                    void *(*merge)(void *val, int found, void *closure),
+                    void *closure);
+
+static inline int
+lbtree_dc_upsert(struct lbtree_d **size_tree, void *key,
+                 lbtree_index_t key_size,
+                 void *(*merge)(void *val, int found, void *closure),
+                 void *closure) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? -1
+             : lbtree_d_upsert(size_tree, key, key_size_bits, merge,
+                               closure);
+}
+
 /*
 Performs a lookup on the tree.
 Returns the value whose associated key matches the `key` argument, or zero if
@@ -60,6 +131,90 @@ static inline void *lbtree_dc(struct lbtree_d *size_tree, void *key,
              : lbtree_d(size_tree, key, key_size_bits);
 }
 
+/*
+Returns the key node whose key matches `key`, or zero if one is not found, for
+wrappers that keep more than the value in a key node.
+*/
+struct lbtree_d *lbtree_d_node_find(struct lbtree_d *size_tree, void *key,
+                                    lbtree_index_t key_size_bits);
+
+#define LBTREE_D_FINGER_SIZE (64)
+
+/*
+A finger remembers the branches passed by the last lookup or add made with it,
+so that the next, for a key that begins with the same bits, can resume from the
+deepest of them that it shares rather than from the root. Keys are split from
+their first bit, so this suits keys that are close in `memcmp` order or that
+share long prefixes, such as sorted strings or big endian integers.
+A finger belongs to one tree and must be initialised with `lbtree_d_finger_init`
+before use and again after any key value pair is removed from that tree.
+*/
+struct lbtree_d_finger {
+  struct lbtree_d_size *size_node;
+  /* branches of the key tree of `size_node` passed by the last descent, each
+    below the one before it */
+  struct lbtree_d *path[LBTREE_D_FINGER_SIZE];
+  unsigned int depth;
+};
+
+static inline void lbtree_d_finger_init(struct lbtree_d_finger *finger) {
+  finger->size_node = 0;
+  finger->depth = 0;
+}
+
+/*
+As `lbtree_d` and `lbtree_d_add`, resuming the descent where `finger` allows.
+*/
+void *lbtree_d_finger(struct lbtree_d *size_tree,
+                      struct lbtree_d_finger *finger, void *key,
+                      lbtree_index_t key_size_bits);
+void *lbtree_d_finger_add(struct lbtree_d **size_tree,
+                          struct lbtree_d_finger *finger, void *key,
+                          lbtree_index_t key_size_bits, void *val);
+
+static inline void *lbtree_dc_finger(struct lbtree_d *size_tree,
+                                     struct lbtree_d_finger *finger, void *key,
+                                     lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_d_finger(size_tree, finger, key, key_size_bits);
+}
+
+static inline void *lbtree_dc_finger_add(struct lbtree_d **size_tree,
+                                         struct lbtree_d_finger *finger,
+                                         void *key, lbtree_index_t key_size,
+                                         void *val) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? key
+             : lbtree_d_finger_add(size_tree, finger, key, key_size_bits,
+                                   val);
+}
+
+struct lbtree_d_pair {
+  void *key;
+  lbtree_index_t key_size_bits;
+  void *val;
+};
+
+/*
+Adds `count` key value pairs, as if by `lbtree_d_add` in the order given, so
+that of pairs with matching keys the last is kept. The pairs are first sorted
+into the order of `lbtree_d_walk` by a radix sort of their sizes and first bytes
+and then added through a finger, so that each descent resumes from the deepest
+branch shared with the key before it rather than from the root. `action`, if not
+null, is called with the key and value of each pair that is replaced, whether
+it was in the tree or earlier in the batch.
+Returns non-zero on memory allocation error, in which case some of the pairs
+may not have been added.
+*/
+int lbtree_d_add_batch(struct lbtree_d **size_tree, struct lbtree_d_pair *pairs,
+                       size_t count,
+                       void (*action)(const void *key, void *val,
+                                      void *closure),
+                       void *closure);
+
 /*
 Removes a single key value pair from the tree.
 Returns the associated value if found and removed, otherwise zero.
@@ -75,6 +230,128 @@ static inline void *lbtree_dc_rm(struct lbtree_d **size_tree, void *key,
              : lbtree_d_rm(size_tree, key, key_size_bits);
 }
 
+/*
+Unlinks a single key value pair from the tree without freeing anything, for
+wrappers that manage the memory of the nodes. `key_node` is set to the unlinked
+key node, or zero if no matching key was found, and `size_node` to the size node
+if it was also unlinked because its key tree became empty, otherwise zero.
+Returns the associated value if found, otherwise zero.
+*/
+void *lbtree_d_unlink(struct lbtree_d **size_tree, void *key,
+                      lbtree_index_t key_size_bits, struct lbtree_d **key_node,
+                      struct lbtree_d **size_node);
+
+/*
+Removes and frees `key_node`, which must be in the tree with a key
+`key_size_bits` long. No keys are compared, but the node is still reached by a
+descent from the root of its key tree, as in a lookup. The size node is also
+removed if its key tree becomes empty.
+Returns the value of the removed node.
+*/
+void *lbtree_d_rm_node(struct lbtree_d **size_tree, struct lbtree_d *key_node,
+                       lbtree_index_t key_size_bits);
+
+/*
+Removes every key value pair whose key is at least `prefix_size_bits` long and
+begins with the first `prefix_size_bits` bits of `prefix`. The matching pairs of
+each key size are detached from the tree together rather than looked up and
+removed one at a time. `action`, if not null, is called with the key and value
+of each removed pair before its node is freed.
+Returns the number of key value pairs removed.
+*/
+size_t lbtree_d_rm_prefix(struct lbtree_d **size_tree, void *prefix,
+                          lbtree_index_t prefix_size_bits,
+                          void (*action)(const void *key, void *val,
+                                         void *closure),
+                          void *closure);
+
+static inline size_t
+lbtree_dc_rm_prefix(struct lbtree_d **size_tree, void *prefix,
+                    lbtree_index_t prefix_size,
+                    void (*action)(const void *key, void *val, void *closure),
+                    void *closure) {
+  lbtree_index_t prefix_size_bits = prefix_size * CHAR_BIT;
+  return ((prefix_size_bits / CHAR_BIT) != prefix_size)
+             ? 0
+             : lbtree_d_rm_prefix(size_tree, prefix, prefix_size_bits, action,
+                                  closure);
+}
+
+/*
+Removes every key value pair with a `key_size_bits` long key from `lo` to `hi`
+inclusive, keys being ordered as by `memcmp` with any bits past `key_size_bits`
+in the last byte ignored. The tree orders keys from their least significant
+bits, so the range is removed as a series of prefixes, one for each byte value
+between the bounds at each byte position, each detached as by
+`lbtree_d_rm_prefix`. `action` is as for `lbtree_d_rm_prefix`.
+Returns the number of key value pairs removed.
+*/
+size_t lbtree_d_rm_range(struct lbtree_d **size_tree, void *lo, void *hi,
+                         lbtree_index_t key_size_bits,
+                         void (*action)(const void *key, void *val,
+                                        void *closure),
+                         void *closure);
+
+static inline size_t
+lbtree_dc_rm_range(struct lbtree_d **size_tree, void *lo, void *hi,
+                   lbtree_index_t key_size,
+                   void (*action)(const void *key, void *val, void *closure),
+                   void *closure) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_d_rm_range(size_tree, lo, hi, key_size_bits, action,
+                                 closure);
+}
+
+/*
+Moves every key value pair whose key is at least `prefix_size_bits` long and
+begins with the first `prefix_size_bits` bits of `prefix` into the empty tree
+`dst`, splitting the tree in two. The matching part of each key tree is detached
+and moved as it is, in time that depends on the depth of the trees rather than
+on the number of pairs moved, and no pair is copied or reallocated.
+Returns non-zero on memory allocation error, in which case only some of the
+pairs have been moved, every pair being in one of the two trees.
+*/
+int lbtree_d_split(struct lbtree_d **size_tree, struct lbtree_d **dst,
+                   void *prefix, lbtree_index_t prefix_size_bits);
+
+static inline int lbtree_dc_split(struct lbtree_d **size_tree,
+                                  struct lbtree_d **dst, void *prefix,
+                                  lbtree_index_t prefix_size) {
+  lbtree_index_t prefix_size_bits = prefix_size * CHAR_BIT;
+  return ((prefix_size_bits / CHAR_BIT) != prefix_size)
+             ? -1
+             : lbtree_d_split(size_tree, dst, prefix, prefix_size_bits);
+}
+
+/*
+Set operations, which make the tree `dst` the union, intersection or difference
+of itself and `src`. Each recurses over the key trees of one operand while
+following the matching part of the other's, so that parts of either tree with no
+keys in common with the other are passed over (or, for an intersection, removed)
+whole rather than looked up a key at a time.
+`lbtree_d_union` adds the key value pairs of `src` to `dst`, replacing the key
+and value of pairs already in `dst` as `lbtree_d_add` does and calling `action`,
+if not null, with each replaced key and value. The keys of `src` must persist
+as for `lbtree_d_add`.
+`lbtree_d_intersect` removes the pairs of `dst` whose keys are not in `src`, and
+`lbtree_d_diff` those whose keys are, calling `action`, if not null, with the
+key and value of each removed pair before its node is freed.
+Return non-zero on memory allocation error, in which case an intersection or
+difference leaves `dst` unchanged and a union may have added only some pairs.
+*/
+int lbtree_d_union(struct lbtree_d **dst, struct lbtree_d *src,
+                   void (*action)(const void *key, void *val, void *closure),
+                   void *closure);
+int lbtree_d_intersect(struct lbtree_d **dst, struct lbtree_d *src,
+                       void (*action)(const void *key, void *val,
+                                      void *closure),
+                       void *closure);
+int lbtree_d_diff(struct lbtree_d **dst, struct lbtree_d *src,
+                  void (*action)(const void *key, void *val, void *closure),
+                  void *closure);
+
 /*
 Calls `action` once for each key value pair in the tree. The walk will stop when
 any action returns a non-null pointer. Returns the action return value causing
@@ -84,9 +361,188 @@ void *lbtree_d_walk(struct lbtree_d *size_tree,
                     void *(*action)(const void *key, void **val, void *closure),
                     void *closure);
 
+/*
+Order queries, in the order of `lbtree_d_walk`. Keys of one size are ordered by
+the first bit in which they differ, reading bytes in memory order and each byte
+from its least significant bit, the key with a zero in that bit coming first.
+This is `memcmp` order only for keys whose bytes have their bits reversed, so a
+little endian integer key is ordered by its bits from the least significant up
+rather than by value. Keys of different sizes are ordered by their sizes in
+bits, compared in the same way as keys `sizeof(lbtree_index_t)` bytes long.
+
+`lbtree_d_first` and `lbtree_d_last` return the first and last key nodes of the
+tree, or zero if it is empty. `lbtree_d_succ` and `lbtree_d_pred` return the
+key node that follows or precedes `key`, which need not be in the tree, or zero
+if there is none. The key and value are read from the returned node, and the
+size in bits of its key is written to `node_key_size_bits` if one is returned.
+Each takes time that depends on the depth of the tree, not on the number of
+keys.
+*/
+struct lbtree_d *lbtree_d_first(struct lbtree_d *size_tree,
+                                lbtree_index_t *node_key_size_bits);
+struct lbtree_d *lbtree_d_last(struct lbtree_d *size_tree,
+                               lbtree_index_t *node_key_size_bits);
+struct lbtree_d *lbtree_d_succ(struct lbtree_d *size_tree, void *key,
+                               lbtree_index_t key_size_bits,
+                               lbtree_index_t *node_key_size_bits);
+struct lbtree_d *lbtree_d_pred(struct lbtree_d *size_tree, void *key,
+                               lbtree_index_t key_size_bits,
+                               lbtree_index_t *node_key_size_bits);
+
+static inline struct lbtree_d *lbtree_dc_first(struct lbtree_d *size_tree,
+                                               lbtree_index_t *node_key_size) {
+  struct lbtree_d *node = lbtree_d_first(size_tree, node_key_size);
+  if (node != 0) {
+    *node_key_size /= CHAR_BIT;
+  }
+  return node;
+}
+
+static inline struct lbtree_d *lbtree_dc_last(struct lbtree_d *size_tree,
+                                              lbtree_index_t *node_key_size) {
+  struct lbtree_d *node = lbtree_d_last(size_tree, node_key_size);
+  if (node != 0) {
+    *node_key_size /= CHAR_BIT;
+  }
+  return node;
+}
+
+static inline struct lbtree_d *lbtree_dc_succ(struct lbtree_d *size_tree,
+                                              void *key,
+                                              lbtree_index_t key_size,
+                                              lbtree_index_t *node_key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  if ((key_size_bits / CHAR_BIT) != key_size) {
+    return 0;
+  }
+  struct lbtree_d *node =
+      lbtree_d_succ(size_tree, key, key_size_bits, node_key_size);
+  if (node != 0) {
+    *node_key_size /= CHAR_BIT;
+  }
+  return node;
+}
+
+static inline struct lbtree_d *lbtree_dc_pred(struct lbtree_d *size_tree,
+                                              void *key,
+                                              lbtree_index_t key_size,
+                                              lbtree_index_t *node_key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  if ((key_size_bits / CHAR_BIT) != key_size) {
+    return 0;
+  }
+  struct lbtree_d *node =
+      lbtree_d_pred(size_tree, key, key_size_bits, node_key_size);
+  if (node != 0) {
+    *node_key_size /= CHAR_BIT;
+  }
+  return node;
+}
+
+/*
+Counted trees are built from key nodes that also hold the number of keys below
+the branch each makes, so that keys can be counted by prefix and found by their
+position in the order of `lbtree_d_walk` in time that depends on the depth of
+the tree, once for each key size, rather than on the number of keys. A counted
+tree must only be changed through `lbtree_d_count_add` and `lbtree_d_count_rm`,
+which otherwise behave as `lbtree_d_add` and `lbtree_d_rm`, and can be read and
+freed by any function that does not change the tree.
+*/
+struct lbtree_d_count {
+  struct lbtree_d base;
+  size_t count;
+};
+
+void *lbtree_d_count_add(struct lbtree_d **size_tree, void *key,
+                         lbtree_index_t key_size_bits, void *val);
+
+static inline void *lbtree_dc_count_add(struct lbtree_d **size_tree, void *key,
+                                        lbtree_index_t key_size, void *val) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? key
+             : lbtree_d_count_add(size_tree, key, key_size_bits, val);
+}
+
+void *lbtree_d_count_rm(struct lbtree_d **size_tree, void *key,
+                        lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dc_count_rm(struct lbtree_d **size_tree, void *key,
+                                       lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_d_count_rm(size_tree, key, key_size_bits);
+}
+
+/*
+Returns the number of keys in the counted tree.
+*/
+size_t lbtree_d_count(struct lbtree_d *size_tree);
+
+/*
+Returns the number of keys in the counted tree that are at least
+`prefix_size_bits` long and begin with the first `prefix_size_bits` bits of
+`prefix`, the keys that `lbtree_d_rm_prefix` would remove.
+*/
+size_t lbtree_d_count_prefix(struct lbtree_d *size_tree, void *prefix,
+                             lbtree_index_t prefix_size_bits);
+
+static inline size_t lbtree_dc_count_prefix(struct lbtree_d *size_tree,
+                                            void *prefix,
+                                            lbtree_index_t prefix_size) {
+  lbtree_index_t prefix_size_bits = prefix_size * CHAR_BIT;
+  return ((prefix_size_bits / CHAR_BIT) != prefix_size)
+             ? 0
+             : lbtree_d_count_prefix(size_tree, prefix, prefix_size_bits);
+}
+
+/*
+Returns the number of keys in the counted tree that come before `key`, which
+need not be in the tree, in the order of `lbtree_d_walk`.
+*/
+size_t lbtree_d_rank(struct lbtree_d *size_tree, void *key,
+                     lbtree_index_t key_size_bits);
+
+static inline size_t lbtree_dc_rank(struct lbtree_d *size_tree, void *key,
+                                    lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_d_rank(size_tree, key, key_size_bits);
+}
+
+/*
+Returns the key node of the counted tree with `rank` keys before it in the order
+of `lbtree_d_walk`, writing the size in bits of its key to `node_key_size_bits`,
+or zero if the tree holds no more than `rank` keys.
+*/
+struct lbtree_d *lbtree_d_select(struct lbtree_d *size_tree, size_t rank,
+                                 lbtree_index_t *node_key_size_bits);
+
+static inline struct lbtree_d *lbtree_dc_select(struct lbtree_d *size_tree,
+                                                size_t rank,
+                                                lbtree_index_t *node_key_size) {
+  struct lbtree_d *node = lbtree_d_select(size_tree, rank, node_key_size);
+  if (node != 0) {
+    *node_key_size /= CHAR_BIT;
+  }
+  return node;
+}
+
 /*
 Frees all the nodes in the tree.
 */
 void lbtree_d_free(struct lbtree_d *size_tree);
 
+/*
+Frees all the nodes in the tree as `lbtree_d_free` does, calling `action`, if
+not null, with the key and value of each key value pair before its node is
+freed.
+*/
+void lbtree_d_free_action(struct lbtree_d *size_tree,
+                          void (*action)(const void *key, void *val,
+                                         void *closure),
+                          void *closure);
+
 #endif
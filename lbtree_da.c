@@ -0,0 +1,353 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Wrapper around lbtree_d that keeps copies of the keys in an arena, appended
+  in insertion order and repacked in walk order */
+
+#include "lbtree_da.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define KEYS_MIN_SIZE (64)
+
+static size_t key_size(lbtree_index_t key_size_bits) {
+  return (key_size_bits / CHAR_BIT) +
+         (((key_size_bits % CHAR_BIT) != 0) ? 1 : 0);
+}
+
+struct repack_closure {
+  unsigned char *keys;
+  size_t used;
+  size_t key_size;
+};
+
+static void *repack_key_action(void *node, void *v_closure) {
+  struct lbtree_d *key_node = node;
+  struct repack_closure *closure = v_closure;
+  unsigned char *key = closure->keys + closure->used;
+  memcpy(key, key_node->key, closure->key_size);
+  key_node->key = key;
+  closure->used += closure->key_size;
+  return 0;
+}
+
+static void *repack_size_action(void *node, void *v_closure) {
+  struct lbtree_d *size_node = node;
+  struct repack_closure *closure = v_closure;
+  lbtree_index_t key_size_bits = *(lbtree_index_t *)size_node->key;
+  closure->key_size = key_size(key_size_bits);
+  if (key_size_bits == 0) {
+    return repack_key_action(size_node->val, closure);
+  }
+  return lbtree_walk(size_node->val, &lbtree_d_sel_node, &repack_key_action,
+                     closure);
+}
+
+/* Moves the live keys into a new arena of `size` bytes. Returns non-zero on
+  memory allocation error, in which case the arena is unchanged. */
+static int repack(struct lbtree_da *tree, size_t size) {
+  unsigned char *keys = malloc(size);
+  if (keys == 0) {
+    return -1;
+  }
+  struct repack_closure closure = {.keys = keys, .used = 0, .key_size = 0};
+  lbtree_walk((struct lbtree *)tree->size_tree, &lbtree_d_sel_node,
+              &repack_size_action, &closure);
+  free(tree->keys);
+  tree->keys = keys;
+  tree->keys_size = size;
+  tree->keys_used = closure.used;
+  tree->keys_dead = 0;
+  return 0;
+}
+
+static size_t repack_size(size_t live) {
+  return (live > (KEYS_MIN_SIZE / 2)) ? (live * 2) : KEYS_MIN_SIZE;
+}
+
+static int in_nodes(unsigned char *nodes, size_t nodes_size, void *node) {
+  return (((uintptr_t)node - (uintptr_t)nodes) < nodes_size) ? 1 : 0;
+}
+
+/* Frees a node that has left the tree, or drops it from the node arena */
+static void node_release(struct lbtree_da *tree, void *node) {
+  if (in_nodes(tree->nodes, tree->nodes_size, node) == 0) {
+    free(node);
+    return;
+  }
+  --tree->nodes_live;
+  if (tree->nodes_live == 0) {
+    free(tree->nodes);
+    tree->nodes = 0;
+    tree->nodes_size = 0;
+  }
+}
+
+void lbtree_da_init(struct lbtree_da *tree) {
+  tree->size_tree = 0;
+  tree->keys = 0;
+  tree->keys_size = 0;
+  tree->keys_used = 0;
+  tree->keys_dead = 0;
+  tree->nodes = 0;
+  tree->nodes_size = 0;
+  tree->nodes_live = 0;
+}
+
+void *lbtree_da_add(struct lbtree_da *tree, void *key,
+                    lbtree_index_t key_size_bits, void *val) {
+  struct lbtree_d *node =
+      lbtree_d_node_find(tree->size_tree, key, key_size_bits);
+  if (node != 0) {
+    /* keep the existing copy of the key */
+    void *old_val = node->val;
+    node->val = val;
+    return old_val;
+  }
+
+  size_t size = key_size(key_size_bits);
+  if ((tree->keys == 0) || ((tree->keys_size - tree->keys_used) < size)) {
+    if (repack(tree, repack_size(tree->keys_used - tree->keys_dead + size)) !=
+        0) {
+      return val;
+    }
+  }
+  unsigned char *copy = tree->keys + tree->keys_used;
+  memcpy(copy, key, size);
+  /* the key was not found above, so a non-zero return is an allocation error */
+  if (lbtree_d_add(&tree->size_tree, copy, key_size_bits, val) != 0) {
+    return val;
+  }
+  tree->keys_used += size;
+  return 0;
+}
+
+void *lbtree_da_rm(struct lbtree_da *tree, void *key,
+                   lbtree_index_t key_size_bits) {
+  struct lbtree_d *key_node;
+  struct lbtree_d *size_node;
+  void *val = lbtree_d_unlink(&tree->size_tree, key, key_size_bits, &key_node,
+                              &size_node);
+  if (key_node == 0) {
+    return 0;
+  }
+  node_release(tree, key_node);
+  if (size_node != 0) {
+    node_release(tree, size_node);
+  }
+
+  if (tree->size_tree == 0) {
+    free(tree->keys);
+    lbtree_da_init(tree);
+    return val;
+  }
+  tree->keys_dead += key_size(key_size_bits);
+  if (tree->keys_dead > (tree->keys_used / 2)) {
+    /* on memory allocation error the removed keys just stay until the next
+      repack */
+    (void)repack(tree, repack_size(tree->keys_used - tree->keys_dead));
+  }
+  return val;
+}
+
+struct count_closure {
+  size_t size_nodes;
+  size_t key_nodes;
+  size_t keys_used;
+  size_t key_size;
+};
+
+static void *count_key_action(void *node, void *v_closure) {
+  (void)node;
+  struct count_closure *closure = v_closure;
+  ++closure->key_nodes;
+  closure->keys_used += closure->key_size;
+  return 0;
+}
+
+static void *count_size_action(void *node, void *v_closure) {
+  struct lbtree_d_size *size_node = node;
+  struct count_closure *closure = v_closure;
+  ++closure->size_nodes;
+  closure->key_size = key_size(size_node->key_size_bits);
+  if (size_node->key_size_bits == 0) {
+    return count_key_action(size_node->base.val, closure);
+  }
+  return lbtree_walk(size_node->base.val, &lbtree_d_sel_node,
+                     &count_key_action, closure);
+}
+
+struct compact_closure {
+  unsigned char *nodes;
+  size_t nodes_size;
+  /* next free size node and key node in `nodes` */
+  struct lbtree_d_size *size_next;
+  struct lbtree_d *key_next;
+  /* the nodes that were copied, in the order they were copied */
+  struct lbtree **old;
+  size_t old_count;
+  unsigned char *keys;
+  size_t keys_used;
+  size_t key_size;
+};
+
+/* Copies `node`, the nodes positioned below it and the floating nodes whose
+  leaf refs they hold, in depth first order. The first child of each copied
+  node is left pointing at its copy, for `compact_fix` to follow. */
+static void compact_copy(struct compact_closure *closure, struct lbtree *node,
+                         int is_size) {
+  struct lbtree_d *copy;
+  if (is_size != 0) {
+    struct lbtree_d_size *size_copy = closure->size_next++;
+    *size_copy = *(struct lbtree_d_size *)node;
+    size_copy->base.key = (unsigned char *)&size_copy->key_size_bits;
+    copy = &size_copy->base;
+  } else {
+    copy = closure->key_next++;
+    *copy = *(struct lbtree_d *)node;
+    unsigned char *key = closure->keys + closure->keys_used;
+    memcpy(key, copy->key, closure->key_size);
+    copy->key = key;
+    closure->keys_used += closure->key_size;
+  }
+  closure->old[closure->old_count++] = node;
+  node->children[0] = &copy->base;
+
+  lbtree_index_t index = copy->base.index;
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree *child = copy->base.children[i];
+    if (child == node) {
+      continue;
+    }
+    /* a leaf ref to a node that is not an ancestor, and so not yet copied, is
+      to a floating node */
+    if ((lbtree_index_gt(child->index, index) != 0) ||
+        ((lbtree_d_sel_node(child, index) == i) &&
+         (in_nodes(closure->nodes, closure->nodes_size, child->children[0]) ==
+          0))) {
+      compact_copy(closure, child, is_size);
+    }
+  }
+}
+
+/* Points the children of `copy` at the copies of the nodes they pointed at */
+static void compact_fix(struct lbtree *copy) {
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    copy->children[i] = copy->children[i]->children[0];
+  }
+}
+
+int lbtree_da_compact(struct lbtree_da *tree) {
+  if (tree->size_tree == 0) {
+    return 0;
+  }
+  struct count_closure count = {
+      .size_nodes = 0, .key_nodes = 0, .keys_used = 0, .key_size = 0};
+  lbtree_walk(&tree->size_tree->base, &lbtree_d_sel_node, &count_size_action,
+              &count);
+
+  size_t size_nodes_size = count.size_nodes * sizeof(struct lbtree_d_size);
+  size_t nodes_size =
+      size_nodes_size + (count.key_nodes * sizeof(struct lbtree_d));
+  size_t keys_size = repack_size(count.keys_used);
+  unsigned char *nodes = malloc(nodes_size);
+  unsigned char *keys = malloc(keys_size);
+  struct lbtree **old =
+      malloc((count.size_nodes + count.key_nodes) * sizeof(*old));
+  if ((nodes == 0) || (keys == 0) || (old == 0)) {
+    free(nodes);
+    free(keys);
+    free(old);
+    return -1;
+  }
+
+  struct compact_closure closure = {
+      .nodes = nodes,
+      .nodes_size = nodes_size,
+      .size_next = (struct lbtree_d_size *)nodes,
+      /* the size node size is a multiple of its alignment, which is at least
+        that of a key node */
+      .key_next = (struct lbtree_d *)(nodes + size_nodes_size),
+      .old = old,
+      .old_count = 0,
+      .keys = keys,
+      .keys_used = 0,
+      .key_size = 0};
+  compact_copy(&closure, &tree->size_tree->base, 1);
+  struct lbtree_d_size *size_copy;
+  for (size_copy = (struct lbtree_d_size *)nodes;
+       size_copy != (struct lbtree_d_size *)(nodes + size_nodes_size);
+       ++size_copy) {
+    closure.key_size = key_size(size_copy->key_size_bits);
+    compact_copy(&closure, size_copy->base.val, 0);
+  }
+
+  /* every node has been copied, so every child now leads to its copy */
+  for (size_copy = (struct lbtree_d_size *)nodes;
+       size_copy != (struct lbtree_d_size *)(nodes + size_nodes_size);
+       ++size_copy) {
+    compact_fix(&size_copy->base.base);
+    size_copy->base.val = ((struct lbtree *)size_copy->base.val)->children[0];
+  }
+  struct lbtree_d *key_copy;
+  for (key_copy = closure.key_next - count.key_nodes;
+       key_copy != closure.key_next; ++key_copy) {
+    compact_fix(&key_copy->base);
+  }
+  tree->size_tree = (struct lbtree_d *)tree->size_tree->base.children[0];
+
+  size_t i;
+  for (i = 0; i < closure.old_count; ++i) {
+    node_release(tree, old[i]);
+  }
+  free(old);
+  free(tree->keys);
+  tree->keys = keys;
+  tree->keys_size = keys_size;
+  tree->keys_used = closure.keys_used;
+  tree->keys_dead = 0;
+  tree->nodes = nodes;
+  tree->nodes_size = nodes_size;
+  tree->nodes_live = closure.old_count;
+  return 0;
+}
+
+static void *free_key_action(void *node, void *closure) {
+  node_release(closure, node);
+  return 0;
+}
+
+static void *free_size_action(void *node, void *closure) {
+  struct lbtree_d_size *size_node = node;
+  struct lbtree_d *key_tree = size_node->base.val;
+  if (size_node->key_size_bits == 0) {
+    node_release(closure, key_tree);
+  } else {
+    lbtree_walk(&key_tree->base, &lbtree_d_sel_node, &free_key_action,
+                closure);
+  }
+  node_release(closure, node);
+  return 0;
+}
+
+void lbtree_da_free(struct lbtree_da *tree) {
+  lbtree_walk((struct lbtree *)tree->size_tree, &lbtree_d_sel_node,
+              &free_size_action, tree);
+  free(tree->keys);
+  lbtree_da_init(tree);
+}
@@ -0,0 +1,128 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DA_H
+#define LBTREE_DA_H
+
+#include "lbtree_d.h"
+
+#include <stddef.h>
+
+/*
+Variant of lbtree_d that owns its keys, each key is copied into a single key
+arena so the key passed to an add need not persist. The arena is repacked when
+it fills and when removed keys take up more than half of it, so key pointers
+passed to walk actions are only valid until the next add or remove.
+`lbtree_da_compact` additionally moves the nodes into a single node arena.
+*/
+struct lbtree_da {
+  struct lbtree_d *size_tree;
+  unsigned char *keys;
+  size_t keys_size;
+  size_t keys_used;
+  /* bytes of `keys_used` that belong to removed keys */
+  size_t keys_dead;
+  /* nodes placed by the last compaction, freed once none are in the tree */
+  unsigned char *nodes;
+  size_t nodes_size;
+  size_t nodes_live;
+};
+
+/*
+Initialises an empty tree.
+*/
+void lbtree_da_init(struct lbtree_da *tree);
+
+/*
+Adds a key value pair to the tree, copying the key.
+Returns the value associated with a matching key in the tree (this value is
+replaced by this function), or zero if one is not found. `val` on memory
+allocation error.
+*/
+void *lbtree_da_add(struct lbtree_da *tree, void *key,
+                    lbtree_index_t key_size_bits, void *val);
+
+static inline void *lbtree_dac_add(struct lbtree_da *tree, void *key,
+                                   lbtree_index_t key_size, void *val) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? key
+             : lbtree_da_add(tree, key, key_size_bits, val);
+}
+
+/*
+Performs a lookup on the tree.
+Returns the value whose associated key matches the `key` argument, or zero if
+one is not found.
+*/
+static inline void *lbtree_da(struct lbtree_da *tree, void *key,
+                              lbtree_index_t key_size_bits) {
+  return (tree->size_tree == 0) ? 0
+                                : lbtree_d(tree->size_tree, key, key_size_bits);
+}
+
+static inline void *lbtree_dac(struct lbtree_da *tree, void *key,
+                               lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_da(tree, key, key_size_bits);
+}
+
+/*
+Removes a single key value pair from the tree.
+Returns the associated value if found and removed, otherwise zero.
+*/
+void *lbtree_da_rm(struct lbtree_da *tree, void *key,
+                   lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dac_rm(struct lbtree_da *tree, void *key,
+                                  lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_da_rm(tree, key, key_size_bits);
+}
+
+/*
+Calls `action` once for each key value pair in the tree. The walk will stop when
+any action returns a non-null pointer. Returns the action return value causing
+the walk to stop, otherwise zero.
+*/
+static inline void *
+lbtree_da_walk(struct lbtree_da *tree,
+               void *(*action)(const void *key, void **val, void *closure),
+               void *closure) {
+  return lbtree_d_walk(tree->size_tree, action, closure);
+}
+
+/*
+Moves every node into one new allocation, each tree laid out in depth first
+order with the size tree first, and the keys into a new key arena in the same
+order, so that lookups touch as few cache lines and pages as the shape of the
+tree allows. Nodes added afterwards are allocated individually as before, and
+the tree can be compacted again at any time. This is a single pass over the
+whole tree, taking time linear in its size.
+Returns non-zero on memory allocation error, in which case the tree is
+unchanged.
+*/
+int lbtree_da_compact(struct lbtree_da *tree);
+
+/*
+Frees all the nodes in the tree and its keys, leaving it empty.
+*/
+void lbtree_da_free(struct lbtree_da *tree);
+
+#endif
@@ -0,0 +1,195 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Wrapper around lbtree_d whose values point to entries in a fixed array, over
+  which a CLOCK hand chooses pairs to evict */
+
+#include "lbtree_de.h"
+
+#include <stdlib.h>
+
+int lbtree_de_init(struct lbtree_de *cache, size_t capacity, size_t budget,
+                   void (*evict)(const void *key, void *val, void *closure),
+                   void *closure) {
+  cache->entries =
+      (capacity != 0) ? malloc(capacity * sizeof(*cache->entries)) : 0;
+  if (cache->entries == 0) {
+    return -1;
+  }
+  /* every entry starts on the free list */
+  size_t i;
+  for (i = 0; i < capacity; ++i) {
+    cache->entries[i].node = 0;
+    cache->entries[i].val = &cache->entries[i + 1];
+  }
+  cache->entries[capacity - 1].val = 0;
+  cache->free = cache->entries;
+  cache->size_tree = 0;
+  cache->capacity = capacity;
+  cache->count = 0;
+  cache->hand = 0;
+  cache->budget = budget;
+  cache->cost = 0;
+  cache->hits = 0;
+  cache->misses = 0;
+  cache->evictions = 0;
+  cache->evict = evict;
+  cache->closure = closure;
+  return 0;
+}
+
+static void entry_free(struct lbtree_de *cache, struct lbtree_de_entry *entry) {
+  entry->node = 0;
+  entry->val = cache->free;
+  cache->free = entry;
+  --cache->count;
+  cache->cost -= entry->cost;
+}
+
+/* Evicts the pair of the first entry under the hand with its reference bit
+  clear, clearing the bits of those passed over. `keep` is passed over
+  regardless, and must not be the only pair in the cache. */
+static void evict(struct lbtree_de *cache, struct lbtree_de_entry *keep) {
+  for (;;) {
+    struct lbtree_de_entry *entry = &cache->entries[cache->hand];
+    if (++cache->hand == cache->capacity) {
+      cache->hand = 0;
+    }
+    if ((entry->node == 0) || (entry == keep)) {
+      continue;
+    }
+    if (entry->referenced != 0) {
+      entry->referenced = 0;
+      continue;
+    }
+    void *key = entry->node->key;
+    void *val = entry->val;
+    lbtree_d_rm_node(&cache->size_tree, entry->node, entry->key_size_bits);
+    entry_free(cache, entry);
+    ++cache->evictions;
+    if (cache->evict != 0) {
+      cache->evict(key, val, cache->closure);
+    }
+    return;
+  }
+}
+
+/* Evicts pairs other than `keep` until the cache is within its budget */
+static void evict_over_budget(struct lbtree_de *cache,
+                              struct lbtree_de_entry *keep) {
+  if (cache->budget == 0) {
+    return;
+  }
+  /* `keep` is within the budget on its own, so is never the last pair here */
+  while (cache->cost > cache->budget) {
+    evict(cache, keep);
+  }
+}
+
+void *lbtree_de_add(struct lbtree_de *cache, void *key,
+                    lbtree_index_t key_size_bits, void *val, size_t cost) {
+  if ((cache->budget != 0) && (cost > cache->budget)) {
+    return val;
+  }
+  void **slot = lbtree_d_slot(&cache->size_tree, key, key_size_bits);
+  if (slot == 0) {
+    return val;
+  }
+  struct lbtree_de_entry *entry = *slot;
+  if (entry != 0) {
+    void *old_val = entry->val;
+    entry->node->key = key;
+    entry->val = val;
+    cache->cost += cost - entry->cost;
+    entry->cost = cost;
+    entry->referenced = 1;
+    evict_over_budget(cache, entry);
+    return old_val;
+  }
+
+  if (cache->count == cache->capacity) {
+    /* the new node has no entry yet, so cannot be evicted */
+    evict(cache, 0);
+  }
+  entry = cache->free;
+  cache->free = entry->val;
+  entry->node = lbtree_d_slot_node(slot);
+  entry->val = val;
+  entry->key_size_bits = key_size_bits;
+  entry->cost = cost;
+  entry->referenced = 0;
+  *slot = entry;
+  ++cache->count;
+  cache->cost += cost;
+  evict_over_budget(cache, entry);
+  return 0;
+}
+
+void *lbtree_de(struct lbtree_de *cache, void *key,
+                lbtree_index_t key_size_bits) {
+  struct lbtree_d *node =
+      lbtree_d_node_find(cache->size_tree, key, key_size_bits);
+  if (node == 0) {
+    ++cache->misses;
+    return 0;
+  }
+  ++cache->hits;
+  struct lbtree_de_entry *entry = node->val;
+  entry->referenced = 1;
+  return entry->val;
+}
+
+void *lbtree_de_rm(struct lbtree_de *cache, void *key,
+                   lbtree_index_t key_size_bits) {
+  struct lbtree_de_entry *entry =
+      lbtree_d_rm(&cache->size_tree, key, key_size_bits);
+  if (entry == 0) {
+    return 0;
+  }
+  void *val = entry->val;
+  entry_free(cache, entry);
+  return val;
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(const void *key, void **val, void *v_closure) {
+  struct walk_closure *closure = v_closure;
+  struct lbtree_de_entry *entry = *val;
+  return closure->action(key, &entry->val, closure->closure);
+}
+
+void *lbtree_de_walk(struct lbtree_de *cache,
+                     void *(*action)(const void *key, void **val,
+                                     void *closure),
+                     void *closure) {
+  if (cache->size_tree == 0) {
+    return 0;
+  }
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  return lbtree_d_walk(cache->size_tree, &walk_action, &walk_closure);
+}
+
+void lbtree_de_free(struct lbtree_de *cache) {
+  if (cache->size_tree != 0) {
+    lbtree_d_free(cache->size_tree);
+    cache->size_tree = 0;
+  }
+  free(cache->entries);
+  cache->entries = 0;
+}
@@ -0,0 +1,143 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DE_H
+#define LBTREE_DE_H
+
+#include "lbtree_d.h"
+
+#include <stddef.h>
+
+/*
+Variant of lbtree_d bounded to `capacity` pairs and, if `budget` is not zero, to
+a total `cost` of `budget`, the cost of each pair being given as it is added
+(its size in bytes, for example). Adds that would pass either bound first evict
+pairs chosen by CLOCK: each pair has a reference bit, set when it is looked up
+or replaced, and a hand passes over the pairs in turn, clearing set bits and
+evicting the first pair whose bit is clear. A pair is added with its bit clear,
+so one that is never looked up is evicted before those that are.
+
+The pairs are held in an array of `capacity` entries allocated by
+`lbtree_de_init`, each of which refers to its node in the tree, so evicting a
+pair compares no keys, though cutting its node still descends from the root of
+the tree to it as a lookup would. `evict`, if not null, is called with each
+evicted pair, which may then be freed.
+*/
+struct lbtree_de_entry {
+  /* the key node of the pair, zero if the entry is free */
+  struct lbtree_d *node;
+  /* the value, or the next free entry */
+  void *val;
+  lbtree_index_t key_size_bits;
+  size_t cost;
+  unsigned char referenced;
+};
+
+struct lbtree_de {
+  struct lbtree_d *size_tree;
+  struct lbtree_de_entry *entries;
+  struct lbtree_de_entry *free;
+  size_t capacity;
+  size_t count;
+  /* the entry the hand is over */
+  size_t hand;
+  /* zero for no bound on cost */
+  size_t budget;
+  size_t cost;
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+  void (*evict)(const void *key, void *val, void *closure);
+  void *closure;
+};
+
+/*
+Initialises an empty cache of at most `capacity` pairs.
+Returns non-zero if `capacity` is zero or on memory allocation error.
+*/
+int lbtree_de_init(struct lbtree_de *cache, size_t capacity, size_t budget,
+                   void (*evict)(const void *key, void *val, void *closure),
+                   void *closure);
+
+/*
+Adds a key value pair of the given cost to the cache, evicting pairs if
+needed, the value pointed to by `key` must persist as for `lbtree_d_add` until
+the pair is evicted, removed or replaced.
+Returns the value associated with a matching key in the cache (this key value
+pair is replaced by this function, and is not passed to `evict`), or zero if one
+is not found. `val` on memory allocation error or if `cost` is over the budget,
+in which case the cache is unchanged.
+*/
+void *lbtree_de_add(struct lbtree_de *cache, void *key,
+                    lbtree_index_t key_size_bits, void *val, size_t cost);
+
+static inline void *lbtree_dec_add(struct lbtree_de *cache, void *key,
+                                   lbtree_index_t key_size, void *val,
+                                   size_t cost) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? key
+             : lbtree_de_add(cache, key, key_size_bits, val, cost);
+}
+
+/*
+Performs a lookup on the cache, setting the reference bit of the pair found and
+counting a hit, or a miss if none is found.
+Returns the value whose associated key matches the `key` argument, or zero if
+one is not found.
+*/
+void *lbtree_de(struct lbtree_de *cache, void *key,
+                lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dec(struct lbtree_de *cache, void *key,
+                               lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_de(cache, key, key_size_bits);
+}
+
+/*
+Removes a single key value pair from the cache, without passing it to `evict`.
+Returns the associated value if found and removed, otherwise zero.
+*/
+void *lbtree_de_rm(struct lbtree_de *cache, void *key,
+                   lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dec_rm(struct lbtree_de *cache, void *key,
+                                  lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_de_rm(cache, key, key_size_bits);
+}
+
+/*
+Calls `action` once for each key value pair in the cache, without changing
+reference bits. The walk will stop when any action returns a non-null pointer.
+Returns the action return value causing the walk to stop, otherwise zero.
+*/
+void *lbtree_de_walk(struct lbtree_de *cache,
+                     void *(*action)(const void *key, void **val,
+                                     void *closure),
+                     void *closure);
+
+/*
+Frees all the nodes in the cache and its entries, without passing the pairs to
+`evict`. The cache must be initialised again before it is used.
+*/
+void lbtree_de_free(struct lbtree_de *cache);
+
+#endif
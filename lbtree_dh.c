@@ -0,0 +1,234 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_dh.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t rotl(uint64_t x, unsigned int b) {
+  return (x << b) | (x >> (64 - b));
+}
+
+static void sip_round(uint64_t v[4]) {
+  v[0] += v[1];
+  v[1] = rotl(v[1], 13) ^ v[0];
+  v[0] = rotl(v[0], 32);
+  v[2] += v[3];
+  v[3] = rotl(v[3], 16) ^ v[2];
+  v[0] += v[3];
+  v[3] = rotl(v[3], 21) ^ v[0];
+  v[2] += v[1];
+  v[1] = rotl(v[1], 17) ^ v[2];
+  v[2] = rotl(v[2], 32);
+}
+
+/* one compression round of SipHash-1-3 */
+static void sip_block(uint64_t v[4], uint64_t m) {
+  v[3] ^= m;
+  sip_round(v);
+  v[0] ^= m;
+}
+
+uint64_t lbtree_dh_hash(const void *key, lbtree_index_t key_size_bits,
+                        const uint64_t seed[2]) {
+  uint64_t v[4] = {
+      seed[0] ^ 0x736f6d6570736575u, seed[1] ^ 0x646f72616e646f6du,
+      seed[0] ^ 0x6c7967656e657261u, seed[1] ^ 0x7465646279746573u};
+  /* the message is the key size followed by the bytes the key touches, so that
+    keys of different sizes are never the same message */
+  sip_block(v, (uint64_t)key_size_bits);
+  const unsigned char *k = key;
+  lbtree_index_t size = (key_size_bits + CHAR_BIT - 1) / CHAR_BIT;
+  unsigned int rem = (unsigned int)(key_size_bits % CHAR_BIT);
+  /* bits past the end of the key are ignored */
+  unsigned char last =
+      (rem == 0) ? UCHAR_MAX : (unsigned char)((1u << rem) - 1);
+  unsigned char length = (unsigned char)(size + sizeof(uint64_t));
+  unsigned char buf[sizeof(uint64_t)];
+  uint64_t m;
+  while (size >= sizeof(buf)) {
+    memcpy(buf, k, sizeof(buf));
+    if (size == sizeof(buf)) {
+      buf[sizeof(buf) - 1] &= last;
+    }
+    memcpy(&m, buf, sizeof(m));
+    sip_block(v, m);
+    k += sizeof(buf);
+    size -= sizeof(buf);
+  }
+  memset(buf, 0, sizeof(buf));
+  if (size != 0) {
+    memcpy(buf, k, (size_t)size);
+    buf[size - 1] &= last;
+  }
+  buf[sizeof(buf) - 1] = length;
+  memcpy(&m, buf, sizeof(m));
+  sip_block(v, m);
+  v[2] ^= 0xff;
+  sip_round(v);
+  sip_round(v);
+  sip_round(v);
+  return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+void lbtree_dh_init(struct lbtree_dh *tree, const uint64_t seed[2]) {
+  tree->root = 0;
+  tree->hash = &lbtree_dh_hash;
+  tree->seed[0] = seed[0];
+  tree->seed[1] = seed[1];
+}
+
+static int match(const struct lbtree_dh_node *node, const void *key,
+                 lbtree_index_t key_size_bits) {
+  if (node->key_size_bits != key_size_bits) {
+    return 0;
+  }
+  const unsigned char *a = node->key;
+  const unsigned char *b = key;
+  lbtree_index_t size = key_size_bits / CHAR_BIT;
+  if ((size != 0) && (memcmp(a, b, (size_t)size) != 0)) {
+    return 0;
+  }
+  unsigned int rem = (unsigned int)(key_size_bits % CHAR_BIT);
+  return (rem == 0) || (((a[size] ^ b[size]) & ((1u << rem) - 1)) == 0);
+}
+
+/* Returns the node in the tree with the hash `h`, the head of its chain, or
+  zero if there is none */
+static struct lbtree_dh_node *head_find(struct lbtree_dh *tree, uint64_t h) {
+  return lbtree_u64((struct lbtree_u64 *)tree->root, h);
+}
+
+void *lbtree_dh_add(struct lbtree_dh *tree, void *key,
+                    lbtree_index_t key_size_bits, void *val) {
+  uint64_t h = tree->hash(key, key_size_bits, tree->seed);
+  struct lbtree_dh_node *head = head_find(tree, h);
+  struct lbtree_dh_node *node;
+  for (node = head; node != 0; node = node->next) {
+    if (match(node, key, key_size_bits) != 0) {
+      void *old_val = node->val;
+      node->key = key;
+      node->val = val;
+      return old_val;
+    }
+  }
+
+  node = malloc(sizeof(*node));
+  if (node == 0) {
+    return val;
+  }
+  node->key = key;
+  node->key_size_bits = key_size_bits;
+  node->val = val;
+  if (head != 0) {
+    /* a collision, chained behind the node in the tree */
+    node->next = head->next;
+    head->next = node;
+  } else {
+    node->base.key = h;
+    node->next = 0;
+    lbtree_u64_add((struct lbtree_u64 **)&tree->root, &node->base);
+  }
+  return 0;
+}
+
+void *lbtree_dh(struct lbtree_dh *tree, void *key,
+                lbtree_index_t key_size_bits) {
+  struct lbtree_dh_node *node =
+      head_find(tree, tree->hash(key, key_size_bits, tree->seed));
+  for (; node != 0; node = node->next) {
+    if (match(node, key, key_size_bits) != 0) {
+      return node->val;
+    }
+  }
+  return 0;
+}
+
+void *lbtree_dh_rm(struct lbtree_dh *tree, void *key,
+                   lbtree_index_t key_size_bits) {
+  struct lbtree_dh_node *head =
+      head_find(tree, tree->hash(key, key_size_bits, tree->seed));
+  if (head == 0) {
+    return 0;
+  }
+  struct lbtree_dh_node **ref = &head;
+  while ((*ref != 0) && (match(*ref, key, key_size_bits) == 0)) {
+    ref = &(*ref)->next;
+  }
+  struct lbtree_dh_node *node = *ref;
+  if (node == 0) {
+    return 0;
+  }
+  void *val = node->val;
+  if (node != head) {
+    *ref = node->next;
+    free(node);
+  } else if (head->next != 0) {
+    /* the head stays in the tree, taking the next pair of the chain */
+    struct lbtree_dh_node *next = head->next;
+    head->key = next->key;
+    head->key_size_bits = next->key_size_bits;
+    head->val = next->val;
+    head->next = next->next;
+    free(next);
+  } else {
+    lbtree_u64_rm((struct lbtree_u64 **)&tree->root, &head->base);
+    free(head);
+  }
+  return val;
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(void *v_node, void *v_closure) {
+  struct walk_closure *closure = v_closure;
+  struct lbtree_dh_node *node;
+  for (node = v_node; node != 0; node = node->next) {
+    void *r = closure->action(node->key, &node->val, closure->closure);
+    if (r != 0) {
+      return r;
+    }
+  }
+  return 0;
+}
+
+void *lbtree_dh_walk(struct lbtree_dh *tree,
+                     void *(*action)(const void *key, void **val,
+                                     void *closure),
+                     void *closure) {
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  return lbtree_u64_walk((struct lbtree_u64 *)tree->root, &walk_action,
+                         &walk_closure);
+}
+
+static void *free_action(void *v_node, void *closure) {
+  (void)closure;
+  struct lbtree_dh_node *node = v_node;
+  while (node != 0) {
+    struct lbtree_dh_node *next = node->next;
+    free(node);
+    node = next;
+  }
+  return 0;
+}
+
+void lbtree_dh_free(struct lbtree_dh *tree) {
+  lbtree_u64_walk((struct lbtree_u64 *)tree->root, &free_action, 0);
+  tree->root = 0;
+}
@@ -0,0 +1,130 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DH_H
+#define LBTREE_DH_H
+
+#include "lbtree_int.h"
+
+#include <limits.h>
+#include <stdint.h>
+
+/*
+Variant of lbtree_d that indexes a 64 bit hash of each key and its size rather
+than the key itself, so that however long the keys are and however many bits
+they share, no lookup passes more than 64 branches, and about log2 of the
+number of keys for a good hash. The whole key is compared once at the end of a
+lookup, and keys whose hashes collide are chained from the one node in the tree.
+Keys are not copied and are walked in no useful order.
+
+`hash` and `seed` are set by `lbtree_dh_init` to `lbtree_dh_hash` and the seed
+given, and may be replaced before any key is added. The default hash is keyed by
+the seed, so trees that may be given keys chosen to collide should be seeded
+with a secret random value, and chains are then no longer than those of random
+keys for as long as the seed stays secret. A replacement hash that is not keyed
+gives no such bound.
+*/
+struct lbtree_dh_node {
+  struct lbtree_u64 base;
+  /* the next node whose key has the same hash */
+  struct lbtree_dh_node *next;
+  void *key;
+  lbtree_index_t key_size_bits;
+  void *val;
+};
+
+struct lbtree_dh {
+  struct lbtree_dh_node *root;
+  uint64_t (*hash)(const void *key, lbtree_index_t key_size_bits,
+                   const uint64_t seed[2]);
+  uint64_t seed[2];
+};
+
+/*
+The default hash, SipHash-1-3 keyed by the 128 bit `seed`, of the key size
+followed by the key, ignoring any bits past `key_size_bits` in the last byte.
+*/
+uint64_t lbtree_dh_hash(const void *key, lbtree_index_t key_size_bits,
+                        const uint64_t seed[2]);
+
+/*
+Initialises an empty tree, copying the seed.
+*/
+void lbtree_dh_init(struct lbtree_dh *tree, const uint64_t seed[2]);
+
+/*
+Adds a key value pair to the tree.
+Returns the value associated with a matching key in the tree (this value is
+replaced by this function), or zero if one is not found. `val` on memory
+allocation error.
+*/
+void *lbtree_dh_add(struct lbtree_dh *tree, void *key,
+                    lbtree_index_t key_size_bits, void *val);
+
+static inline void *lbtree_dhc_add(struct lbtree_dh *tree, void *key,
+                                   lbtree_index_t key_size, void *val) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? key
+             : lbtree_dh_add(tree, key, key_size_bits, val);
+}
+
+/*
+Performs a lookup on the tree.
+Returns the value whose associated key matches the `key` argument, or zero if
+one is not found.
+*/
+void *lbtree_dh(struct lbtree_dh *tree, void *key,
+                lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dhc(struct lbtree_dh *tree, void *key,
+                               lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_dh(tree, key, key_size_bits);
+}
+
+/*
+Removes a single key value pair from the tree.
+Returns the associated value if found and removed, otherwise zero.
+*/
+void *lbtree_dh_rm(struct lbtree_dh *tree, void *key,
+                   lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dhc_rm(struct lbtree_dh *tree, void *key,
+                                  lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_dh_rm(tree, key, key_size_bits);
+}
+
+/*
+Calls `action` once for each key value pair in the tree. The walk will stop when
+any action returns a non-null pointer. Returns the action return value causing
+the walk to stop, otherwise zero.
+*/
+void *lbtree_dh_walk(struct lbtree_dh *tree,
+                     void *(*action)(const void *key, void **val,
+                                     void *closure),
+                     void *closure);
+
+/*
+Frees all the nodes in the tree, leaving it empty.
+*/
+void lbtree_dh_free(struct lbtree_dh *tree);
+
+#endif
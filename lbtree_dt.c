@@ -0,0 +1,198 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Wrapper around lbtree_d that marks removed pairs dead by replacing their
+  values with a tombstone, and removes them from the tree in batches */
+
+#include "lbtree_dt.h"
+
+#include <stdlib.h>
+
+/* the value of every dead pair, which no live value can point to */
+static char tombstone;
+
+void lbtree_dt_init(struct lbtree_dt *tree, unsigned int sweep_percent,
+                    void (*release)(const void *key, void *closure),
+                    void *closure) {
+  tree->size_tree = 0;
+  tree->count = 0;
+  tree->dead = 0;
+  tree->sweep_percent = sweep_percent;
+  tree->release = release;
+  tree->closure = closure;
+}
+
+static void release(struct lbtree_dt *tree, const void *key) {
+  if (tree->release != 0) {
+    tree->release(key, tree->closure);
+  }
+}
+
+void *lbtree_dt_add(struct lbtree_dt *tree, void *key,
+                    lbtree_index_t key_size_bits, void *val) {
+  struct lbtree_d *node =
+      lbtree_d_node_find(tree->size_tree, key, key_size_bits);
+  if (node != 0) {
+    void *old_key = node->key;
+    void *old_val = node->val;
+    node->key = key;
+    node->val = val;
+    if (old_val != &tombstone) {
+      return old_val;
+    }
+    --tree->dead;
+    /* a key added again in the buffer it was removed in is live once more */
+    if (old_key != key) {
+      release(tree, old_key);
+    }
+    return 0;
+  }
+  /* the key was not found above, so a non-zero return is an allocation error */
+  if (lbtree_d_add(&tree->size_tree, key, key_size_bits, val) != 0) {
+    return val;
+  }
+  ++tree->count;
+  return 0;
+}
+
+void *lbtree_dt(struct lbtree_dt *tree, void *key,
+                lbtree_index_t key_size_bits) {
+  struct lbtree_d *node =
+      lbtree_d_node_find(tree->size_tree, key, key_size_bits);
+  return ((node == 0) || (node->val == &tombstone)) ? 0 : node->val;
+}
+
+void *lbtree_dt_rm(struct lbtree_dt *tree, void *key,
+                   lbtree_index_t key_size_bits) {
+  struct lbtree_d *node =
+      lbtree_d_node_find(tree->size_tree, key, key_size_bits);
+  if ((node == 0) || (node->val == &tombstone)) {
+    return 0;
+  }
+  void *val = node->val;
+  node->val = &tombstone;
+  ++tree->dead;
+  if ((tree->sweep_percent != 0) &&
+      ((tree->dead * 100) > (tree->count * tree->sweep_percent))) {
+    /* on memory allocation error the dead pairs just stay until the next
+      sweep */
+    (void)lbtree_dt_sweep(tree);
+  }
+  return val;
+}
+
+struct sweep_closure {
+  struct lbtree_dt *tree;
+  /* the size nodes emptied so far, followed by the dead key nodes of the key
+    tree being swept, of which there are at least as many */
+  struct lbtree_d **nodes;
+  size_t emptied;
+  size_t end;
+};
+
+static void *collect_action(void *node, void *v_closure) {
+  struct lbtree_d *key_node = node;
+  struct sweep_closure *closure = v_closure;
+  if (key_node->val == &tombstone) {
+    closure->nodes[closure->end++] = key_node;
+  }
+  return 0;
+}
+
+static void *sweep_size_action(void *node, void *v_closure) {
+  struct lbtree_d_size *size_node = node;
+  struct sweep_closure *closure = v_closure;
+  struct lbtree_d *key_tree = size_node->base.val;
+  closure->end = closure->emptied;
+  if (size_node->key_size_bits == 0) {
+    /* a lone node whose key must not be read */
+    collect_action(key_tree, closure);
+  } else {
+    lbtree_walk(&key_tree->base, &lbtree_d_sel_node, &collect_action, closure);
+  }
+
+  size_t i;
+  for (i = closure->emptied; i < closure->end; ++i) {
+    struct lbtree_d *key_node = closure->nodes[i];
+    if (size_node->key_size_bits == 0) {
+      size_node->base.val = 0;
+    } else {
+      lbtree_rm((struct lbtree **)&size_node->base.val, &lbtree_d_sel_node,
+                &key_node->base);
+    }
+    release(closure->tree, key_node->key);
+    free(key_node);
+  }
+  if (size_node->base.val == 0) {
+    closure->nodes[closure->emptied++] = &size_node->base;
+  }
+  return 0;
+}
+
+int lbtree_dt_sweep(struct lbtree_dt *tree) {
+  if (tree->dead == 0) {
+    return 0;
+  }
+  struct sweep_closure closure = {.tree = tree, .emptied = 0, .end = 0};
+  closure.nodes = malloc(tree->dead * sizeof(*closure.nodes));
+  if (closure.nodes == 0) {
+    return -1;
+  }
+  lbtree_walk(&tree->size_tree->base, &lbtree_d_sel_node, &sweep_size_action,
+              &closure);
+
+  size_t i;
+  for (i = 0; i < closure.emptied; ++i) {
+    lbtree_rm((struct lbtree **)&tree->size_tree, &lbtree_d_sel_node,
+              &closure.nodes[i]->base);
+    free(closure.nodes[i]);
+  }
+  free(closure.nodes);
+  tree->count -= tree->dead;
+  tree->dead = 0;
+  return 0;
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(const void *key, void **val, void *v_closure) {
+  struct walk_closure *closure = v_closure;
+  return (*val == &tombstone) ? 0
+                              : closure->action(key, val, closure->closure);
+}
+
+void *lbtree_dt_walk(struct lbtree_dt *tree,
+                     void *(*action)(const void *key, void **val,
+                                     void *closure),
+                     void *closure) {
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  return lbtree_d_walk(tree->size_tree, &walk_action, &walk_closure);
+}
+
+static void free_action(const void *key, void *val, void *tree) {
+  if (val == &tombstone) {
+    release(tree, key);
+  }
+}
+
+void lbtree_dt_free(struct lbtree_dt *tree) {
+  /* each dead key is released only as its node is freed, as the nodes that
+    remain are still read */
+  lbtree_d_free_action(tree->size_tree, &free_action, tree);
+  lbtree_dt_init(tree, tree->sweep_percent, tree->release, tree->closure);
+}
@@ -0,0 +1,128 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DT_H
+#define LBTREE_DT_H
+
+#include "lbtree_d.h"
+
+#include <stddef.h>
+
+/*
+Variant of lbtree_d whose removals only mark the pair dead, which takes one
+lookup and neither restructures the tree nor frees anything. Dead pairs are
+skipped by lookups and walks, and are physically removed together by a sweep,
+run by `lbtree_dt_sweep` or by the removal that takes the dead pairs past
+`sweep_percent` percent of the pairs in the tree.
+
+Lookups still read the keys of dead pairs, so the key of a removed pair must
+persist until the tree is done with it: when the pair is swept, when the tree
+is freed, or when the key is added again in another buffer, replacing it.
+`release`, if not null, is then called with the key. A key added again in the
+buffer it was removed in is not released, as the live pair holds it.
+*/
+struct lbtree_dt {
+  struct lbtree_d *size_tree;
+  /* pairs in the tree, including dead ones */
+  size_t count;
+  size_t dead;
+  /* zero to sweep only when asked */
+  unsigned int sweep_percent;
+  void (*release)(const void *key, void *closure);
+  void *closure;
+};
+
+/*
+Initialises an empty tree.
+*/
+void lbtree_dt_init(struct lbtree_dt *tree, unsigned int sweep_percent,
+                    void (*release)(const void *key, void *closure),
+                    void *closure);
+
+/*
+Adds a key value pair to the tree, the value pointed to by `key` must persist
+as for `lbtree_d_add`.
+Returns the value associated with a matching live key in the tree (this key
+value pair is replaced by this function), or zero if one is not found. `val` on
+memory allocation error. The key of a replaced live pair is not released, and
+returns to the caller with its value.
+*/
+void *lbtree_dt_add(struct lbtree_dt *tree, void *key,
+                    lbtree_index_t key_size_bits, void *val);
+
+static inline void *lbtree_dtc_add(struct lbtree_dt *tree, void *key,
+                                   lbtree_index_t key_size, void *val) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? key
+             : lbtree_dt_add(tree, key, key_size_bits, val);
+}
+
+/*
+Performs a lookup on the tree.
+Returns the value whose associated live key matches the `key` argument, or zero
+if one is not found.
+*/
+void *lbtree_dt(struct lbtree_dt *tree, void *key,
+                lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dtc(struct lbtree_dt *tree, void *key,
+                               lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_dt(tree, key, key_size_bits);
+}
+
+/*
+Marks a single key value pair dead, sweeping the tree if that takes the dead
+pairs past `sweep_percent`.
+Returns the associated value if a live pair was found, otherwise zero.
+*/
+void *lbtree_dt_rm(struct lbtree_dt *tree, void *key,
+                   lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dtc_rm(struct lbtree_dt *tree, void *key,
+                                  lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_dt_rm(tree, key, key_size_bits);
+}
+
+/*
+Removes every dead pair from the tree, one walk collecting them and each then
+being cut from its key tree by its node, without comparing keys.
+Returns non-zero on memory allocation error, in which case the tree is
+unchanged.
+*/
+int lbtree_dt_sweep(struct lbtree_dt *tree);
+
+/*
+Calls `action` once for each live key value pair in the tree. The walk will stop
+when any action returns a non-null pointer. Returns the action return value
+causing the walk to stop, otherwise zero.
+*/
+void *lbtree_dt_walk(struct lbtree_dt *tree,
+                     void *(*action)(const void *key, void **val,
+                                     void *closure),
+                     void *closure);
+
+/*
+Frees all the nodes in the tree, leaving it empty.
+*/
+void lbtree_dt_free(struct lbtree_dt *tree);
+
+#endif
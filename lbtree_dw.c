@@ -0,0 +1,547 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_dw.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ENTRY_ALIGN (8)
+#define BUF_MIN_SIZE (4096)
+
+static const char checkpoint_magic[8] = {'l', 'b', 't', 'r',
+                                        'e', 'e', 'd', 'w'};
+
+/* A key value pair as it is held in memory, in the checkpoint and in log
+  records, the key's bytes followed by the value's and padding to
+  `ENTRY_ALIGN` */
+struct entry {
+  uint64_t key_size_bits;
+  uint64_t val_size;
+  unsigned char data[];
+};
+
+enum record_op { RECORD_ADD = 1, RECORD_RM = 2 };
+
+/* A log record, followed by an entry, whose value is empty for removals */
+struct record {
+  /* of the bytes of the record following this field */
+  uint64_t check;
+  uint64_t op;
+};
+
+static size_t key_bytes(uint64_t key_size_bits) {
+  return (size_t)((key_size_bits / CHAR_BIT) +
+                  (((key_size_bits % CHAR_BIT) != 0) ? 1 : 0));
+}
+
+static size_t entry_size(uint64_t key_size_bits, uint64_t val_size) {
+  size_t size = sizeof(struct entry) + key_bytes(key_size_bits) + val_size;
+  return (size + (ENTRY_ALIGN - 1)) & ~(size_t)(ENTRY_ALIGN - 1);
+}
+
+/* Returns the size of the entry at `data`, or zero if it does not fit in
+  `size` bytes */
+static size_t entry_fit(const unsigned char *data, size_t size) {
+  if (size < sizeof(struct entry)) {
+    return 0;
+  }
+  const struct entry *e = (const struct entry *)data;
+  if ((e->key_size_bits / CHAR_BIT >= size) || (e->val_size >= size)) {
+    return 0;
+  }
+  size_t e_size = entry_size(e->key_size_bits, e->val_size);
+  return (e_size <= size) ? e_size : 0;
+}
+
+/* FNV-1a */
+static uint64_t check(const unsigned char *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325u;
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3u;
+  }
+  return hash;
+}
+
+static struct entry *entry_new(const void *key, lbtree_index_t key_size_bits,
+                               const void *val, size_t val_size) {
+  size_t size = entry_size(key_size_bits, val_size);
+  struct entry *e = malloc(size);
+  if (e == 0) {
+    return 0;
+  }
+  e->key_size_bits = key_size_bits;
+  e->val_size = val_size;
+  size_t k_bytes = key_bytes(key_size_bits);
+  memcpy(e->data, key, k_bytes);
+  if (val_size != 0) {
+    memcpy(&e->data[k_bytes], val, val_size);
+  }
+  memset(&e->data[k_bytes + val_size], 0,
+         size - sizeof(*e) - k_bytes - val_size);
+  return e;
+}
+
+/* Frees `e` unless it is in the mapped checkpoint */
+static void entry_del(struct lbtree_dw *tree, struct entry *e) {
+  unsigned char *data = (unsigned char *)e;
+  if ((data < tree->map) || (data >= &tree->map[tree->map_size])) {
+    free(e);
+  }
+}
+
+/* Adds `e` to the tree, freeing the entry it replaces. Returns non-zero on
+  memory allocation error. */
+static int entry_add(struct lbtree_dw *tree, struct entry *e) {
+  struct entry *old =
+      lbtree_d_add(&tree->size_tree, e->data, e->key_size_bits, e);
+  if (old == e) {
+    return -1;
+  }
+  if (old != 0) {
+    entry_del(tree, old);
+  }
+  return 0;
+}
+
+static void entry_rm(struct lbtree_dw *tree, const void *key,
+                     lbtree_index_t key_size_bits) {
+  if (tree->size_tree == 0) {
+    return;
+  }
+  struct entry *old =
+      lbtree_d_rm(&tree->size_tree, (void *)key, key_size_bits);
+  if (old != 0) {
+    entry_del(tree, old);
+  }
+}
+
+static char *path_new(const char *path, const char *suffix) {
+  size_t size = strlen(path);
+  size_t suffix_size = strlen(suffix);
+  char *r = malloc(size + suffix_size + 1);
+  if (r != 0) {
+    memcpy(r, path, size);
+    memcpy(&r[size], suffix, suffix_size + 1);
+  }
+  return r;
+}
+
+/* Adds each entry of the checkpoint mapped at `map`, rebuilding the nodes that
+  the checkpoint does not hold. Returns non-zero on error. */
+static int checkpoint_load(struct lbtree_dw *tree, unsigned char *map,
+                           size_t size) {
+  if ((size < sizeof(checkpoint_magic)) ||
+      (memcmp(map, checkpoint_magic, sizeof(checkpoint_magic)) != 0)) {
+    return -1;
+  }
+  size_t offset = sizeof(checkpoint_magic);
+  while (offset != size) {
+    size_t e_size = entry_fit(&map[offset], size - offset);
+    if ((e_size == 0) ||
+        (entry_add(tree, (struct entry *)&map[offset]) != 0)) {
+      return -1;
+    }
+    offset += e_size;
+  }
+  return 0;
+}
+
+/* Maps the checkpoint at `path`, returning non-zero on error. If there is no
+  checkpoint nothing is mapped. */
+static int checkpoint_map(const char *path, unsigned char **map,
+                          size_t *size) {
+  *map = 0;
+  *size = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) {
+    return (errno == ENOENT) ? 0 : -1;
+  }
+  struct stat st;
+  int r = -1;
+  if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+    void *m = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      *map = m;
+      *size = (size_t)st.st_size;
+      r = 0;
+    }
+  }
+  close(fd);
+  return r;
+}
+
+/* Applies the records of `log` that are whole and intact, setting `used` to
+  their length. Returns non-zero on memory allocation error. */
+static int log_replay(struct lbtree_dw *tree, unsigned char *log, size_t size,
+                      size_t *used) {
+  size_t offset = 0;
+  for (;;) {
+    *used = offset;
+    if (size - offset < sizeof(struct record)) {
+      return 0;
+    }
+    struct record *rec = (struct record *)&log[offset];
+    unsigned char *data = &log[offset + sizeof(*rec)];
+    size_t e_size = entry_fit(data, size - offset - sizeof(*rec));
+    if ((e_size == 0) ||
+        (check(&log[offset + sizeof(rec->check)],
+               sizeof(*rec) - sizeof(rec->check) + e_size) != rec->check)) {
+      return 0;
+    }
+    struct entry *e = (struct entry *)data;
+    if (rec->op == RECORD_ADD) {
+      struct entry *copy = malloc(e_size);
+      if (copy == 0) {
+        return -1;
+      }
+      memcpy(copy, e, e_size);
+      if (entry_add(tree, copy) != 0) {
+        free(copy);
+        return -1;
+      }
+    } else if (rec->op == RECORD_RM) {
+      entry_rm(tree, e->data, e->key_size_bits);
+    } else {
+      return 0;
+    }
+    offset += sizeof(*rec) + e_size;
+  }
+}
+
+/* Reads the whole of the file `fd` into a new allocation */
+static unsigned char *file_read(int fd, size_t *size) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    return 0;
+  }
+  *size = (size_t)st.st_size;
+  unsigned char *data = malloc((*size == 0) ? 1 : *size);
+  size_t done = 0;
+  while ((data != 0) && (done != *size)) {
+    ssize_t r = pread(fd, &data[done], *size - done, (off_t)done);
+    if (r > 0) {
+      done += (size_t)r;
+    } else if ((r == 0) || (errno != EINTR)) {
+      free(data);
+      data = 0;
+    }
+  }
+  return data;
+}
+
+static void free_entry_action(const void *key, void *val, void *closure) {
+  (void)key;
+  entry_del(closure, val);
+}
+
+static void tree_free(struct lbtree_dw *tree) {
+  /* the keys are in the entries, so each is freed only as its node is */
+  lbtree_d_free_action(tree->size_tree, &free_entry_action, tree);
+  tree->size_tree = 0;
+  if (tree->map != 0) {
+    munmap(tree->map, tree->map_size);
+  }
+  if (tree->log_fd != -1) {
+    close(tree->log_fd);
+  }
+  free(tree->buf);
+  free(tree->path);
+}
+
+int lbtree_dw_open(struct lbtree_dw *tree, const char *path,
+                   size_t commit_size) {
+  tree->size_tree = 0;
+  tree->log_fd = -1;
+  tree->log_size = 0;
+  tree->buf = 0;
+  tree->buf_size = 0;
+  tree->buf_used = 0;
+  tree->commit_size = commit_size;
+  tree->map = 0;
+  tree->map_size = 0;
+  tree->path = path_new(path, "");
+  char *log_path = path_new(path, ".log");
+  int r = ((tree->path == 0) || (log_path == 0)) ? -1 : 0;
+  if (r == 0) {
+    r = checkpoint_map(path, &tree->map, &tree->map_size);
+  }
+  if ((r == 0) && (tree->map != 0)) {
+    r = checkpoint_load(tree, tree->map, tree->map_size);
+  }
+  if (r == 0) {
+    tree->log_fd = open(log_path, O_RDWR | O_CREAT, 0666);
+    r = (tree->log_fd == -1) ? -1 : 0;
+  }
+  if (r == 0) {
+    size_t size;
+    unsigned char *log = file_read(tree->log_fd, &size);
+    r = ((log == 0) || (log_replay(tree, log, size, &tree->log_size) != 0))
+            ? -1
+            : 0;
+    free(log);
+  }
+  /* drop a torn record at the end so that new records follow the last whole
+    one */
+  if ((r == 0) && (ftruncate(tree->log_fd, (off_t)tree->log_size) != 0)) {
+    r = -1;
+  }
+  free(log_path);
+  if (r != 0) {
+    tree_free(tree);
+  }
+  return r;
+}
+
+/* Appends a record to the uncommitted changes. Returns non-zero on memory
+  allocation error. */
+static int log_append(struct lbtree_dw *tree, enum record_op op,
+                      const void *key, lbtree_index_t key_size_bits,
+                      const void *val, size_t val_size) {
+  size_t e_size = entry_size(key_size_bits, val_size);
+  size_t size = sizeof(struct record) + e_size;
+  if (tree->buf_size - tree->buf_used < size) {
+    size_t buf_size = (tree->buf_size == 0) ? BUF_MIN_SIZE : tree->buf_size;
+    while (buf_size - tree->buf_used < size) {
+      buf_size *= 2;
+    }
+    unsigned char *buf = realloc(tree->buf, buf_size);
+    if (buf == 0) {
+      return -1;
+    }
+    tree->buf = buf;
+    tree->buf_size = buf_size;
+  }
+  unsigned char *data = &tree->buf[tree->buf_used];
+  struct record *rec = (struct record *)data;
+  struct entry *e = (struct entry *)&data[sizeof(*rec)];
+  rec->op = op;
+  e->key_size_bits = key_size_bits;
+  e->val_size = val_size;
+  size_t k_bytes = key_bytes(key_size_bits);
+  memcpy(e->data, key, k_bytes);
+  if (val_size != 0) {
+    memcpy(&e->data[k_bytes], val, val_size);
+  }
+  memset(&e->data[k_bytes + val_size], 0,
+         e_size - sizeof(*e) - k_bytes - val_size);
+  rec->check =
+      check(&data[sizeof(rec->check)], size - sizeof(rec->check));
+  tree->buf_used += size;
+  return 0;
+}
+
+static int commit_due(struct lbtree_dw *tree) {
+  return (tree->buf_used >= tree->commit_size) ? lbtree_dw_commit(tree) : 0;
+}
+
+int lbtree_dw_add(struct lbtree_dw *tree, const void *key,
+                  lbtree_index_t key_size_bits, const void *val,
+                  size_t val_size) {
+  struct entry *e = entry_new(key, key_size_bits, val, val_size);
+  if (e == 0) {
+    return -1;
+  }
+  size_t buf_used = tree->buf_used;
+  if (log_append(tree, RECORD_ADD, key, key_size_bits, val, val_size) != 0) {
+    free(e);
+    return -1;
+  }
+  if (entry_add(tree, e) != 0) {
+    tree->buf_used = buf_used;
+    free(e);
+    return -1;
+  }
+  return commit_due(tree);
+}
+
+const void *lbtree_dw(struct lbtree_dw *tree, const void *key,
+                      lbtree_index_t key_size_bits, size_t *val_size) {
+  if (tree->size_tree == 0) {
+    return 0;
+  }
+  struct entry *e = lbtree_d(tree->size_tree, (void *)key, key_size_bits);
+  if (e == 0) {
+    return 0;
+  }
+  *val_size = (size_t)e->val_size;
+  return &e->data[key_bytes(e->key_size_bits)];
+}
+
+int lbtree_dw_rm(struct lbtree_dw *tree, const void *key,
+                 lbtree_index_t key_size_bits) {
+  size_t val_size;
+  if (lbtree_dw(tree, key, key_size_bits, &val_size) == 0) {
+    return 0;
+  }
+  if (log_append(tree, RECORD_RM, key, key_size_bits, 0, 0) != 0) {
+    return -1;
+  }
+  entry_rm(tree, key, key_size_bits);
+  return commit_due(tree);
+}
+
+int lbtree_dw_commit(struct lbtree_dw *tree) {
+  if (tree->buf_used == 0) {
+    return 0;
+  }
+  size_t done = 0;
+  while (done != tree->buf_used) {
+    ssize_t r = pwrite(tree->log_fd, &tree->buf[done], tree->buf_used - done,
+                       (off_t)(tree->log_size + done));
+    if (r > 0) {
+      done += (size_t)r;
+    } else if ((r == 0) || (errno != EINTR)) {
+      break;
+    }
+  }
+  if ((done != tree->buf_used) || (fdatasync(tree->log_fd) != 0)) {
+    /* drop any part written, so that a retry appends to the committed log,
+      a failure here leaves a torn record that the next open discards */
+    int r = ftruncate(tree->log_fd, (off_t)tree->log_size);
+    (void)r;
+    return -1;
+  }
+  tree->log_size += tree->buf_used;
+  tree->buf_used = 0;
+  return 0;
+}
+
+static void *write_entry_action(const void *key, void **val, void *closure) {
+  (void)key;
+  struct entry *e = *val;
+  size_t size = entry_size(e->key_size_bits, e->val_size);
+  return (fwrite(e, 1, size, closure) != size) ? closure : 0;
+}
+
+/* Syncs the directory holding `path`, so that a rename into it is durable */
+static int dir_sync(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *dir = (slash == 0) ? path_new(".", "") : path_new(path, "");
+  if (dir == 0) {
+    return -1;
+  }
+  if (slash != 0) {
+    dir[(slash == path) ? 1 : (size_t)(slash - path)] = '\0';
+  }
+  int fd = open(dir, O_RDONLY);
+  free(dir);
+  if (fd == -1) {
+    return -1;
+  }
+  int r = fsync(fd);
+  close(fd);
+  return r;
+}
+
+int lbtree_dw_checkpoint(struct lbtree_dw *tree) {
+  if (lbtree_dw_commit(tree) != 0) {
+    return -1;
+  }
+  char *tmp_path = path_new(tree->path, ".tmp");
+  if (tmp_path == 0) {
+    return -1;
+  }
+  FILE *file = fopen(tmp_path, "wb");
+  int r = (file == 0) ? -1 : 0;
+  if (r == 0) {
+    if ((fwrite(checkpoint_magic, 1, sizeof(checkpoint_magic), file) !=
+         sizeof(checkpoint_magic)) ||
+        ((tree->size_tree != 0) &&
+         (lbtree_d_walk(tree->size_tree, &write_entry_action, file) != 0)) ||
+        (fflush(file) != 0) || (fsync(fileno(file)) != 0)) {
+      r = -1;
+    }
+    if (fclose(file) != 0) {
+      r = -1;
+    }
+  }
+  if ((r == 0) && (rename(tmp_path, tree->path) != 0)) {
+    r = -1;
+  }
+  if (r != 0) {
+    unlink(tmp_path);
+  }
+  free(tmp_path);
+  /* once the new checkpoint is in place the log is redundant, replaying it
+    over the checkpoint would change nothing */
+  if ((r != 0) || (dir_sync(tree->path) != 0) ||
+      (ftruncate(tree->log_fd, 0) != 0) || (fdatasync(tree->log_fd) != 0)) {
+    return -1;
+  }
+  tree->log_size = 0;
+
+  /* use the entries in the new checkpoint in place of those in memory and in
+    the old one, the keys are all in the tree so no node is allocated */
+  unsigned char *map;
+  size_t map_size;
+  if (checkpoint_map(tree->path, &map, &map_size) != 0) {
+    return -1;
+  }
+  size_t offset = sizeof(checkpoint_magic);
+  while (offset != map_size) {
+    struct entry *e = (struct entry *)&map[offset];
+    struct entry *old =
+        lbtree_d_add(&tree->size_tree, e->data, e->key_size_bits, e);
+    entry_del(tree, old);
+    offset += entry_size(e->key_size_bits, e->val_size);
+  }
+  if (tree->map != 0) {
+    munmap(tree->map, tree->map_size);
+  }
+  tree->map = map;
+  tree->map_size = map_size;
+  return 0;
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, lbtree_index_t key_size_bits,
+                  const void *val, size_t val_size, void *closure);
+  void *closure;
+};
+
+static void *walk_action(const void *key, void **val, void *v_closure) {
+  struct walk_closure *closure = v_closure;
+  struct entry *e = *val;
+  return closure->action(key, e->key_size_bits,
+                         &e->data[key_bytes(e->key_size_bits)],
+                         (size_t)e->val_size, closure->closure);
+}
+
+void *lbtree_dw_walk(struct lbtree_dw *tree,
+                     void *(*action)(const void *key,
+                                     lbtree_index_t key_size_bits,
+                                     const void *val, size_t val_size,
+                                     void *closure),
+                     void *closure) {
+  if (tree->size_tree == 0) {
+    return 0;
+  }
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  return lbtree_d_walk(tree->size_tree, &walk_action, &walk_closure);
+}
+
+int lbtree_dw_close(struct lbtree_dw *tree) {
+  int r = lbtree_dw_commit(tree);
+  tree_free(tree);
+  return r;
+}
@@ -0,0 +1,149 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DW_H
+#define LBTREE_DW_H
+
+#include "lbtree_d.h"
+
+#include <stddef.h>
+
+/*
+Durable variant of lbtree_d whose keys and values are byte strings, kept in a
+checkpoint file and a write-ahead log beside it (the checkpoint path with
+".log" appended). Adds and removals change the tree at once and are appended to
+an in-memory log buffer, which is written to the log file and synced in one go
+when it reaches `commit_size` bytes or `lbtree_dw_commit` is called, so many
+changes share the cost of one sync. Only committed changes survive a crash.
+
+Only the keys and values are stored, the nodes of the tree are rebuilt in memory
+whenever it is opened. The checkpoint is mapped and its pairs are used in place,
+so opening is a map, one add per key without copying and a replay of the changes
+logged since the last checkpoint, a torn record at the end of the log being
+discarded. `lbtree_dw_checkpoint` writes the whole tree to a new checkpoint,
+replaces the old one, empties the log and adds each key again to point its node
+at the new copy. Opening and checkpointing are therefore linear in the size of
+the tree, the log providing the durability of each commit and group commit but
+not a restart in less than a full rebuild.
+
+The files are in the byte order and layout of the host that wrote them.
+*/
+struct lbtree_dw {
+  struct lbtree_d *size_tree;
+  char *path;
+  int log_fd;
+  /* length of the committed log */
+  size_t log_size;
+  /* changes not yet committed */
+  unsigned char *buf;
+  size_t buf_size;
+  size_t buf_used;
+  size_t commit_size;
+  /* the mapped checkpoint, in which entries are not freed */
+  unsigned char *map;
+  size_t map_size;
+};
+
+/*
+Opens the tree stored at `path`, creating empty files if there are none, and
+replays its log. Returns non-zero on error, in which case nothing is left open.
+*/
+int lbtree_dw_open(struct lbtree_dw *tree, const char *path,
+                   size_t commit_size);
+
+/*
+Adds a key value pair to the tree, copying both, replacing the value of a
+matching key. Returns non-zero on memory allocation error, in which case the
+tree is unchanged, or if a commit it causes fails.
+*/
+int lbtree_dw_add(struct lbtree_dw *tree, const void *key,
+                  lbtree_index_t key_size_bits, const void *val,
+                  size_t val_size);
+
+static inline int lbtree_dwc_add(struct lbtree_dw *tree, const void *key,
+                                 lbtree_index_t key_size, const void *val,
+                                 size_t val_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? -1
+             : lbtree_dw_add(tree, key, key_size_bits, val, val_size);
+}
+
+/*
+Performs a lookup on the tree.
+Returns the value whose associated key matches the `key` argument, setting
+`val_size` to its size, or zero if one is not found. The value is valid until
+the key is next added or removed or the tree is checkpointed or closed.
+*/
+const void *lbtree_dw(struct lbtree_dw *tree, const void *key,
+                      lbtree_index_t key_size_bits, size_t *val_size);
+
+static inline const void *lbtree_dwc(struct lbtree_dw *tree, const void *key,
+                                     lbtree_index_t key_size,
+                                     size_t *val_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_dw(tree, key, key_size_bits, val_size);
+}
+
+/*
+Removes a single key value pair from the tree, if found.
+Returns non-zero on memory allocation error or if a commit it causes fails.
+*/
+int lbtree_dw_rm(struct lbtree_dw *tree, const void *key,
+                 lbtree_index_t key_size_bits);
+
+static inline int lbtree_dwc_rm(struct lbtree_dw *tree, const void *key,
+                                lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? -1
+             : lbtree_dw_rm(tree, key, key_size_bits);
+}
+
+/*
+Writes the uncommitted changes to the log and syncs it.
+Returns non-zero on error, in which case the changes stay uncommitted.
+*/
+int lbtree_dw_commit(struct lbtree_dw *tree);
+
+/*
+Commits, writes the whole tree to a new checkpoint that atomically replaces the
+old one and empties the log, so that the next open need not replay it.
+Returns non-zero on error, in which case the old checkpoint and log still hold
+every committed change.
+*/
+int lbtree_dw_checkpoint(struct lbtree_dw *tree);
+
+/*
+Calls `action` once for each key value pair in the tree. The walk will stop when
+any action returns a non-null pointer. Returns the action return value causing
+the walk to stop, otherwise zero.
+*/
+void *lbtree_dw_walk(struct lbtree_dw *tree,
+                     void *(*action)(const void *key,
+                                     lbtree_index_t key_size_bits,
+                                     const void *val, size_t val_size,
+                                     void *closure),
+                     void *closure);
+
+/*
+Commits and frees the tree. Returns non-zero if the commit failed, in which
+case the uncommitted changes are lost.
+*/
+int lbtree_dw_close(struct lbtree_dw *tree);
+
+#endif
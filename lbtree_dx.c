@@ -0,0 +1,269 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Wrapper around lbtree_d whose values point to timers, held in the slots of a
+  hierarchical timer wheel, that hold the values */
+
+#include "lbtree_dx.h"
+
+#include <stdlib.h>
+
+/* Returns the number of trailing zero bits in `x`, which must be non-zero */
+static inline unsigned int ctz64(uint64_t x) {
+#if defined(__GNUC__)
+  return (unsigned int)__builtin_ctzll(x);
+#else
+  unsigned int n = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+/* Returns the index of the most significant set bit in `x`, which must be
+  non-zero */
+static inline unsigned int msb64(uint64_t x) {
+#if defined(__GNUC__)
+  return 63 - (unsigned int)__builtin_clzll(x);
+#else
+  unsigned int n = 0;
+  while ((x >>= 1) != 0) {
+    ++n;
+  }
+  return n;
+#endif
+}
+
+void lbtree_dx_init(struct lbtree_dx *tree, uint64_t now,
+                    void (*expire)(const void *key, void *val, void *closure),
+                    void *closure) {
+  tree->size_tree = 0;
+  unsigned int level;
+  unsigned int slot;
+  for (level = 0; level < LBTREE_DX_LEVELS; ++level) {
+    for (slot = 0; slot < LBTREE_DX_SLOTS; ++slot) {
+      tree->wheel[level][slot] = 0;
+    }
+    tree->occupied[level] = 0;
+  }
+  tree->now = now;
+  tree->count = 0;
+  tree->expire = expire;
+  tree->closure = closure;
+}
+
+/* Adds `timer` to the slot of the lowest level whose span holds both its
+  expiry time and the time of the tree, the level being given by the most
+  significant bit in which the two differ */
+static void timer_link(struct lbtree_dx *tree, struct lbtree_dx_timer *timer) {
+  /* a pair that has expired is removed by the next tick */
+  uint64_t at = (timer->expires > tree->now) ? timer->expires : tree->now + 1;
+  unsigned int level = msb64(at ^ tree->now) / LBTREE_DX_SLOT_BITS;
+  unsigned int slot =
+      (at >> (level * LBTREE_DX_SLOT_BITS)) & (LBTREE_DX_SLOTS - 1);
+  struct lbtree_dx_timer **head = &tree->wheel[level][slot];
+  timer->next = *head;
+  if (*head != 0) {
+    (*head)->prev = &timer->next;
+  }
+  timer->prev = head;
+  *head = timer;
+  timer->level = (unsigned char)level;
+  timer->slot = (unsigned char)slot;
+  tree->occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void timer_unlink(struct lbtree_dx *tree,
+                         struct lbtree_dx_timer *timer) {
+  *timer->prev = timer->next;
+  if (timer->next != 0) {
+    timer->next->prev = timer->prev;
+  }
+  if (tree->wheel[timer->level][timer->slot] == 0) {
+    tree->occupied[timer->level] &= ~((uint64_t)1 << timer->slot);
+  }
+}
+
+void *lbtree_dx_add(struct lbtree_dx *tree, void *key,
+                    lbtree_index_t key_size_bits, void *val, uint64_t expires) {
+  void **slot = lbtree_d_slot(&tree->size_tree, key, key_size_bits);
+  if (slot == 0) {
+    return val;
+  }
+  struct lbtree_dx_timer *timer = *slot;
+  if (timer != 0) {
+    void *old_val = timer->val;
+    timer->node->key = key;
+    timer->val = val;
+    timer_unlink(tree, timer);
+    timer->expires = expires;
+    timer_link(tree, timer);
+    return old_val;
+  }
+
+  timer = malloc(sizeof(*timer));
+  if (timer == 0) {
+    /* the node added for the pair has a zero value */
+    lbtree_d_rm(&tree->size_tree, key, key_size_bits);
+    return val;
+  }
+  timer->node = lbtree_d_slot_node(slot);
+  timer->val = val;
+  timer->expires = expires;
+  timer->key_size_bits = key_size_bits;
+  timer_link(tree, timer);
+  *slot = timer;
+  ++tree->count;
+  return 0;
+}
+
+int lbtree_dx_touch(struct lbtree_dx *tree, void *key,
+                    lbtree_index_t key_size_bits, uint64_t expires) {
+  struct lbtree_d *node =
+      lbtree_d_node_find(tree->size_tree, key, key_size_bits);
+  if (node == 0) {
+    return -1;
+  }
+  struct lbtree_dx_timer *timer = node->val;
+  timer_unlink(tree, timer);
+  timer->expires = expires;
+  timer_link(tree, timer);
+  return 0;
+}
+
+void *lbtree_dx(struct lbtree_dx *tree, void *key,
+                lbtree_index_t key_size_bits) {
+  struct lbtree_d *node =
+      lbtree_d_node_find(tree->size_tree, key, key_size_bits);
+  return (node == 0) ? 0 : ((struct lbtree_dx_timer *)node->val)->val;
+}
+
+void *lbtree_dx_rm(struct lbtree_dx *tree, void *key,
+                   lbtree_index_t key_size_bits) {
+  struct lbtree_dx_timer *timer =
+      lbtree_d_rm(&tree->size_tree, key, key_size_bits);
+  if (timer == 0) {
+    return 0;
+  }
+  void *val = timer->val;
+  timer_unlink(tree, timer);
+  free(timer);
+  --tree->count;
+  return val;
+}
+
+size_t lbtree_dx_tick(struct lbtree_dx *tree, uint64_t now) {
+  size_t expired = 0;
+  while (tree->now < now) {
+    /* the next slot reached is the first one occupied after the time of the
+      tree in the lowest level that has one, as each level's slots all start
+      after those of the level below end */
+    unsigned int level;
+    uint64_t above = 0;
+    for (level = 0; level < LBTREE_DX_LEVELS; ++level) {
+      unsigned int shift = level * LBTREE_DX_SLOT_BITS;
+      unsigned int current = (tree->now >> shift) & (LBTREE_DX_SLOTS - 1);
+      /* the slots after `current`, none if it is the last */
+      above = tree->occupied[level] & ~(((uint64_t)2 << current) - 1);
+      if (above != 0) {
+        break;
+      }
+    }
+    if (above == 0) {
+      tree->now = now;
+      break;
+    }
+    unsigned int shift = level * LBTREE_DX_SLOT_BITS;
+    unsigned int slot = ctz64(above);
+    unsigned int span_bits = shift + LBTREE_DX_SLOT_BITS;
+    uint64_t start =
+        ((span_bits < 64) ? ((tree->now >> span_bits) << span_bits) : 0) |
+        ((uint64_t)slot << shift);
+    if (start > now) {
+      tree->now = now;
+      break;
+    }
+    tree->now = start;
+
+    struct lbtree_dx_timer *timer = tree->wheel[level][slot];
+    tree->wheel[level][slot] = 0;
+    tree->occupied[level] &= ~((uint64_t)1 << slot);
+    while (timer != 0) {
+      struct lbtree_dx_timer *next = timer->next;
+      if (timer->expires > tree->now) {
+        /* to a lower level, as the time of the tree is now in this slot */
+        timer_link(tree, timer);
+      } else {
+        void *key = timer->node->key;
+        void *val = timer->val;
+        lbtree_d_rm_node(&tree->size_tree, timer->node, timer->key_size_bits);
+        free(timer);
+        --tree->count;
+        ++expired;
+        if (tree->expire != 0) {
+          tree->expire(key, val, tree->closure);
+        }
+      }
+      timer = next;
+    }
+  }
+  return expired;
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(const void *key, void **val, void *v_closure) {
+  struct walk_closure *closure = v_closure;
+  struct lbtree_dx_timer *timer = *val;
+  return closure->action(key, &timer->val, closure->closure);
+}
+
+void *lbtree_dx_walk(struct lbtree_dx *tree,
+                     void *(*action)(const void *key, void **val,
+                                     void *closure),
+                     void *closure) {
+  if (tree->size_tree == 0) {
+    return 0;
+  }
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  return lbtree_d_walk(tree->size_tree, &walk_action, &walk_closure);
+}
+
+void lbtree_dx_free(struct lbtree_dx *tree) {
+  unsigned int level;
+  unsigned int slot;
+  for (level = 0; level < LBTREE_DX_LEVELS; ++level) {
+    for (slot = 0; slot < LBTREE_DX_SLOTS; ++slot) {
+      struct lbtree_dx_timer *timer = tree->wheel[level][slot];
+      while (timer != 0) {
+        struct lbtree_dx_timer *next = timer->next;
+        free(timer);
+        timer = next;
+      }
+      tree->wheel[level][slot] = 0;
+    }
+    tree->occupied[level] = 0;
+  }
+  if (tree->size_tree != 0) {
+    lbtree_d_free(tree->size_tree);
+    tree->size_tree = 0;
+  }
+  tree->count = 0;
+}
@@ -0,0 +1,168 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DX_H
+#define LBTREE_DX_H
+
+#include "lbtree_d.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Variant of lbtree_d whose pairs each expire at a time given as they are added,
+in units of the caller's choosing. `lbtree_dx_tick` advances the time of the
+tree, removing the pairs that expire by then.
+
+The expiry times are held in a hierarchical timer wheel: level `l` has
+`LBTREE_DX_SLOTS` slots, each a list of the pairs expiring in one span of
+`LBTREE_DX_SLOTS` to the power `l` units, the spans of a level together covering
+one span of the level above. A pair is held in the lowest level whose span
+holds both its expiry time and the time of the tree, and a tick moves the pairs
+of each slot it reaches down a level, or removes them if they have expired. So
+a pair moves at most once a level, each tick passes over empty slots a level at
+a time, and the pairs that do not expire are not visited.
+*/
+#define LBTREE_DX_SLOT_BITS (6)
+#define LBTREE_DX_SLOTS (1 << LBTREE_DX_SLOT_BITS)
+/* enough levels for every 64 bit time */
+#define LBTREE_DX_LEVELS ((64 + LBTREE_DX_SLOT_BITS - 1) / LBTREE_DX_SLOT_BITS)
+
+struct lbtree_dx_timer {
+  /* the key node of the pair */
+  struct lbtree_d *node;
+  void *val;
+  uint64_t expires;
+  struct lbtree_dx_timer *next;
+  /* the ref to this timer, either a slot or the `next` of another timer */
+  struct lbtree_dx_timer **prev;
+  lbtree_index_t key_size_bits;
+  unsigned char level;
+  unsigned char slot;
+};
+
+struct lbtree_dx {
+  struct lbtree_d *size_tree;
+  struct lbtree_dx_timer *wheel[LBTREE_DX_LEVELS][LBTREE_DX_SLOTS];
+  /* a set bit for each slot that is not empty */
+  uint64_t occupied[LBTREE_DX_LEVELS];
+  uint64_t now;
+  size_t count;
+  void (*expire)(const void *key, void *val, void *closure);
+  void *closure;
+};
+
+/*
+Initialises an empty tree at time `now`. `expire`, if not null, is called with
+each pair removed by `lbtree_dx_tick`, which may then be freed, and must not
+change the tree.
+*/
+void lbtree_dx_init(struct lbtree_dx *tree, uint64_t now,
+                    void (*expire)(const void *key, void *val, void *closure),
+                    void *closure);
+
+/*
+Adds a key value pair that expires at time `expires` to the tree, the value
+pointed to by `key` must persist as for `lbtree_d_add` until the pair is
+removed or replaced. A pair that expires no later than the time of the tree is
+removed by the next tick that advances it.
+Returns the value associated with a matching key in the tree (this key value
+pair is replaced by this function, along with its expiry time), or zero if one
+is not found. `val` on memory allocation error, in which case the tree is
+unchanged.
+*/
+void *lbtree_dx_add(struct lbtree_dx *tree, void *key,
+                    lbtree_index_t key_size_bits, void *val, uint64_t expires);
+
+static inline void *lbtree_dxc_add(struct lbtree_dx *tree, void *key,
+                                   lbtree_index_t key_size, void *val,
+                                   uint64_t expires) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? key
+             : lbtree_dx_add(tree, key, key_size_bits, val, expires);
+}
+
+/*
+Sets the expiry time of the pair whose key matches the `key` argument.
+Returns non-zero if one is not found.
+*/
+int lbtree_dx_touch(struct lbtree_dx *tree, void *key,
+                    lbtree_index_t key_size_bits, uint64_t expires);
+
+static inline int lbtree_dxc_touch(struct lbtree_dx *tree, void *key,
+                                   lbtree_index_t key_size, uint64_t expires) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? -1
+             : lbtree_dx_touch(tree, key, key_size_bits, expires);
+}
+
+/*
+Performs a lookup on the tree.
+Returns the value whose associated key matches the `key` argument, or zero if
+one is not found.
+*/
+void *lbtree_dx(struct lbtree_dx *tree, void *key,
+                lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dxc(struct lbtree_dx *tree, void *key,
+                               lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_dx(tree, key, key_size_bits);
+}
+
+/*
+Removes a single key value pair from the tree, without passing it to `expire`.
+Returns the associated value if found and removed, otherwise zero.
+*/
+void *lbtree_dx_rm(struct lbtree_dx *tree, void *key,
+                   lbtree_index_t key_size_bits);
+
+static inline void *lbtree_dxc_rm(struct lbtree_dx *tree, void *key,
+                                  lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_dx_rm(tree, key, key_size_bits);
+}
+
+/*
+Advances the time of the tree to `now`, removing every pair that expires no
+later than `now` and passing it to `expire`. A time earlier than that of the
+tree leaves it unchanged.
+Returns the number of pairs removed.
+*/
+size_t lbtree_dx_tick(struct lbtree_dx *tree, uint64_t now);
+
+/*
+Calls `action` once for each key value pair in the tree. The walk will stop
+when any action returns a non-null pointer.
+Returns the action return value causing the walk to stop, otherwise zero.
+*/
+void *lbtree_dx_walk(struct lbtree_dx *tree,
+                     void *(*action)(const void *key, void **val,
+                                     void *closure),
+                     void *closure);
+
+/*
+Frees all the nodes in the tree, without passing the pairs to `expire`, leaving
+it empty at the same time.
+*/
+void lbtree_dx_free(struct lbtree_dx *tree);
+
+#endif
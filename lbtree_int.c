@@ -0,0 +1,100 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_int.h"
+
+/* Returns the number of trailing zero bits in `x`, which must be non-zero */
+static inline unsigned int ctz64(uint64_t x) {
+#if defined(__GNUC__)
+  return (unsigned int)__builtin_ctzll(x);
+#else
+  unsigned int n = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+/* Bits are selected least significant first, so the index of a new node is
+  that of the least significant bit in which its key differs from the key found
+  by looking it up, `diff` is the two keys xored */
+static inline lbtree_index_t lbtree_u32_index(uint32_t diff) {
+  return ctz64(diff);
+}
+
+static inline lbtree_index_t lbtree_u64_index(uint64_t diff) {
+  return ctz64(diff);
+}
+
+#ifdef LBTREE_U128
+static inline lbtree_index_t lbtree_u128_index(lbtree_u128_t diff) {
+  uint64_t low = (uint64_t)diff;
+  return (low != 0) ? ctz64(low) : (64 + ctz64((uint64_t)(diff >> 64)));
+}
+#endif
+
+#define LBTREE_INT_DEFINE(name, type)                                          \
+  static unsigned int name##_sel_key(void *key, lbtree_index_t index) {        \
+    return (*(type *)key >> index) & 1;                                        \
+  }                                                                            \
+                                                                               \
+  static unsigned int name##_sel_node(void *node, lbtree_index_t index) {      \
+    return name##_sel_key(&((struct name *)node)->key, index);                 \
+  }                                                                            \
+                                                                               \
+  void *name##_add(struct name **tree, struct name *node) {                    \
+    if (*tree == 0) {                                                          \
+      lbtree_init(&node->base);                                                \
+      *tree = node;                                                            \
+      return 0;                                                                \
+    }                                                                          \
+    struct name *match = name##_best(*tree, node->key);                        \
+    type diff = match->key ^ node->key;                                        \
+    if (diff == 0) {                                                           \
+      lbtree_repl((struct lbtree **)tree, &name##_sel_node, &match->base,      \
+                  &node->base);                                                \
+      return match;                                                            \
+    }                                                                          \
+    node->base.index = name##_index(diff);                                     \
+    lbtree_add((struct lbtree **)tree, &name##_sel_node, &node->base);         \
+    return 0;                                                                  \
+  }                                                                            \
+                                                                               \
+  void name##_rm(struct name **tree, struct name *node) {                      \
+    lbtree_rm((struct lbtree **)tree, &name##_sel_node, &node->base);          \
+  }                                                                            \
+                                                                               \
+  void *name##_rm_key(struct name **tree, type key) {                          \
+    if (name(*tree, key) == 0) {                                               \
+      return 0;                                                                \
+    }                                                                          \
+    return lbtree_rm_key((struct lbtree **)tree, &name##_sel_key, &key);       \
+  }                                                                            \
+                                                                               \
+  void *name##_walk(struct name *tree,                                         \
+                    void *(*action)(void *node, void *closure),                \
+                    void *closure) {                                           \
+    return lbtree_walk((struct lbtree *)tree, &name##_sel_node, action,        \
+                       closure);                                               \
+  }
+
+LBTREE_INT_DEFINE(lbtree_u32, uint32_t)
+LBTREE_INT_DEFINE(lbtree_u64, uint64_t)
+
+#ifdef LBTREE_U128
+LBTREE_INT_DEFINE(lbtree_u128, lbtree_u128_t)
+#endif
@@ -0,0 +1,99 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_INT_H
+#define LBTREE_INT_H
+
+#include "lbtree.h"
+
+#include <stdint.h>
+
+/*
+Trees keyed by fixed width unsigned integers. As with lbtree, nodes are
+allocated by the user and must begin with the tree's node struct, for example:
+
+  struct my_node {
+    struct lbtree_u64 base;
+    void *val;
+  };
+
+Each width provides, with `name` one of `lbtree_u32`, `lbtree_u64` and (where
+the compiler supports 128 bit integers, in which case `LBTREE_U128` is defined)
+`lbtree_u128`:
+
+  void *name_add(struct name **tree, struct name *node);
+Adds `node`, whose key must be set, to the tree. Returns the node with a
+matching key that `node` replaced, or zero if there was none.
+
+  void *name(struct name *tree, type key);
+Returns the node with a matching key, or zero if there is none.
+
+  void name_rm(struct name **tree, struct name *node);
+Removes `node`, which must be in the tree.
+
+  void *name_rm_key(struct name **tree, type key);
+Removes and returns the node with a matching key, or returns zero if there is
+none.
+
+  void *name_walk(struct name *tree, void *(*action)(void *node, void *closure),
+                  void *closure);
+As `lbtree_walk`.
+
+Lookups are inlined into the caller and select each child directly from the key
+rather than through a selector function.
+*/
+#define LBTREE_INT_DECLARE(name, type)                                         \
+  struct name {                                                                \
+    struct lbtree base;                                                        \
+    type key;                                                                  \
+  };                                                                           \
+                                                                               \
+  void *name##_add(struct name **tree, struct name *node);                     \
+  void name##_rm(struct name **tree, struct name *node);                       \
+  void *name##_rm_key(struct name **tree, type key);                           \
+  void *name##_walk(struct name *tree,                                         \
+                    void *(*action)(void *node, void *closure),                \
+                    void *closure);                                            \
+                                                                               \
+  /* Returns the node reached by looking up `key` in a non-empty tree, which   \
+    only has a matching key if there is one in the tree. */                    \
+  static inline struct name *name##_best(struct name *tree, type key) {        \
+    struct lbtree *node = &tree->base;                                         \
+    lbtree_index_t parent_index;                                               \
+    do {                                                                       \
+      parent_index = node->index;                                              \
+      node = node->children[(key >> parent_index) & 1];                        \
+    } while (lbtree_index_gt(node->index, parent_index) != 0);                 \
+    return (struct name *)node;                                                \
+  }                                                                            \
+                                                                               \
+  static inline void *name(struct name *tree, type key) {                      \
+    if (tree == 0) {                                                           \
+      return 0;                                                                \
+    }                                                                          \
+    struct name *node = name##_best(tree, key);                                \
+    return (node->key == key) ? node : 0;                                      \
+  }
+
+LBTREE_INT_DECLARE(lbtree_u32, uint32_t)
+LBTREE_INT_DECLARE(lbtree_u64, uint64_t)
+
+#ifdef __SIZEOF_INT128__
+#define LBTREE_U128
+typedef unsigned __int128 lbtree_u128_t;
+LBTREE_INT_DECLARE(lbtree_u128, lbtree_u128_t)
+#endif
+
+#endif
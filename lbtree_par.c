@@ -0,0 +1,338 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_par.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+/* depth of the branches below which a subtree is walked by one thread */
+#define SPLIT_DEPTH (16)
+#define TASKS_MIN_SIZE (64)
+
+struct task {
+  struct lbtree *node;
+  unsigned int depth;
+  /* non-zero if `node` is passed to the action rather than walked */
+  int leaf;
+};
+
+/* Tasks from `head` up to `tail` are queued, the owning thread taking the most
+  recently queued from the tail and other threads the oldest, nearest the root,
+  from the head */
+struct queue {
+  pthread_mutex_t lock;
+  struct task *tasks;
+  size_t size;
+  size_t head;
+  size_t tail;
+};
+
+struct pool {
+  pthread_mutex_t lock;
+  /* tasks queued or being run, the walk is done when none remain */
+  size_t pending;
+  void *result;
+  unsigned int (*sel_node)(void *node, lbtree_index_t index);
+  void *(*action)(void *node, void *closure);
+  struct worker *workers;
+  unsigned int worker_count;
+};
+
+struct worker {
+  struct queue queue;
+  struct pool *pool;
+  void *closure;
+  pthread_t thread;
+  int started;
+};
+
+static int queue_push(struct queue *queue, struct task task) {
+  pthread_mutex_lock(&queue->lock);
+  if (queue->tail == queue->size) {
+    if (queue->head != 0) {
+      memmove(queue->tasks, &queue->tasks[queue->head],
+              (queue->tail - queue->head) * sizeof(*queue->tasks));
+      queue->tail -= queue->head;
+      queue->head = 0;
+    } else {
+      size_t size =
+          (queue->size == 0) ? TASKS_MIN_SIZE : (queue->size * 2);
+      struct task *tasks = realloc(queue->tasks, size * sizeof(*tasks));
+      if (tasks == 0) {
+        pthread_mutex_unlock(&queue->lock);
+        return -1;
+      }
+      queue->tasks = tasks;
+      queue->size = size;
+    }
+  }
+  queue->tasks[queue->tail++] = task;
+  pthread_mutex_unlock(&queue->lock);
+  return 0;
+}
+
+/* Takes a task from the tail if `own`, otherwise from the head. Returns
+  non-zero if the queue is empty. */
+static int queue_take(struct queue *queue, int own, struct task *task) {
+  int empty = 1;
+  pthread_mutex_lock(&queue->lock);
+  if (queue->tail != queue->head) {
+    *task = own ? queue->tasks[--queue->tail] : queue->tasks[queue->head++];
+    empty = 0;
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return empty;
+}
+
+static void *task_run(struct worker *worker, struct task task);
+
+/* Queues `task`, or runs it now if it cannot be queued */
+static void *task_spawn(struct worker *worker, struct task task) {
+  struct pool *pool = worker->pool;
+  pthread_mutex_lock(&pool->lock);
+  ++pool->pending;
+  pthread_mutex_unlock(&pool->lock);
+  if (queue_push(&worker->queue, task) == 0) {
+    return 0;
+  }
+  pthread_mutex_lock(&pool->lock);
+  --pool->pending;
+  pthread_mutex_unlock(&pool->lock);
+  return task_run(worker, task);
+}
+
+static void *task_run(struct worker *worker, struct task task) {
+  struct pool *pool = worker->pool;
+  if (task.leaf != 0) {
+    return pool->action(task.node, worker->closure);
+  }
+  if (task.depth >= SPLIT_DEPTH) {
+    return lbtree_walk(task.node, pool->sel_node, pool->action,
+                       worker->closure);
+  }
+  struct lbtree *node = task.node;
+  lbtree_index_t index = node->index;
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree *child = node->children[i];
+    if (pool->sel_node(child, index) != i) {
+      continue;
+    }
+    void *r;
+    if (lbtree_index_gt(child->index, index) != 0) {
+      struct task sub = {.node = child, .depth = task.depth + 1, .leaf = 0};
+      r = task_spawn(worker, sub);
+    } else {
+      r = pool->action(child, worker->closure);
+    }
+    if (r != 0) {
+      return r;
+    }
+  }
+  return 0;
+}
+
+static void *worker_run(void *v_worker) {
+  struct worker *worker = v_worker;
+  struct pool *pool = worker->pool;
+  unsigned int id = (unsigned int)(worker - pool->workers);
+  for (;;) {
+    struct task task;
+    int empty = queue_take(&worker->queue, 1, &task);
+    unsigned int i;
+    for (i = 1; (empty != 0) && (i < pool->worker_count); ++i) {
+      struct worker *victim =
+          &pool->workers[(id + i) % pool->worker_count];
+      empty = queue_take(&victim->queue, 0, &task);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    int done = (empty != 0) ? (pool->pending == 0) : (pool->result != 0);
+    pthread_mutex_unlock(&pool->lock);
+    if (empty != 0) {
+      if (done != 0) {
+        break;
+      }
+      sched_yield();
+      continue;
+    }
+
+    /* once stopped the remaining tasks are dropped */
+    void *r = (done == 0) ? task_run(worker, task) : 0;
+    pthread_mutex_lock(&pool->lock);
+    if ((r != 0) && (pool->result == 0)) {
+      pool->result = r;
+    }
+    --pool->pending;
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return 0;
+}
+
+/* Walks the trees or leaves of `roots`, setting `result` to the pointer that
+  stopped the walk or zero. Returns non-zero if the walk could not be started
+  and should be made by the calling thread alone. */
+static int par_walk(struct task *roots, size_t root_count,
+                    unsigned int (*sel_node)(void *node,
+                                             lbtree_index_t index),
+                    void *(*action)(void *node, void *closure),
+                    void **closures, unsigned int thread_count,
+                    void **result) {
+  if (thread_count < 2) {
+    return -1;
+  }
+  struct worker *workers = malloc(thread_count * sizeof(*workers));
+  if (workers == 0) {
+    return -1;
+  }
+  struct pool pool = {.pending = 0,
+                      .result = 0,
+                      .sel_node = sel_node,
+                      .action = action,
+                      .workers = workers,
+                      .worker_count = thread_count};
+  pthread_mutex_init(&pool.lock, 0);
+  unsigned int i;
+  for (i = 0; i < thread_count; ++i) {
+    struct worker *worker = &workers[i];
+    pthread_mutex_init(&worker->queue.lock, 0);
+    worker->queue.tasks = 0;
+    worker->queue.size = 0;
+    worker->queue.head = 0;
+    worker->queue.tail = 0;
+    worker->pool = &pool;
+    worker->closure = closures[i];
+    worker->started = 0;
+  }
+
+  /* the roots are queued on the calling thread's queue before the other
+    threads start and take them from it */
+  size_t j;
+  for (j = 0; (j < root_count) && (pool.result == 0); ++j) {
+    pool.result = task_spawn(&workers[0], roots[j]);
+  }
+  /* threads that fail to start leave their share to the others */
+  for (i = 1; i < thread_count; ++i) {
+    workers[i].started = (pthread_create(&workers[i].thread, 0, &worker_run,
+                                         &workers[i]) == 0)
+                             ? 1
+                             : 0;
+  }
+  worker_run(&workers[0]);
+  for (i = 1; i < thread_count; ++i) {
+    if (workers[i].started != 0) {
+      pthread_join(workers[i].thread, 0);
+    }
+  }
+
+  for (i = 0; i < thread_count; ++i) {
+    free(workers[i].queue.tasks);
+    pthread_mutex_destroy(&workers[i].queue.lock);
+  }
+  pthread_mutex_destroy(&pool.lock);
+  free(workers);
+  *result = pool.result;
+  return 0;
+}
+
+void *lbtree_par_walk(struct lbtree *tree,
+                      unsigned int (*sel_node)(void *node,
+                                               lbtree_index_t index),
+                      void *(*action)(void *node, void *closure),
+                      void **closures, unsigned int thread_count) {
+  if (tree == 0) {
+    return 0;
+  }
+  struct task root = {.node = tree, .depth = 0, .leaf = 0};
+  void *result;
+  if (par_walk(&root, 1, sel_node, action, closures, thread_count, &result) !=
+      0) {
+    return lbtree_walk(tree, sel_node, action, closures[0]);
+  }
+  return result;
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_key_action(void *node, void *v_closure) {
+  struct lbtree_d *dyn_node = node;
+  struct walk_closure *closure = v_closure;
+  return closure->action(dyn_node->key, &dyn_node->val, closure->closure);
+}
+
+struct roots {
+  struct task *tasks;
+  size_t count;
+};
+
+/* Adds the key tree of a size node to the roots, or counts it if there are no
+  tasks to fill yet */
+static void *root_size_action(void *node, void *v_roots) {
+  struct lbtree_d_size *dyn_size = node;
+  struct roots *roots = v_roots;
+  if (roots->tasks != 0) {
+    /* read through the key pointer so that layout compatible wrappers can
+      share the walk, a lone node with a zero size key is not walked as its
+      key must not be read */
+    struct task task = {
+        .node = dyn_size->base.val,
+        .depth = 0,
+        .leaf = (*(lbtree_index_t *)dyn_size->base.key == 0) ? 1 : 0};
+    roots->tasks[roots->count] = task;
+  }
+  ++roots->count;
+  return 0;
+}
+
+void *lbtree_d_par_walk(struct lbtree_d *size_tree,
+                        void *(*action)(const void *key, void **val,
+                                        void *closure),
+                        void **closures, unsigned int thread_count) {
+  if (size_tree == 0) {
+    return 0;
+  }
+  struct roots roots = {.tasks = 0, .count = 0};
+  lbtree_walk(&size_tree->base, &lbtree_d_sel_node, &root_size_action, &roots);
+  roots.tasks = malloc(roots.count * sizeof(*roots.tasks));
+  struct walk_closure *walk_closures =
+      malloc(thread_count * sizeof(*walk_closures));
+  void **v_closures = malloc(thread_count * sizeof(*v_closures));
+  void *result = 0;
+  int error = ((roots.tasks == 0) || (walk_closures == 0) || (v_closures == 0))
+                  ? -1
+                  : 0;
+  if (error == 0) {
+    roots.count = 0;
+    lbtree_walk(&size_tree->base, &lbtree_d_sel_node, &root_size_action,
+                &roots);
+    unsigned int i;
+    for (i = 0; i < thread_count; ++i) {
+      walk_closures[i].action = action;
+      walk_closures[i].closure = closures[i];
+      v_closures[i] = &walk_closures[i];
+    }
+    error = par_walk(roots.tasks, roots.count, &lbtree_d_sel_node,
+                     &walk_key_action, v_closures, thread_count, &result);
+  }
+  free(v_closures);
+  free(walk_closures);
+  free(roots.tasks);
+  return (error != 0) ? lbtree_d_walk(size_tree, action, closures[0]) : result;
+}
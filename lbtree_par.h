@@ -0,0 +1,53 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_PAR_H
+#define LBTREE_PAR_H
+
+#include "lbtree.h"
+#include "lbtree_d.h"
+
+/*
+Parallel walks, which visit every node of a tree once using POSIX threads.
+The branches nearest the root are queued as separate subtrees on the queue of
+the thread that reached them, and a thread whose queue is empty takes the
+subtree nearest the root from another thread's queue, so the work stays spread
+across threads however unbalanced the tree. Deeper subtrees are walked by the
+thread that took them as by `lbtree_walk`.
+
+`thread_count` threads are used, including the calling thread, and each passes
+its own element of `closures` to `action`, so that results can be gathered per
+thread without locking and combined once the walk returns. The order in which
+nodes are visited is unspecified and the tree must not be modified during the
+walk. If memory cannot be allocated, or `thread_count` is one, the walk is made
+by the calling thread alone.
+
+When an action returns a non-null pointer the threads stop taking subtrees and
+that pointer is returned, though subtrees already being walked by other threads
+are completed. If several actions return non-null pointers, one of them is
+returned. Otherwise zero is returned.
+*/
+void *lbtree_par_walk(struct lbtree *tree,
+                      unsigned int (*sel_node)(void *node,
+                                               lbtree_index_t index),
+                      void *(*action)(void *node, void *closure),
+                      void **closures, unsigned int thread_count);
+
+void *lbtree_d_par_walk(struct lbtree_d *size_tree,
+                        void *(*action)(const void *key, void **val,
+                                        void *closure),
+                        void **closures, unsigned int thread_count);
+
+#endif
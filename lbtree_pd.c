@@ -0,0 +1,786 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Path copying wrapper around lbtree_d.
+
+  Every node records the number of references to it from parent nodes (or
+  versions), and separately the number of leaf references to it, not counting
+  references a node makes to itself. A modification copies each node on its
+  path that has another parent before changing it.
+
+  Copying a node does not update the leaf reference to it, which lies further
+  down the path to its key, so a version may reference an older copy of one of
+  its own nodes as a leaf. The older copy holds the same key and value, so this
+  is harmless until that key value pair is changed or removed, at which point
+  the leaf reference is first pointed at the current copy.
+*/
+
+#include "lbtree_pd.h"
+
+#include <string.h>
+
+#define HOLDER_COUNT (4)
+
+struct lbtree_pd_size {
+  struct lbtree_pd base;
+  lbtree_index_t key_size_bits;
+};
+
+static void ref_release(struct lbtree_pd *node, int is_size);
+
+static void node_free(struct lbtree_pd *node, int is_size) {
+  if ((is_size != 0) && (node->base.val != 0)) {
+    ref_release(node->base.val, 0);
+  }
+  free(node);
+}
+
+static void back_release(struct lbtree_pd *node, int is_size) {
+  if ((--node->back_refs == 0) && (node->refs == 0)) {
+    node_free(node, is_size);
+  }
+}
+
+static void ref_release(struct lbtree_pd *node, int is_size) {
+  if (--node->refs != 0) {
+    return;
+  }
+  /* hold the node while its descendants drop their leaf references to it, it
+    is then only reached as a leaf and so only references itself */
+  ++node->back_refs;
+  struct lbtree *base = &node->base.base;
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree *child = base->children[i];
+    if (child == base) {
+      continue;
+    }
+    base->children[i] = base;
+    if (lbtree_index_gt(child->index, base->index) != 0) {
+      ref_release((struct lbtree_pd *)child, is_size);
+    } else {
+      back_release((struct lbtree_pd *)child, is_size);
+    }
+  }
+  back_release(node, is_size);
+}
+
+/* Returns an unreferenced copy of `node`, or zero on memory allocation error.
+  Without `position` set, the copy is only to be reached as a leaf and so only
+  references itself.
+*/
+static struct lbtree_pd *node_dup(struct lbtree_pd *node, int is_size,
+                                  int position) {
+  size_t size =
+      (is_size != 0) ? sizeof(struct lbtree_pd_size) : sizeof(struct lbtree_pd);
+  struct lbtree_pd *copy = malloc(size);
+  if (copy == 0) {
+    return 0;
+  }
+  memcpy(copy, node, size);
+  copy->refs = 0;
+  copy->back_refs = 0;
+  if (is_size != 0) {
+    copy->base.key =
+        (unsigned char *)&((struct lbtree_pd_size *)copy)->key_size_bits;
+    ++((struct lbtree_pd *)copy->base.val)->refs;
+  }
+
+  struct lbtree *base = &node->base.base;
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree *child = base->children[i];
+    if ((child == base) || (position == 0)) {
+      copy->base.base.children[i] = &copy->base.base;
+    } else if (lbtree_index_gt(child->index, base->index) != 0) {
+      ++((struct lbtree_pd *)child)->refs;
+    } else {
+      ++((struct lbtree_pd *)child)->back_refs;
+    }
+  }
+  return copy;
+}
+
+/* Returns the node referenced by `ref`, first replacing it with a copy if it
+  has another parent. Returns zero on memory allocation error.
+*/
+static struct lbtree_pd *own(struct lbtree **ref, int is_size) {
+  struct lbtree_pd *node = (struct lbtree_pd *)*ref;
+  if (node->refs == 1) {
+    return node;
+  }
+  struct lbtree_pd *copy = node_dup(node, is_size, 1);
+  if (copy == 0) {
+    return 0;
+  }
+  copy->refs = 1;
+  *ref = &copy->base.base;
+  ref_release(node, is_size);
+  return copy;
+}
+
+/* Makes the nodes on the path to `key` whose indices are not greater than
+  `index` exclusive to this version. `parent` is set to the last of these, or
+  zero if there are none. Returns non-zero on memory allocation error.
+*/
+static int own_path(struct lbtree **ref, void *key, lbtree_index_t index,
+                    int is_size, struct lbtree **parent) {
+  *parent = 0;
+  if (lbtree_index_gt((*ref)->index, index) != 0) {
+    return 0;
+  }
+  lbtree_index_t parent_index;
+  do {
+    struct lbtree_pd *node = own(ref, is_size);
+    if (node == 0) {
+      return -1;
+    }
+    *parent = &node->base.base;
+    parent_index = (*parent)->index;
+    ref = &(*parent)->children[lbtree_d_sel_key(key, parent_index)];
+  } while ((lbtree_index_gt((*ref)->index, parent_index) != 0) &&
+           (lbtree_index_gt((*ref)->index, index) == 0));
+  return 0;
+}
+
+static int same_node(struct lbtree *a, struct lbtree *b, int is_size) {
+  unsigned char *ka = ((struct lbtree_d *)a)->key;
+  unsigned char *kb = ((struct lbtree_d *)b)->key;
+  return (is_size != 0) ? (*(lbtree_index_t *)ka == *(lbtree_index_t *)kb)
+                        : (ka == kb);
+}
+
+/* Points the leaf reference for `key` at the current copy of its target. With
+  `exclusive` set, the target is also copied if any other version references
+  it. The path to `key` must already be exclusive to this version. Returns the
+  target, or zero on memory allocation error.
+*/
+static struct lbtree_pd *own_leaf(struct lbtree **tree, void *key, int is_size,
+                                  int exclusive) {
+  struct lbtree **ref = tree;
+  struct lbtree *holder;
+  lbtree_index_t holder_index;
+  do {
+    holder = *ref;
+    holder_index = holder->index;
+    ref = &holder->children[lbtree_d_sel_key(key, holder_index)];
+  } while (lbtree_index_gt((*ref)->index, holder_index) != 0);
+  struct lbtree_pd *leaf = (struct lbtree_pd *)*ref;
+
+  /* find the leaf's position, if it has one */
+  struct lbtree **pos_ref = tree;
+  while (same_node(*pos_ref, &leaf->base.base, is_size) == 0) {
+    if (*pos_ref == holder) {
+      pos_ref = 0;
+      break;
+    }
+    pos_ref = &(*pos_ref)->children[lbtree_d_sel_key(key, (*pos_ref)->index)];
+  }
+
+  if (pos_ref == 0) {
+    /* the leaf has no position in this version, but may have one in another
+      and then its children are not this version's */
+    if ((exclusive == 0) || ((leaf->back_refs == 1) && (leaf->refs == 0))) {
+      return leaf;
+    }
+    struct lbtree_pd *copy = node_dup(leaf, is_size, 0);
+    if (copy == 0) {
+      return 0;
+    }
+    copy->back_refs = 1;
+    *ref = &copy->base.base;
+    back_release(leaf, is_size);
+    return copy;
+  }
+
+  struct lbtree_pd *node = (struct lbtree_pd *)*pos_ref;
+  unsigned long int own_back_refs = (holder == *pos_ref) ? 0 : 1;
+  if (&node->base.base != &leaf->base.base) {
+    *ref = &node->base.base;
+    node->back_refs += own_back_refs;
+    back_release(leaf, is_size);
+  }
+  if ((exclusive == 0) || (node->back_refs == own_back_refs)) {
+    return node;
+  }
+  struct lbtree_pd *copy = node_dup(node, is_size, 1);
+  if (copy == 0) {
+    return 0;
+  }
+  copy->refs = 1;
+  *pos_ref = &copy->base.base;
+  if (own_back_refs != 0) {
+    *ref = &copy->base.base;
+    copy->back_refs = 1;
+    --node->back_refs;
+  }
+  ref_release(node, is_size);
+  return copy;
+}
+
+/* Makes the path to `key` and its key value pair exclusive to this version.
+  Returns the key value pair's node, or zero on memory allocation error.
+*/
+static struct lbtree_pd *own_key(struct lbtree **tree, void *key,
+                                 int is_size) {
+  struct lbtree *parent;
+  if (own_path(tree, key, ~(lbtree_index_t)0, is_size, &parent) != 0) {
+    return 0;
+  }
+  return own_leaf(tree, key, is_size, 1);
+}
+
+/* The nodes whose references an lbtree operation may change, with their
+  references beforehand.
+*/
+struct holders {
+  struct lbtree *nodes[HOLDER_COUNT];
+  struct lbtree *children[HOLDER_COUNT][LBTREE_LUT_SIZE];
+  lbtree_index_t indices[HOLDER_COUNT];
+  unsigned int count;
+};
+
+static void holders_add(struct holders *holders, struct lbtree *node) {
+  if (node == 0) {
+    return;
+  }
+  unsigned int i;
+  for (i = 0; i < holders->count; ++i) {
+    if (holders->nodes[i] == node) {
+      return;
+    }
+  }
+  holders->nodes[i] = node;
+  memcpy(holders->children[i], node->children, sizeof(node->children));
+  holders->indices[i] = node->index;
+  ++holders->count;
+}
+
+static lbtree_index_t holders_index(struct holders *holders,
+                                    struct lbtree *node) {
+  unsigned int i;
+  for (i = 0; i < holders->count; ++i) {
+    if (holders->nodes[i] == node) {
+      return holders->indices[i];
+    }
+  }
+  return node->index;
+}
+
+/* Removes the counts for the references the holders had beforehand, without
+  freeing anything.
+*/
+static void holders_uncount(struct holders *holders) {
+  unsigned int i;
+  for (i = 0; i < holders->count; ++i) {
+    unsigned int j;
+    for (j = 0; j < LBTREE_LUT_SIZE; ++j) {
+      struct lbtree *child = holders->children[i][j];
+      if (child == holders->nodes[i]) {
+        continue;
+      }
+      if (lbtree_index_gt(holders_index(holders, child),
+                          holders->indices[i]) != 0) {
+        --((struct lbtree_pd *)child)->refs;
+      } else {
+        --((struct lbtree_pd *)child)->back_refs;
+      }
+    }
+  }
+}
+
+static void children_count(struct lbtree *node) {
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree *child = node->children[i];
+    if (child == node) {
+      continue;
+    }
+    if (lbtree_index_gt(child->index, node->index) != 0) {
+      ++((struct lbtree_pd *)child)->refs;
+    } else {
+      ++((struct lbtree_pd *)child)->back_refs;
+    }
+  }
+}
+
+static void root_count(struct lbtree **tree, struct lbtree *root) {
+  if (*tree != root) {
+    --((struct lbtree_pd *)root)->refs;
+    if (*tree != 0) {
+      ++((struct lbtree_pd *)*tree)->refs;
+    }
+  }
+}
+
+/* Links `node` into the tree at `index`, the path to `node`'s key must already
+  be exclusive to this version up to `index`, and `parent` is the last node on
+  it.
+*/
+static void insert(struct lbtree **tree, struct lbtree *parent,
+                   struct lbtree_pd *node, lbtree_index_t index, int is_size) {
+  struct holders holders = {.count = 0};
+  holders_add(&holders, parent);
+  struct lbtree *root = *tree;
+  struct lbtree *base = &node->base.base;
+  base->index = index;
+  node->refs = 0;
+  node->back_refs = 0;
+
+  struct lbtree *dropped = lbtree_add(tree, &lbtree_d_sel_node, base);
+  if ((parent != 0) && (lbtree_index_gt(index, parent->index) == 0)) {
+    /* `node` has no position, it is only ever reached as a leaf and so only
+      references itself */
+    unsigned int i;
+    for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+      if (base->children[i] != base) {
+        dropped = base->children[i];
+        base->children[i] = base;
+      }
+    }
+  }
+
+  holders_uncount(&holders);
+  if (parent != 0) {
+    children_count(parent);
+  }
+  children_count(base);
+  root_count(tree, root);
+
+  if ((dropped != 0) && (dropped != parent)) {
+    /* restore the count removed above and release it properly */
+    struct lbtree_pd *pd_dropped = (struct lbtree_pd *)dropped;
+    if (lbtree_index_gt(dropped->index, parent->index) != 0) {
+      ++pd_dropped->refs;
+      ref_release(pd_dropped, is_size);
+    } else {
+      ++pd_dropped->back_refs;
+      back_release(pd_dropped, is_size);
+    }
+  }
+}
+
+/* Makes everything that removing `key` changes exclusive to this version.
+  Returns the key value pair's node, or zero on memory allocation error.
+*/
+static struct lbtree_pd *rm_prepare(struct lbtree **tree, void *key,
+                                    int is_size) {
+  struct lbtree_pd *leaf = own_key(tree, key, is_size);
+  if (leaf == 0) {
+    return 0;
+  }
+  struct lbtree_leaf_pos leaf_pos =
+      lbtree_leaf_pos(tree, &lbtree_d_sel_key, key, 0);
+  struct lbtree_d *leaf_parent = (struct lbtree_d *)*leaf_pos.parent_ref;
+  if ((&leaf_parent->base == &leaf->base.base) ||
+      (leaf_pos.cut == leaf_pos.leaf)) {
+    return leaf;
+  }
+  /* the leaf's parent is moved to the leaf's position, its own leaf reference
+    must then be to its current copy */
+  struct lbtree *parent;
+  if ((own_path(tree, leaf_parent->key, ~(lbtree_index_t)0, is_size,
+                &parent) != 0) ||
+      (own_leaf(tree, leaf_parent->key, is_size, 0) == 0)) {
+    return 0;
+  }
+  return leaf;
+}
+
+/* Unlinks `leaf`, prepared by `rm_prepare`, from the tree. `leaf` is then no
+  longer referenced.
+*/
+static void rm_commit(struct lbtree **tree, void *key, struct lbtree_pd *leaf) {
+  struct lbtree_rm_pos pos = lbtree_rm_pos(tree, &lbtree_d_sel_key, key);
+  struct holders holders = {.count = 0};
+  holders_add(&holders, pos.leaf.grandparent);
+  holders_add(&holders, *pos.leaf.parent_ref);
+  holders_add(&holders, pos.branch.parent);
+  holders_add(&holders, &leaf->base.base);
+  struct lbtree *root = *tree;
+
+  lbtree_cut(pos.branch.ref, pos.leaf);
+
+  holders_uncount(&holders);
+  unsigned int i;
+  for (i = 0; i < holders.count; ++i) {
+    if (holders.nodes[i] != &leaf->base.base) {
+      children_count(holders.nodes[i]);
+    }
+  }
+  root_count(tree, root);
+}
+
+static struct lbtree_pd *key_new(void *key, void *val) {
+  struct lbtree_pd *node = malloc(sizeof(*node));
+  if (node == 0) {
+    return 0;
+  }
+  node->base.key = key;
+  node->base.val = val;
+  node->refs = 1;
+  node->back_refs = 0;
+  lbtree_init(&node->base.base);
+  return node;
+}
+
+static struct lbtree_pd_size *size_new(lbtree_index_t key_size_bits,
+                                       struct lbtree_pd *key_tree) {
+  struct lbtree_pd_size *node = malloc(sizeof(*node));
+  if (node == 0) {
+    return 0;
+  }
+  node->key_size_bits = key_size_bits;
+  node->base.base.key = (unsigned char *)&node->key_size_bits;
+  node->base.base.val = key_tree;
+  node->base.refs = 1;
+  node->base.back_refs = 0;
+  lbtree_init(&node->base.base.base);
+  return node;
+}
+
+void *lbtree_pd_add(struct lbtree_pd **tree, void *key,
+                    lbtree_index_t key_size_bits, void *val) {
+  struct lbtree **size_tree = (struct lbtree **)tree;
+  struct lbtree_pd_size *size_best =
+      (*tree == 0) ? 0 : lbtree(*size_tree, &lbtree_d_sel_key, &key_size_bits);
+  struct lbtree *parent;
+
+  if ((size_best == 0) || (size_best->key_size_bits != key_size_bits)) {
+    /* key_size_bits not yet in size tree, add to size tree and to key tree */
+    struct lbtree_pd *key_node = key_new(key, val);
+    if (key_node == 0) {
+      return val;
+    }
+    struct lbtree_pd_size *size_node = size_new(key_size_bits, key_node);
+    if (size_node == 0) {
+      free(key_node);
+      return val;
+    }
+    if (size_best == 0) {
+      *tree = &size_node->base;
+      return 0;
+    }
+    lbtree_index_t index =
+        lbtree_d_index(&key_size_bits, size_best->base.base.key,
+                       sizeof(lbtree_index_t) * CHAR_BIT);
+    if (own_path(size_tree, &key_size_bits, index, 1, &parent) != 0) {
+      free(size_node);
+      free(key_node);
+      return val;
+    }
+    insert(size_tree, parent, &size_node->base, index, 1);
+    return 0;
+  }
+
+  /* key_size already exists in size tree, add to key tree only */
+  struct lbtree_pd *size_leaf = own_key(size_tree, &key_size_bits, 1);
+  if (size_leaf == 0) {
+    return val;
+  }
+  struct lbtree **key_tree = (struct lbtree **)&size_leaf->base.val;
+  struct lbtree_pd *key_best;
+  if (key_size_bits == 0) {
+    key_best = own(key_tree, 0);
+  } else {
+    key_best = lbtree(*key_tree, &lbtree_d_sel_key, key);
+    lbtree_index_t index =
+        lbtree_d_index(key, key_best->base.key, key_size_bits);
+    if (index != key_size_bits) {
+      struct lbtree_pd *key_node = key_new(key, val);
+      if (key_node == 0) {
+        return val;
+      }
+      if (own_path(key_tree, key, index, 0, &parent) != 0) {
+        free(key_node);
+        return val;
+      }
+      insert(key_tree, parent, key_node, index, 0);
+      return 0;
+    }
+    key_best = own_key(key_tree, key, 0);
+  }
+  if (key_best == 0) {
+    return val;
+  }
+  void *old_val = key_best->base.val;
+  key_best->base.key = key;
+  key_best->base.val = val;
+  return old_val;
+}
+
+void *lbtree_pd_rm(struct lbtree_pd **tree, void *key,
+                   lbtree_index_t key_size_bits) {
+  if (*tree == 0) {
+    return 0;
+  }
+  struct lbtree **size_tree = (struct lbtree **)tree;
+  struct lbtree_pd_size *size_best =
+      lbtree(*size_tree, &lbtree_d_sel_key, &key_size_bits);
+  if (size_best->key_size_bits != key_size_bits) {
+    return 0;
+  }
+  struct lbtree *key_root = size_best->base.base.val;
+  if ((key_size_bits != 0) &&
+      (lbtree_d_index(((struct lbtree_d *)lbtree(key_root, &lbtree_d_sel_key,
+                                                 key))
+                          ->key,
+                      key, key_size_bits) != key_size_bits)) {
+    return 0;
+  }
+
+  /* prepare everything before changing anything, so that a memory allocation
+    error leaves the tree as it was */
+  struct lbtree_pd *size_leaf = own_key(size_tree, &key_size_bits, 1);
+  if (size_leaf == 0) {
+    return 0;
+  }
+  key_root = size_leaf->base.val;
+  unsigned int last = (key_root->children[0] == key_root) &&
+                      (key_root->children[1] == key_root);
+  if ((last != 0) && (rm_prepare(size_tree, &key_size_bits, 1) == 0)) {
+    return 0;
+  }
+
+  struct lbtree **key_tree = (struct lbtree **)&size_leaf->base.val;
+  void *val;
+  if (key_size_bits == 0) {
+    struct lbtree_pd *key_best = (struct lbtree_pd *)key_root;
+    val = key_best->base.val;
+    ref_release(key_best, 0);
+    *key_tree = 0;
+  } else {
+    struct lbtree_pd *key_best = rm_prepare(key_tree, key, 0);
+    if (key_best == 0) {
+      return 0;
+    }
+    rm_commit(key_tree, key, key_best);
+    val = key_best->base.val;
+    free(key_best);
+  }
+
+  if (*key_tree == 0) {
+    /* key tree empty, also remove from size_tree */
+    rm_commit(size_tree, &key_size_bits, size_leaf);
+    free(size_leaf);
+  }
+  return val;
+}
+
+/* The keys of one version that share a prefix: those in the branch of `node`,
+  or with `branch` clear the key of `node` alone, or none if `node` is zero */
+struct part {
+  struct lbtree *node;
+  int branch;
+};
+
+/* Returns the part referenced by the `i`th child of `node` */
+static struct part part_child(struct lbtree *node, unsigned int i) {
+  struct lbtree *child = node->children[i];
+  struct part part = {.node = 0, .branch = 0};
+  if (lbtree_d_sel_node(child, node->index) == i) {
+    part.node = child;
+    part.branch = lbtree_index_gt(child->index, node->index);
+  }
+  return part;
+}
+
+struct changes_closure {
+  void *(*action)(const void *key, void *const *from_val, void *const *to_val,
+                  void *closure);
+  void *closure;
+  /* clear while comparing key trees, of keys `key_size_bits` long */
+  int is_size;
+  lbtree_index_t key_size_bits;
+  /* for a part in only one version, whether that version is `to` */
+  int to;
+};
+
+static void *pair_only(struct changes_closure *closure, struct lbtree_d *node) {
+  void **val = &node->val;
+  return closure->action(node->key, (closure->to == 0) ? val : 0,
+                         (closure->to != 0) ? val : 0, closure->closure);
+}
+
+static void *only_action(void *node, void *v_closure) {
+  struct changes_closure *closure = v_closure;
+  struct lbtree_d *d_node = node;
+  if (closure->is_size == 0) {
+    return pair_only(closure, d_node);
+  }
+  struct lbtree_d *key_tree = d_node->val;
+  if (*(lbtree_index_t *)d_node->key == 0) {
+    /* a lone node whose key must not be read */
+    return pair_only(closure, key_tree);
+  }
+  closure->is_size = 0;
+  void *r =
+      lbtree_walk(&key_tree->base, &lbtree_d_sel_node, &only_action, closure);
+  closure->is_size = 1;
+  return r;
+}
+
+/* Passes every pair of `part`, which is only in `to` if `to` is set */
+static void *part_only(struct changes_closure *closure, struct part part,
+                       int to) {
+  if (part.node == 0) {
+    return 0;
+  }
+  closure->to = to;
+  return (part.branch != 0)
+             ? lbtree_walk(part.node, &lbtree_d_sel_node, &only_action,
+                           closure)
+             : only_action(part.node, closure);
+}
+
+static void *parts_changes(struct changes_closure *closure, struct part from,
+                           struct part to);
+
+static void *key_trees_changes(struct changes_closure *closure,
+                               struct lbtree_d *from, struct lbtree_d *to) {
+  struct lbtree_d *from_tree = from->val;
+  struct lbtree_d *to_tree = to->val;
+  if (from_tree == to_tree) {
+    return 0;
+  }
+  lbtree_index_t key_size_bits = *(lbtree_index_t *)to->key;
+  if (key_size_bits == 0) {
+    /* lone nodes whose keys must not be read */
+    return (from_tree->val == to_tree->val)
+               ? 0
+               : closure->action(to_tree->key, &from_tree->val, &to_tree->val,
+                                 closure->closure);
+  }
+  closure->is_size = 0;
+  closure->key_size_bits = key_size_bits;
+  struct part from_part = {.node = &from_tree->base, .branch = 1};
+  struct part to_part = {.node = &to_tree->base, .branch = 1};
+  void *r = parts_changes(closure, from_part, to_part);
+  closure->is_size = 1;
+  return r;
+}
+
+/* Passes every pair of two parts with no keys in common, in the order they are
+  walked, `index` being the first bit in which their keys differ */
+static void *parts_apart(struct changes_closure *closure, struct part from,
+                         struct part to, lbtree_index_t index) {
+  unsigned char *from_key = ((struct lbtree_d *)from.node)->key;
+  unsigned char *to_key = ((struct lbtree_d *)to.node)->key;
+  int from_first =
+      (lbtree_d_sel_key(from_key, index) < lbtree_d_sel_key(to_key, index));
+  void *r = (from_first != 0) ? part_only(closure, from, 0)
+                              : part_only(closure, to, 1);
+  if (r != 0) {
+    return r;
+  }
+  return (from_first != 0) ? part_only(closure, to, 1)
+                           : part_only(closure, from, 0);
+}
+
+/* Passes the changes between two parts reached by the same path in either
+  version, recursing into both together so that parts they share are passed
+  over */
+static void *parts_changes(struct changes_closure *closure, struct part from,
+                           struct part to) {
+  if ((from.node == to.node) && (from.branch == to.branch)) {
+    /* shared by the versions, or empty in both */
+    return 0;
+  }
+  if (from.node == 0) {
+    return part_only(closure, to, 1);
+  }
+  if (to.node == 0) {
+    return part_only(closure, from, 0);
+  }
+
+  struct lbtree_d *from_node = (struct lbtree_d *)from.node;
+  struct lbtree_d *to_node = (struct lbtree_d *)to.node;
+  lbtree_index_t size_bits = (closure->is_size != 0)
+                                 ? (sizeof(lbtree_index_t) * CHAR_BIT)
+                                 : closure->key_size_bits;
+  lbtree_index_t index =
+      lbtree_d_index(from_node->key, to_node->key, size_bits);
+  if ((from.branch == 0) && (to.branch == 0)) {
+    if (index != size_bits) {
+      return parts_apart(closure, from, to, index);
+    }
+    if (closure->is_size != 0) {
+      return key_trees_changes(closure, from_node, to_node);
+    }
+    return (from_node->val == to_node->val)
+               ? 0
+               : closure->action(to_node->key, &from_node->val,
+                                 &to_node->val, closure->closure);
+  }
+
+  /* the part that branches first is split, unless the keys of the parts differ
+    before then, in a bit that all the keys of a branch share */
+  int split_from =
+      (from.branch != 0) &&
+      ((to.branch == 0) || (lbtree_index_gt(from.node->index,
+                                            to.node->index) == 0));
+  struct part split = (split_from != 0) ? from : to;
+  struct part other = (split_from != 0) ? to : from;
+  if (lbtree_index_gt(split.node->index, index) != 0) {
+    return parts_apart(closure, from, to, index);
+  }
+  /* the keys of the other part are then all on one side of the split, unless
+    it branches at the same index */
+  int both = (other.branch != 0) && (other.node->index == split.node->index);
+  unsigned int side = lbtree_d_sel_node(other.node, split.node->index);
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct part child = part_child(split.node, i);
+    void *r;
+    if (both != 0) {
+      r = parts_changes(closure, child, part_child(other.node, i));
+    } else if (i != side) {
+      r = part_only(closure, child, split_from == 0);
+    } else if (split_from != 0) {
+      r = parts_changes(closure, child, other);
+    } else {
+      r = parts_changes(closure, other, child);
+    }
+    if (r != 0) {
+      return r;
+    }
+  }
+  return 0;
+}
+
+void *lbtree_pd_changes(struct lbtree_pd *from, struct lbtree_pd *to,
+                        void *(*action)(const void *key, void *const *from_val,
+                                        void *const *to_val, void *closure),
+                        void *closure) {
+  struct changes_closure changes_closure = {
+      .action = action, .closure = closure, .is_size = 1};
+  struct part from_part = {.node = (from == 0) ? 0 : &from->base.base,
+                           .branch = 1};
+  struct part to_part = {.node = (to == 0) ? 0 : &to->base.base, .branch = 1};
+  return parts_changes(&changes_closure, from_part, to_part);
+}
+
+struct lbtree_pd *lbtree_pd_snapshot(struct lbtree_pd *tree) {
+  if (tree != 0) {
+    ++tree->refs;
+  }
+  return tree;
+}
+
+void lbtree_pd_release(struct lbtree_pd *tree) {
+  if (tree != 0) {
+    ref_release(tree, 1);
+  }
+}
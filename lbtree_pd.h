@@ -0,0 +1,135 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_PD_H
+#define LBTREE_PD_H
+
+#include "lbtree_d.h"
+
+/*
+Persistent variant of lbtree_d. Modifications copy the nodes they touch that
+are shared with a snapshot rather than changing them in place, so a snapshot
+stays unchanged and readable while the tree it was taken from is modified.
+Snapshots are taken in constant time.
+
+Lookups and walks do not modify any node and may run concurrently with each
+other and with modification of a different version. Adds, removes, snapshots
+and releases change reference counts on shared nodes and so must be serialised
+with each other across all versions.
+*/
+struct lbtree_pd {
+  struct lbtree_d base;
+  /* references from parent nodes and from versions */
+  unsigned long int refs;
+  /* leaf references */
+  unsigned long int back_refs;
+};
+
+/*
+Adds a key value pair to the tree, the value pointed to by `key` must persist
+through any key value pair's lifetime as part of any version of the tree.
+Returns the value associated with a matching key in the tree (this key value
+pair is replaced by this function), or zero if one is not found. `val` on memory
+allocation error, in which case the tree is unchanged.
+*/
+void *lbtree_pd_add(struct lbtree_pd **tree, void *key,
+                    lbtree_index_t key_size_bits, void *val);
+
+static inline void *lbtree_pdc_add(struct lbtree_pd **tree, void *key,
+                                   lbtree_index_t key_size, void *val) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? key
+             : lbtree_pd_add(tree, key, key_size_bits, val);
+}
+
+/*
+Performs a lookup on any version of the tree.
+Returns the value whose associated key matches the `key` argument, or zero if
+one is not found.
+*/
+static inline void *lbtree_pd(struct lbtree_pd *tree, void *key,
+                              lbtree_index_t key_size_bits) {
+  return (tree == 0) ? 0 : lbtree_d(&tree->base, key, key_size_bits);
+}
+
+static inline void *lbtree_pdc(struct lbtree_pd *tree, void *key,
+                               lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_pd(tree, key, key_size_bits);
+}
+
+/*
+Removes a single key value pair from the tree.
+Returns the associated value if found and removed, otherwise zero. Zero on
+memory allocation error, in which case the tree is unchanged.
+*/
+void *lbtree_pd_rm(struct lbtree_pd **tree, void *key,
+                   lbtree_index_t key_size_bits);
+
+static inline void *lbtree_pdc_rm(struct lbtree_pd **tree, void *key,
+                                  lbtree_index_t key_size) {
+  lbtree_index_t key_size_bits = key_size * CHAR_BIT;
+  return ((key_size_bits / CHAR_BIT) != key_size)
+             ? 0
+             : lbtree_pd_rm(tree, key, key_size_bits);
+}
+
+/*
+Calls `action` once for each key value pair in any version of the tree. The
+walk will stop when any action returns a non-null pointer. Returns the action
+return value causing the walk to stop, otherwise zero. Values must not be
+modified through `val`, they may be shared with other versions.
+*/
+static inline void *
+lbtree_pd_walk(struct lbtree_pd *tree,
+               void *(*action)(const void *key, void **val, void *closure),
+               void *closure) {
+  return (tree == 0) ? 0 : lbtree_d_walk(&tree->base, action, closure);
+}
+
+/*
+Calls `action` once for each key whose key value pair differs between versions
+`from` and `to` of a tree, in the order of `lbtree_pd_walk`. `from_val` points
+to the key's value in `from` and `to_val` to its value in `to`, either being
+null if the key is not in that version, and `key` is the key in `to` if it is
+there. Values are compared by pointer, a pair whose key alone is replaced is not
+passed. Parts of the tree that the versions share are passed over whole, so
+that comparing a version with a snapshot of it takes time that grows with the
+number of changes made since, rather than with the size of the tree. The walk
+will stop when any action returns a non-null pointer.
+Returns the action return value causing the walk to stop, otherwise zero.
+*/
+void *lbtree_pd_changes(struct lbtree_pd *from, struct lbtree_pd *to,
+                        void *(*action)(const void *key, void *const *from_val,
+                                        void *const *to_val, void *closure),
+                        void *closure);
+
+/*
+Returns a version of the tree that is unaffected by subsequent modification of
+`tree`, it must be released with `lbtree_pd_release`. The snapshot is itself a
+tree and may be modified independently of `tree`.
+*/
+struct lbtree_pd *lbtree_pd_snapshot(struct lbtree_pd *tree);
+
+/*
+Releases a version of the tree, freeing the nodes not shared with any other
+version.
+*/
+void lbtree_pd_release(struct lbtree_pd *tree);
+
+#endif
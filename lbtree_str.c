@@ -0,0 +1,122 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_str.h"
+
+#include <limits.h>
+#include <string.h>
+
+/* A key being looked up, whose length is found as the descent reaches further
+  into it. Indices only increase down the tree, so each byte is checked for the
+  terminator at most once per descent. */
+struct cursor {
+  const unsigned char *key;
+  /* number of bytes known to precede the terminator */
+  size_t size;
+  unsigned char ended;
+};
+
+/* Returns the bit at `index` of a key `size` bytes long, reading as zero past
+  its end */
+static unsigned int sel_bit(const unsigned char *key, size_t size,
+                            lbtree_index_t index) {
+  lbtree_index_t char_index = index / CHAR_BIT;
+  return (char_index < size) ? (key[char_index] >> (index % CHAR_BIT)) & 1 : 0;
+}
+
+static unsigned int sel_key(void *v_cursor, lbtree_index_t index) {
+  struct cursor *cursor = v_cursor;
+  lbtree_index_t char_index = index / CHAR_BIT;
+  while ((cursor->ended == 0) && (cursor->size <= char_index)) {
+    if (cursor->key[cursor->size] == 0) {
+      cursor->ended = 1;
+    } else {
+      ++cursor->size;
+    }
+  }
+  return sel_bit(cursor->key, cursor->size, index);
+}
+
+static unsigned int sel_node(void *v_node, lbtree_index_t index) {
+  struct lbtree_str *node = v_node;
+  return sel_bit((const unsigned char *)node->key, node->size, index);
+}
+
+/* Returns the index of the least significant set bit of non-zero `x` */
+static inline unsigned int ctz(unsigned int x) {
+#if defined(__GNUC__)
+  return (unsigned int)__builtin_ctz(x);
+#else
+  unsigned int n = 0;
+  while ((x & 1) == 0) {
+    x >>= 1;
+    ++n;
+  }
+  return n;
+#endif
+}
+
+void *lbtree_str_add(struct lbtree_str **tree, struct lbtree_str *node) {
+  node->size = strlen(node->key);
+  if (*tree == 0) {
+    lbtree_init(&node->base);
+    *tree = node;
+    return 0;
+  }
+
+  struct lbtree_str *match = lbtree(&(*tree)->base, &sel_node, node);
+  const unsigned char *ka = (const unsigned char *)node->key;
+  const unsigned char *kb = (const unsigned char *)match->key;
+  /* stops at the first differing byte or the shared terminator */
+  size_t i = 0;
+  while ((ka[i] == kb[i]) && (ka[i] != 0)) {
+    ++i;
+  }
+  if (ka[i] == kb[i]) {
+    lbtree_repl((struct lbtree **)tree, &sel_node, &match->base, &node->base);
+    return match;
+  }
+  node->base.index = ((lbtree_index_t)i * CHAR_BIT) + ctz(ka[i] ^ kb[i]);
+  lbtree_add((struct lbtree **)tree, &sel_node, &node->base);
+  return 0;
+}
+
+void *lbtree_str(struct lbtree_str *tree, const char *key) {
+  if (tree == 0) {
+    return 0;
+  }
+  struct cursor cursor = {
+      .key = (const unsigned char *)key, .size = 0, .ended = 0};
+  struct lbtree_str *node = lbtree(&tree->base, &sel_key, &cursor);
+  return (strcmp(node->key, key) == 0) ? node : 0;
+}
+
+void lbtree_str_rm(struct lbtree_str **tree, struct lbtree_str *node) {
+  lbtree_rm((struct lbtree **)tree, &sel_node, &node->base);
+}
+
+void *lbtree_str_rm_key(struct lbtree_str **tree, const char *key) {
+  struct lbtree_str *node = lbtree_str(*tree, key);
+  if (node != 0) {
+    lbtree_str_rm(tree, node);
+  }
+  return node;
+}
+
+void *lbtree_str_walk(struct lbtree_str *tree,
+                      void *(*action)(void *node, void *closure),
+                      void *closure) {
+  return lbtree_walk((struct lbtree *)tree, &sel_node, action, closure);
+}
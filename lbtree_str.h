@@ -0,0 +1,68 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_STR_H
+#define LBTREE_STR_H
+
+#include "lbtree.h"
+
+#include <stddef.h>
+
+/*
+Tree keyed by NUL terminated strings, bits past the terminator read as zero so
+keys of any length share one tree. As with lbtree, nodes are allocated by the
+user and must begin with a `struct lbtree_str`, and the string pointed to by
+`key` must persist while the node is in the tree.
+*/
+struct lbtree_str {
+  struct lbtree base;
+  const char *key;
+  /* length of `key`, set by `lbtree_str_add` */
+  size_t size;
+};
+
+/*
+Adds `node`, whose key must be set, to the tree.
+Returns the node with a matching key that `node` replaced, or zero if there was
+none.
+*/
+void *lbtree_str_add(struct lbtree_str **tree, struct lbtree_str *node);
+
+/*
+Performs a lookup in a single descent, reading `key` only as far as the descent
+needs.
+Returns the node with a matching key, or zero if there is none.
+*/
+void *lbtree_str(struct lbtree_str *tree, const char *key);
+
+/*
+Removes `node`, which must be in the tree.
+*/
+void lbtree_str_rm(struct lbtree_str **tree, struct lbtree_str *node);
+
+/*
+Removes the node with a matching key.
+Returns the removed node, or zero if there is none.
+*/
+void *lbtree_str_rm_key(struct lbtree_str **tree, const char *key);
+
+/*
+As `lbtree_walk`.
+*/
+void *lbtree_str_walk(struct lbtree_str *tree,
+                      void *(*action)(void *node, void *closure),
+                      void *closure);
+
+#endif
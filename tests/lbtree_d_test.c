@@ -16,9 +16,12 @@
 #include "lbtree_d_test.h"
 
 #include "../lbtree_d.h"
+#include "everand/everand.h"
 
 #include <assert.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
 
 static struct tree_test *lbtree_d_test_node_tt(void *node) { return node; }
 
@@ -84,3 +87,775 @@ const struct tree_test_iface lbtree_d_test_iface = {
     .rm = &lbtree_d_test_rm,
     .walk = &lbtree_d_test_walk,
     .del = &lbtree_d_test_del};
+
+/* Returns non-zero if the first `size_bits` bits of `a` and `b` match */
+static int prefix_match(const unsigned char *a, const unsigned char *b,
+                        size_t size_bits) {
+  size_t size = size_bits / CHAR_BIT;
+  if (memcmp(a, b, size) != 0) {
+    return 0;
+  }
+  unsigned int mask = (1u << (size_bits % CHAR_BIT)) - 1;
+  return ((size_bits % CHAR_BIT) == 0) || (((a[size] ^ b[size]) & mask) == 0);
+}
+
+struct rm_closure {
+  struct tree_test **expected;
+  size_t *first;
+};
+
+static void rm_action(const void *key, void *val, void *v_closure) {
+  struct rm_closure *closure = v_closure;
+  struct tree_test *tt = val;
+  struct tree_test **expected = &closure->expected[closure->first[tt->id]];
+  assert(*expected == tt);
+  assert(memcmp(key, tt->key.buf, tt->key.size) == 0);
+  *expected = 0;
+}
+
+void lbtree_d_test_rm_prefix(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_d_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_FEW);
+  struct tree_test **expected = calloc(size, sizeof(*expected));
+  assert(expected != 0);
+
+  size_t i;
+  struct lbtree_d *tree = 0;
+  struct rm_closure closure = {.expected = expected, .first = first};
+  unsigned int step;
+  for (step = 0; step < TREE_TEST_STEP_COUNT; ++step) {
+    struct tree_test *tt = nodes[everand(size - 1)];
+    size_t op = everand(31);
+    size_t count = 0;
+    if (op == 0) {
+      size_t prefix_size_bits = everand(tt->key.size * CHAR_BIT);
+      for (i = 0; i < size; ++i) {
+        struct tree_test *other = expected[i];
+        count += ((other != 0) &&
+                  ((other->key.size * CHAR_BIT) >= prefix_size_bits) &&
+                  (prefix_match(other->key.buf, tt->key.buf,
+                                prefix_size_bits) != 0))
+                     ? 1
+                     : 0;
+      }
+      assert(lbtree_d_rm_prefix(&tree, tt->key.buf, prefix_size_bits,
+                                &rm_action, &closure) == count);
+    } else if (op == 1) {
+      struct tree_test *lo = tt;
+      struct tree_test *hi = nodes[everand(size - 1)];
+      for (i = 0; i < size; ++i) {
+        struct tree_test *other = expected[i];
+        count += ((other != 0) && (other->key.size == lo->key.size) &&
+                  (lo->key.size == hi->key.size) &&
+                  (memcmp(lo->key.buf, other->key.buf, lo->key.size) <= 0) &&
+                  (memcmp(other->key.buf, hi->key.buf, lo->key.size) <= 0))
+                     ? 1
+                     : 0;
+      }
+      if (lo->key.size == hi->key.size) {
+        assert(lbtree_dc_rm_range(&tree, lo->key.buf, hi->key.buf,
+                                  lo->key.size, &rm_action,
+                                  &closure) == count);
+      }
+    } else if (op < 24) {
+      assert(lbtree_dc_add(&tree, tt->key.buf, tt->key.size, tt) ==
+             expected[first[tt->id]]);
+      expected[first[tt->id]] = tt;
+    } else {
+      assert(lbtree_dc_rm(&tree, tt->key.buf, tt->key.size) ==
+             expected[first[tt->id]]);
+      expected[first[tt->id]] = 0;
+    }
+
+    count = 0;
+    for (i = 0; i < size; ++i) {
+      if (first[i] != i) {
+        continue;
+      }
+      struct tree_test *other = nodes[i];
+      assert(((tree == 0) ? 0
+                          : lbtree_dc(tree, other->key.buf, other->key.size)) ==
+             expected[i]);
+      count += (expected[i] != 0) ? 1 : 0;
+    }
+    size_t walk_count = 0;
+    if (tree != 0) {
+      lbtree_d_walk(tree, &tree_test_count_action, &walk_count);
+    }
+    assert(walk_count == count);
+  }
+
+  if (tree != 0) {
+    lbtree_d_free(tree);
+  }
+  free(expected);
+  free(first);
+  lbtree_d_test_nodes_del(nodes);
+}
+
+#define SET_OP_COUNT (3)
+
+struct set_closure {
+  /* the value each key's removed or replaced value is expected to be */
+  struct tree_test **expected;
+  size_t *first;
+  size_t count;
+};
+
+static void set_action(const void *key, void *val, void *v_closure) {
+  struct set_closure *closure = v_closure;
+  struct tree_test *tt = val;
+  struct tree_test **expected = &closure->expected[closure->first[tt->id]];
+  assert(*expected == tt);
+  assert(memcmp(key, tt->key.buf, tt->key.size) == 0);
+  *expected = 0;
+  ++closure->count;
+}
+
+static void set_check(struct lbtree_d *tree, void **nodes, size_t *first,
+                      struct tree_test **expected, size_t size) {
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    if (first[i] != i) {
+      continue;
+    }
+    struct tree_test *tt = nodes[i];
+    assert(((tree == 0) ? 0 : lbtree_dc(tree, tt->key.buf, tt->key.size)) ==
+           expected[i]);
+    count += (expected[i] != 0) ? 1 : 0;
+  }
+  size_t walk_count = 0;
+  if (tree != 0) {
+    lbtree_d_walk(tree, &tree_test_count_action, &walk_count);
+  }
+  assert(walk_count == count);
+}
+
+void lbtree_d_test_set_ops(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_d_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_FEW);
+  struct tree_test **a = calloc(size, sizeof(*a));
+  struct tree_test **b = calloc(size, sizeof(*b));
+  struct tree_test **result = calloc(size, sizeof(*result));
+  struct tree_test **acted = calloc(size, sizeof(*acted));
+  assert((a != 0) && (b != 0) && (result != 0) && (acted != 0));
+
+  size_t i;
+
+  /* b either is random, holds only keys from some regions of the key space or
+    mostly matches a, so that both disjoint and identical parts occur */
+  size_t mode = everand(2);
+  struct lbtree_d *tree_a = 0;
+  struct lbtree_d *tree_b = 0;
+  for (i = 0; i < size; ++i) {
+    struct tree_test *tt = nodes[i];
+    size_t f = first[i];
+    if (everand(3) != 0) {
+      assert(lbtree_dc_add(&tree_a, tt->key.buf, tt->key.size, tt) == a[f]);
+      a[f] = tt;
+    }
+    int in_b;
+    if (mode == 0) {
+      in_b = (everand(1) != 0);
+    } else if (mode == 1) {
+      in_b = (tt->key.size != 0) && (((tt->key.buf[0] / 33) % 2) == 0);
+    } else {
+      in_b = (everand(9) == 0) ? (a[f] == 0) : (a[f] == tt);
+    }
+    if (in_b) {
+      assert(lbtree_dc_add(&tree_b, tt->key.buf, tt->key.size, tt) == b[f]);
+      b[f] = tt;
+    }
+  }
+
+  size_t op = everand(SET_OP_COUNT - 1);
+  size_t acted_count = 0;
+  for (i = 0; i < size; ++i) {
+    int in_a = (a[i] != 0);
+    int in_b = (b[i] != 0);
+    if (op == 0) {
+      result[i] = in_b ? b[i] : a[i];
+      acted[i] = (in_a && in_b) ? a[i] : 0;
+    } else if (op == 1) {
+      result[i] = (in_a && in_b) ? a[i] : 0;
+      acted[i] = (in_a && !in_b) ? a[i] : 0;
+    } else {
+      result[i] = (in_a && !in_b) ? a[i] : 0;
+      acted[i] = (in_a && in_b) ? a[i] : 0;
+    }
+    acted_count += (acted[i] != 0) ? 1 : 0;
+  }
+
+  struct set_closure closure = {.expected = acted, .first = first, .count = 0};
+  if (op == 0) {
+    assert(lbtree_d_union(&tree_a, tree_b, &set_action, &closure) == 0);
+  } else if (op == 1) {
+    assert(lbtree_d_intersect(&tree_a, tree_b, &set_action, &closure) == 0);
+  } else {
+    assert(lbtree_d_diff(&tree_a, tree_b, &set_action, &closure) == 0);
+  }
+  assert(closure.count == acted_count);
+  set_check(tree_a, nodes, first, result, size);
+  set_check(tree_b, nodes, first, b, size);
+
+  if (tree_a != 0) {
+    lbtree_d_free(tree_a);
+  }
+  if (tree_b != 0) {
+    lbtree_d_free(tree_b);
+  }
+  free(acted);
+  free(result);
+  free(b);
+  free(a);
+  free(first);
+  lbtree_d_test_nodes_del(nodes);
+}
+
+void lbtree_d_test_split(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_d_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_FEW);
+  struct tree_test **expected = calloc(size, sizeof(*expected));
+  assert(expected != 0);
+
+  size_t i;
+
+  struct lbtree_d *tree = 0;
+  for (i = 0; i < size; ++i) {
+    struct tree_test *tt = nodes[i];
+    if (everand(3) != 0) {
+      assert(lbtree_dc_add(&tree, tt->key.buf, tt->key.size, tt) ==
+             expected[first[i]]);
+      expected[first[i]] = tt;
+    } else {
+      assert(lbtree_dc_rm(&tree, tt->key.buf, tt->key.size) ==
+             expected[first[i]]);
+      expected[first[i]] = 0;
+    }
+  }
+
+  struct tree_test *prefix = nodes[everand(size - 1)];
+  size_t prefix_size_bits = everand(prefix->key.size * CHAR_BIT);
+  struct lbtree_d *split = 0;
+  assert(lbtree_d_split(&tree, &split, prefix->key.buf, prefix_size_bits) ==
+         0);
+
+  /* both trees remain usable, the keys with the prefix being kept in the split
+    tree */
+  unsigned int step;
+  for (step = 0; step < (TREE_TEST_STEP_COUNT / 4); ++step) {
+    if (step != 0) {
+      struct tree_test *tt = nodes[everand(size - 1)];
+      struct lbtree_d **dst =
+          (((tt->key.size * CHAR_BIT) >= prefix_size_bits) &&
+           (prefix_match(tt->key.buf, prefix->key.buf, prefix_size_bits) != 0))
+              ? &split
+              : &tree;
+      if (everand(1) != 0) {
+        assert(lbtree_dc_add(dst, tt->key.buf, tt->key.size, tt) ==
+               expected[first[tt->id]]);
+        expected[first[tt->id]] = tt;
+      } else {
+        assert(lbtree_dc_rm(dst, tt->key.buf, tt->key.size) ==
+               expected[first[tt->id]]);
+        expected[first[tt->id]] = 0;
+      }
+    }
+
+    size_t counts[2] = {0, 0};
+    for (i = 0; i < size; ++i) {
+      if (first[i] != i) {
+        continue;
+      }
+      struct tree_test *tt = nodes[i];
+      int in_split =
+          ((tt->key.size * CHAR_BIT) >= prefix_size_bits) &&
+          (prefix_match(tt->key.buf, prefix->key.buf, prefix_size_bits) != 0);
+      struct lbtree_d *in = in_split ? split : tree;
+      struct lbtree_d *out = in_split ? tree : split;
+      assert(((in == 0) ? 0 : lbtree_dc(in, tt->key.buf, tt->key.size)) ==
+             expected[i]);
+      assert(((out == 0) ? 0 : lbtree_dc(out, tt->key.buf, tt->key.size)) ==
+             0);
+      counts[in_split] += (expected[i] != 0) ? 1 : 0;
+    }
+    size_t walk_counts[2] = {0, 0};
+    if (tree != 0) {
+      lbtree_d_walk(tree, &tree_test_count_action, &walk_counts[0]);
+    }
+    if (split != 0) {
+      lbtree_d_walk(split, &tree_test_count_action, &walk_counts[1]);
+    }
+    assert((walk_counts[0] == counts[0]) && (walk_counts[1] == counts[1]));
+  }
+
+  if (tree != 0) {
+    lbtree_d_free(tree);
+  }
+  if (split != 0) {
+    lbtree_d_free(split);
+  }
+  free(expected);
+  free(first);
+  lbtree_d_test_nodes_del(nodes);
+}
+
+static void *count_merge(void *val, int found, void *closure) {
+  /* the expected count before this update */
+  uintptr_t *expected = closure;
+  assert((found != 0) == (*expected != 0));
+  assert((uintptr_t)val == *expected);
+  return (void *)((uintptr_t)val + 1);
+}
+
+void lbtree_d_test_upsert(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_d_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_FEW);
+  uintptr_t *counts = calloc(size, sizeof(*counts));
+  assert(counts != 0);
+
+  size_t i;
+
+  /* each key's value counts its updates, which are made through a slot, an
+    upsert or occasionally a removal */
+  struct lbtree_d *tree = 0;
+  unsigned int step;
+  for (step = 0; step < TREE_TEST_STEP_COUNT; ++step) {
+    struct tree_test *tt = nodes[everand(size - 1)];
+    uintptr_t *count = &counts[first[tt->id]];
+    size_t op = everand(15);
+    if (op == 0) {
+      assert(lbtree_dc_rm(&tree, tt->key.buf, tt->key.size) == (void *)*count);
+      *count = 0;
+    } else if (op < 8) {
+      void **slot = lbtree_dc_slot(&tree, tt->key.buf, tt->key.size);
+      assert((slot != 0) && (*slot == (void *)*count));
+      *slot = (void *)(*count + 1);
+      ++*count;
+    } else {
+      assert(lbtree_dc_upsert(&tree, tt->key.buf, tt->key.size, &count_merge,
+                              count) == 0);
+      ++*count;
+    }
+    assert(((tree == 0) ? 0 : lbtree_dc(tree, tt->key.buf, tt->key.size)) ==
+           (void *)*count);
+  }
+
+  size_t count = 0;
+  for (i = 0; i < size; ++i) {
+    if (first[i] != i) {
+      continue;
+    }
+    struct tree_test *tt = nodes[i];
+    assert(((tree == 0) ? 0 : lbtree_dc(tree, tt->key.buf, tt->key.size)) ==
+           (void *)counts[i]);
+    count += (counts[i] != 0) ? 1 : 0;
+  }
+  size_t walk_count = 0;
+  if (tree != 0) {
+    lbtree_d_walk(tree, &tree_test_count_action, &walk_count);
+    lbtree_d_free(tree);
+  }
+  assert(walk_count == count);
+
+  free(counts);
+  free(first);
+  lbtree_d_test_nodes_del(nodes);
+}
+
+#define DEEP_KEY_SIZE (32)
+#define DEEP_KEY_COUNT ((DEEP_KEY_SIZE * CHAR_BIT) + 1)
+
+void lbtree_d_test_deep(void) {
+  /* keys with at most one set bit, which branch one below the other from the
+    zero key so that the tree is as deep as the key is long */
+  static unsigned char keys[DEEP_KEY_COUNT][DEEP_KEY_SIZE];
+  size_t order[DEEP_KEY_COUNT];
+  size_t i;
+  memset(keys, 0, sizeof(keys));
+  for (i = 0; i < DEEP_KEY_COUNT; ++i) {
+    if (i != 0) {
+      keys[i][(i - 1) / CHAR_BIT] = (unsigned char)(1u << ((i - 1) % CHAR_BIT));
+    }
+    order[i] = i;
+  }
+
+  struct lbtree_d *tree = 0;
+  unsigned int pass;
+  for (pass = 0; pass < 2; ++pass) {
+    for (i = DEEP_KEY_COUNT - 1; i != 0; --i) {
+      size_t j = everand(i);
+      size_t swap = order[i];
+      order[i] = order[j];
+      order[j] = swap;
+    }
+    for (i = 0; i < DEEP_KEY_COUNT; ++i) {
+      size_t k = order[i];
+      /* adding in the first pass and removing in the second */
+      if (pass == 0) {
+        assert(lbtree_dc_add(&tree, keys[k], DEEP_KEY_SIZE, keys[k]) == 0);
+      } else {
+        assert(lbtree_dc_rm(&tree, keys[k], DEEP_KEY_SIZE) == keys[k]);
+      }
+    }
+    for (i = 0; i < DEEP_KEY_COUNT; ++i) {
+      assert(((tree == 0) ? 0 : lbtree_dc(tree, keys[i], DEEP_KEY_SIZE)) ==
+             ((pass == 0) ? keys[i] : 0));
+    }
+  }
+  assert(tree == 0);
+}
+
+void lbtree_d_test_finger(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_d_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_COUNT);
+  struct tree_test **expected = calloc(size, sizeof(*expected));
+  assert(expected != 0);
+
+  size_t i;
+
+  struct lbtree_d *tree = 0;
+  struct lbtree_d_finger finger;
+  lbtree_d_finger_init(&finger);
+  size_t next = 0;
+  unsigned int step;
+  for (step = 0; step < TREE_TEST_STEP_COUNT; ++step) {
+    /* mostly the next key in order, sometimes one close by or anywhere */
+    size_t op = everand(15);
+    size_t k = (op < 12) ? next : everand(size - 1);
+    if (op == 12) {
+      k = (next + size - everand(7)) % size;
+    }
+    next = (k + 1) % size;
+    struct tree_test *tt = nodes[k];
+    struct tree_test **e = &expected[first[k]];
+    if (op < 8) {
+      assert(lbtree_dc_finger_add(&tree, &finger, tt->key.buf, tt->key.size,
+                                  tt) == *e);
+      *e = tt;
+    } else if (op < 13) {
+      assert(lbtree_dc_finger(tree, &finger, tt->key.buf, tt->key.size) ==
+             *e);
+    } else if (op == 13) {
+      /* adds that do not use the finger leave it valid */
+      assert(lbtree_dc_add(&tree, tt->key.buf, tt->key.size, tt) == *e);
+      *e = tt;
+    } else {
+      assert(lbtree_dc_rm(&tree, tt->key.buf, tt->key.size) == *e);
+      *e = 0;
+      lbtree_d_finger_init(&finger);
+    }
+    assert(((tree == 0) ? 0 : lbtree_dc(tree, tt->key.buf, tt->key.size)) ==
+           *e);
+  }
+
+  size_t count = 0;
+  for (i = 0; i < size; ++i) {
+    if (first[i] != i) {
+      continue;
+    }
+    struct tree_test *tt = nodes[i];
+    assert(((tree == 0) ? 0 : lbtree_dc(tree, tt->key.buf, tt->key.size)) ==
+           expected[i]);
+    assert(lbtree_dc_finger(tree, &finger, tt->key.buf, tt->key.size) ==
+           expected[i]);
+    count += (expected[i] != 0) ? 1 : 0;
+  }
+  size_t walk_count = 0;
+  if (tree != 0) {
+    lbtree_d_walk(tree, &tree_test_count_action, &walk_count);
+    lbtree_d_free(tree);
+  }
+  assert(walk_count == count);
+
+  free(expected);
+  free(first);
+  lbtree_d_test_nodes_del(nodes);
+}
+
+/* Compares keys `size_bits` long in the order of `lbtree_d_walk`, from the
+  first byte's least significant bit */
+static int order_bits_cmp(const unsigned char *a, const unsigned char *b,
+                          size_t size_bits) {
+  size_t i;
+  for (i = 0; i < size_bits; ++i) {
+    int diff = ((a[i / CHAR_BIT] >> (i % CHAR_BIT)) & 1) -
+               ((b[i / CHAR_BIT] >> (i % CHAR_BIT)) & 1);
+    if (diff != 0) {
+      return diff;
+    }
+  }
+  return 0;
+}
+
+static int order_cmp(struct tree_test *a, struct tree_test *b) {
+  lbtree_index_t a_size_bits = a->key.size * CHAR_BIT;
+  lbtree_index_t b_size_bits = b->key.size * CHAR_BIT;
+  int diff = order_bits_cmp((unsigned char *)&a_size_bits,
+                            (unsigned char *)&b_size_bits,
+                            sizeof(lbtree_index_t) * CHAR_BIT);
+  return (diff != 0) ? diff
+                     : order_bits_cmp(a->key.buf, b->key.buf,
+                                      a->key.size * CHAR_BIT);
+}
+
+struct order_closure {
+  struct tree_test **order;
+  size_t count;
+};
+
+static void *order_action(const void *key, void **val, void *v_closure) {
+  (void)key;
+  struct order_closure *closure = v_closure;
+  closure->order[closure->count++] = *val;
+  return 0;
+}
+
+static void order_check_node(struct lbtree_d *node, lbtree_index_t size,
+                             struct tree_test *expected) {
+  if (expected == 0) {
+    assert(node == 0);
+    return;
+  }
+  assert((node != 0) && (node->val == expected));
+  assert(size == expected->key.size);
+}
+
+void lbtree_d_test_order(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_d_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_RAND);
+  struct tree_test **expected = calloc(size, sizeof(*expected));
+  struct tree_test **order = malloc(size * sizeof(*order));
+  assert((expected != 0) && (order != 0));
+
+  size_t i;
+  size_t j;
+
+  /* rounds of adds and removals leave trees shaped by both, each checked
+    against the walk for every key, in the tree or not */
+  struct lbtree_d *tree = 0;
+  unsigned int round;
+  for (round = 0; round < 4; ++round) {
+    for (i = 0; i < size; ++i) {
+      struct tree_test *tt = nodes[i];
+      if ((first[i] != i) || (everand(1) == 0)) {
+        continue;
+      }
+      if (expected[i] == 0) {
+        assert(lbtree_dc_add(&tree, tt->key.buf, tt->key.size, tt) == 0);
+        expected[i] = tt;
+      } else {
+        assert(lbtree_dc_rm(&tree, tt->key.buf, tt->key.size) == tt);
+        expected[i] = 0;
+      }
+    }
+
+    struct order_closure closure = {.order = order, .count = 0};
+    if (tree != 0) {
+      lbtree_d_walk(tree, &order_action, &closure);
+    }
+    for (i = 1; i < closure.count; ++i) {
+      assert(order_cmp(order[i - 1], order[i]) < 0);
+    }
+
+    lbtree_index_t node_size;
+    struct lbtree_d *node = lbtree_dc_first(tree, &node_size);
+    order_check_node(node, node_size, (closure.count != 0) ? order[0] : 0);
+    node = lbtree_dc_last(tree, &node_size);
+    order_check_node(node, node_size,
+                     (closure.count != 0) ? order[closure.count - 1] : 0);
+
+    for (i = 0; i < size; ++i) {
+      struct tree_test *tt = nodes[i];
+      j = 0;
+      while ((j < closure.count) && (order_cmp(order[j], tt) < 0)) {
+        ++j;
+      }
+      struct tree_test *pred = (j != 0) ? order[j - 1] : 0;
+      if ((j < closure.count) && (order_cmp(order[j], tt) == 0)) {
+        ++j;
+      }
+      struct tree_test *succ = (j < closure.count) ? order[j] : 0;
+      node = lbtree_dc_pred(tree, tt->key.buf, tt->key.size, &node_size);
+      order_check_node(node, node_size, pred);
+      node = lbtree_dc_succ(tree, tt->key.buf, tt->key.size, &node_size);
+      order_check_node(node, node_size, succ);
+    }
+  }
+  if (tree != 0) {
+    lbtree_d_free(tree);
+  }
+
+  free(order);
+  free(expected);
+  free(first);
+  lbtree_d_test_nodes_del(nodes);
+}
+
+#define BATCH_MAX_SIZE (64)
+
+struct batch_closure {
+  size_t replaced;
+};
+
+static void batch_action(const void *key, void *val, void *v_closure) {
+  struct batch_closure *closure = v_closure;
+  struct tree_test *tt = val;
+  /* the key passed is that of the pair replaced */
+  assert(key == tt->key.buf);
+  ++closure->replaced;
+}
+
+void lbtree_d_test_add_batch(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_d_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_FEW);
+  struct tree_test **expected = calloc(size, sizeof(*expected));
+  assert(expected != 0);
+
+  size_t i;
+  size_t j;
+
+  /* batches with keys repeated within them and already in the tree, between
+    removals so that batches are added to trees of every shape */
+  struct lbtree_d *tree = 0;
+  struct lbtree_d_pair pairs[BATCH_MAX_SIZE];
+  unsigned int step;
+  for (step = 0; step < (TREE_TEST_STEP_COUNT / 8); ++step) {
+    size_t count = everand(BATCH_MAX_SIZE);
+    size_t replaced = 0;
+    for (j = 0; j < count; ++j) {
+      struct tree_test *tt = nodes[everand(size - 1)];
+      struct tree_test **e = &expected[first[tt->id]];
+      replaced += (*e != 0) ? 1 : 0;
+      *e = tt;
+      pairs[j].key = tt->key.buf;
+      pairs[j].key_size_bits = tt->key.size * CHAR_BIT;
+      pairs[j].val = tt;
+    }
+    struct batch_closure closure = {.replaced = 0};
+    assert(lbtree_d_add_batch(&tree, pairs, count, &batch_action, &closure) ==
+           0);
+    assert(closure.replaced == replaced);
+    for (j = 0; j < count; ++j) {
+      struct tree_test *tt = pairs[j].val;
+      assert(lbtree_dc(tree, tt->key.buf, tt->key.size) ==
+             expected[first[tt->id]]);
+    }
+
+    size_t rm_count = everand(count / 2);
+    for (j = 0; j < rm_count; ++j) {
+      struct tree_test *tt = nodes[everand(size - 1)];
+      struct tree_test **e = &expected[first[tt->id]];
+      if (tree != 0) {
+        assert(lbtree_dc_rm(&tree, tt->key.buf, tt->key.size) == *e);
+      }
+      *e = 0;
+    }
+  }
+
+  size_t count = 0;
+  for (i = 0; i < size; ++i) {
+    if (first[i] != i) {
+      continue;
+    }
+    struct tree_test *tt = nodes[i];
+    assert(((tree == 0) ? 0 : lbtree_dc(tree, tt->key.buf, tt->key.size)) ==
+           expected[i]);
+    count += (expected[i] != 0) ? 1 : 0;
+  }
+  size_t walk_count = 0;
+  if (tree != 0) {
+    lbtree_d_walk(tree, &tree_test_count_action, &walk_count);
+    lbtree_d_free(tree);
+  }
+  assert(walk_count == count);
+
+  free(expected);
+  free(first);
+  lbtree_d_test_nodes_del(nodes);
+}
+
+void lbtree_d_test_count(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_d_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_RAND);
+  struct tree_test **expected = calloc(size, sizeof(*expected));
+  struct tree_test **order = malloc(size * sizeof(*order));
+  assert((expected != 0) && (order != 0));
+
+  size_t i;
+  size_t j;
+
+  /* rounds of adds, replacements and removals, each followed by checks of
+    every rank and of the counts of random prefixes against the walk */
+  struct lbtree_d *tree = 0;
+  unsigned int round;
+  for (round = 0; round < 4; ++round) {
+    for (i = 0; i < size; ++i) {
+      struct tree_test *tt = nodes[i];
+      if (everand(1) == 0) {
+        continue;
+      }
+      struct tree_test **slot = &expected[first[i]];
+      if ((*slot == 0) || (everand(3) == 0)) {
+        assert(lbtree_dc_count_add(&tree, tt->key.buf, tt->key.size, tt) ==
+               *slot);
+        *slot = tt;
+      } else {
+        assert(lbtree_dc_count_rm(&tree, tt->key.buf, tt->key.size) == *slot);
+        *slot = 0;
+      }
+    }
+
+    struct order_closure closure = {.order = order, .count = 0};
+    if (tree != 0) {
+      lbtree_d_walk(tree, &order_action, &closure);
+    }
+    assert(lbtree_d_count(tree) == closure.count);
+
+    lbtree_index_t node_size;
+    for (i = 0; i < closure.count; ++i) {
+      struct lbtree_d *node = lbtree_dc_select(tree, i, &node_size);
+      order_check_node(node, node_size, order[i]);
+    }
+    assert(lbtree_dc_select(tree, closure.count, &node_size) == 0);
+
+    for (i = 0; i < size; ++i) {
+      struct tree_test *tt = nodes[i];
+      j = 0;
+      while ((j < closure.count) && (order_cmp(order[j], tt) < 0)) {
+        ++j;
+      }
+      assert(lbtree_dc_rank(tree, tt->key.buf, tt->key.size) == j);
+
+      size_t prefix_size_bits = everand(tt->key.size * CHAR_BIT);
+      size_t count = 0;
+      for (j = 0; j < closure.count; ++j) {
+        struct tree_test *other = order[j];
+        if (((other->key.size * CHAR_BIT) >= prefix_size_bits) &&
+            (prefix_match(other->key.buf, tt->key.buf, prefix_size_bits) !=
+             0)) {
+          ++count;
+        }
+      }
+      assert(lbtree_d_count_prefix(tree, tt->key.buf, prefix_size_bits) ==
+             count);
+    }
+  }
+  if (tree != 0) {
+    lbtree_d_free(tree);
+  }
+
+  free(order);
+  free(expected);
+  free(first);
+  lbtree_d_test_nodes_del(nodes);
+}
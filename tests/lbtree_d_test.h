@@ -20,4 +20,41 @@
 
 extern const struct tree_test_iface lbtree_d_test_iface;
 
+/* Randomly adds and removes keys and removes keys by prefix and by range,
+  checking the tree against the expected contents after each step */
+void lbtree_d_test_rm_prefix(struct tree_test_config *config);
+
+/* Checks the union, intersection or difference of two random trees against the
+  expected contents */
+void lbtree_d_test_set_ops(struct tree_test_config *config);
+
+/* Splits a random tree at a random prefix and checks that both parts hold the
+  expected keys and remain usable */
+void lbtree_d_test_split(struct tree_test_config *config);
+
+/* Counts updates to random keys through slots and upserts, checking each count
+  against the expected one */
+void lbtree_d_test_upsert(struct tree_test_config *config);
+
+/* Adds and removes keys in a random order from a tree that is as deep as its
+  keys are long */
+void lbtree_d_test_deep(void);
+
+/* Adds and looks up keys mostly in order through a finger, checking the tree
+  against the expected contents after each step */
+void lbtree_d_test_finger(struct tree_test_config *config);
+
+/* Checks first, last, predecessor and successor queries against the order of
+  the walk, for keys in the tree and not, after rounds of adds and removals */
+void lbtree_d_test_order(struct tree_test_config *config);
+
+/* Adds batches of keys, repeated within them and already in the tree, between
+  removals, checking the replaced values and the tree against the expected */
+void lbtree_d_test_add_batch(struct tree_test_config *config);
+
+/* Checks the ranks of keys in the tree and not, selections of every rank and
+  counts of random prefixes of a counted tree against the walk, after rounds of
+  adds, replacements and removals */
+void lbtree_d_test_count(struct tree_test_config *config);
+
 #endif
@@ -0,0 +1,127 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_da_test.h"
+
+#include "../lbtree_da.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+static struct tree_test *lbtree_da_test_node_tt(void *node) { return node; }
+
+static void **lbtree_da_test_nodes_new(size_t size, size_t key_size) {
+  size_t node_size = sizeof(struct tree_test) + key_size;
+  void **nodes = malloc((node_size * size) + (sizeof(void *) * size));
+  assert(nodes != 0);
+
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    nodes[i] = ((unsigned char *)(nodes + size)) + (node_size * i);
+  }
+  return nodes;
+}
+
+static void lbtree_da_test_nodes_del(void **nodes) { free(nodes); }
+
+static void *lbtree_da_test_init(void) {
+  struct lbtree_da *tree = malloc(sizeof(*tree));
+  assert(tree != 0);
+  lbtree_da_init(tree);
+  return tree;
+}
+
+static void *lbtree_da_test_add(void **tree, void *v_tt) {
+  struct tree_test *tt = v_tt;
+  return lbtree_dac_add(*tree, tt->key.buf, tt->key.size, v_tt);
+}
+
+static void *lbtree_da_test_lookup(void *tree, struct tree_test *node) {
+  return lbtree_dac(tree, node->key.buf, node->key.size);
+}
+
+static void lbtree_da_test_rm(void **tree, void *v_node) {
+  struct tree_test *node = v_node;
+  lbtree_dac_rm(*tree, node->key.buf, node->key.size);
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(const void *key, void **val, void *v_closure) {
+  struct walk_closure *closure = v_closure;
+  struct tree_test *tt = *val;
+  /* the tree's own copy of the key */
+  assert(key != tt->key.buf);
+  assert(memcmp(key, tt->key.buf, tt->key.size) == 0);
+  return closure->action(key, val, closure->closure);
+}
+
+static void *lbtree_da_test_walk(void *tree,
+                                 void *(*action)(const void *key, void **val,
+                                                 void *closure),
+                                 void *closure) {
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  return lbtree_da_walk(tree, &walk_action, &walk_closure);
+}
+
+static void lbtree_da_test_del(void *tree) {
+  lbtree_da_free(tree);
+  free(tree);
+}
+
+const struct tree_test_iface lbtree_da_test_iface = {
+    .node_tt = &lbtree_da_test_node_tt,
+    .nodes_new = &lbtree_da_test_nodes_new,
+    .nodes_del = &lbtree_da_test_nodes_del,
+    .init = &lbtree_da_test_init,
+    .add = &lbtree_da_test_add,
+    .lookup = &lbtree_da_test_lookup,
+    .rm = &lbtree_da_test_rm,
+    .walk = &lbtree_da_test_walk,
+    .del = &lbtree_da_test_del};
+
+/* compacts every so often so that later operations run on compacted nodes,
+  mixed with nodes added and removed since */
+static void *lbtree_da_compact_test_add(void **tree, void *v_tt) {
+  struct tree_test *tt = v_tt;
+  if ((tt->id % 256) == 0) {
+    assert(lbtree_da_compact(*tree) == 0);
+  }
+  return lbtree_da_test_add(tree, v_tt);
+}
+
+static void *lbtree_da_compact_test_walk(void *tree,
+                                         void *(*action)(const void *key,
+                                                         void **val,
+                                                         void *closure),
+                                         void *closure) {
+  assert(lbtree_da_compact(tree) == 0);
+  return lbtree_da_test_walk(tree, action, closure);
+}
+
+const struct tree_test_iface lbtree_da_compact_test_iface = {
+    .node_tt = &lbtree_da_test_node_tt,
+    .nodes_new = &lbtree_da_test_nodes_new,
+    .nodes_del = &lbtree_da_test_nodes_del,
+    .init = &lbtree_da_test_init,
+    .add = &lbtree_da_compact_test_add,
+    .lookup = &lbtree_da_test_lookup,
+    .rm = &lbtree_da_test_rm,
+    .walk = &lbtree_da_compact_test_walk,
+    .del = &lbtree_da_test_del};
@@ -0,0 +1,24 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DA_TEST_H
+#define LBTREE_DA_TEST_H
+
+#include "tree_test.h"
+
+extern const struct tree_test_iface lbtree_da_test_iface;
+extern const struct tree_test_iface lbtree_da_compact_test_iface;
+
+#endif
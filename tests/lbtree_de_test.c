@@ -0,0 +1,260 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_de_test.h"
+
+#include "../lbtree_de.h"
+#include "./everand/everand.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#define CAPACITY (4096)
+#define MAX_CAPACITY (64)
+#define MAX_COST (8)
+
+static struct tree_test *lbtree_de_test_node_tt(void *node) { return node; }
+
+static void **lbtree_de_test_nodes_new(size_t size, size_t key_size) {
+  /* rounded up so that every node is aligned for any key size */
+  size_t align = _Alignof(struct tree_test);
+  size_t node_size =
+      ((sizeof(struct tree_test) + key_size + align - 1) / align) * align;
+  void **nodes = malloc((node_size * size) + (sizeof(void *) * size));
+  assert(nodes != 0);
+
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    nodes[i] = ((unsigned char *)(nodes + size)) + (node_size * i);
+  }
+  return nodes;
+}
+
+static void lbtree_de_test_nodes_del(void **nodes) { free(nodes); }
+
+static void evict_none(const void *key, void *val, void *closure) {
+  (void)key;
+  (void)val;
+  (void)closure;
+  assert(0);
+}
+
+static void *lbtree_de_test_init(void) {
+  struct lbtree_de *cache = malloc(sizeof(*cache));
+  assert(cache != 0);
+  assert(lbtree_de_init(cache, CAPACITY, 0, &evict_none, 0) == 0);
+  return cache;
+}
+
+static void *lbtree_de_test_add(void **v_cache, void *v_tt) {
+  struct tree_test *tt = v_tt;
+  return lbtree_dec_add(*v_cache, tt->key.buf, tt->key.size, v_tt, 1);
+}
+
+static void *lbtree_de_test_lookup(void *v_cache, struct tree_test *node) {
+  return lbtree_dec(v_cache, node->key.buf, node->key.size);
+}
+
+static void lbtree_de_test_rm(void **v_cache, void *v_node) {
+  struct tree_test *node = v_node;
+  lbtree_dec_rm(*v_cache, node->key.buf, node->key.size);
+}
+
+static void *lbtree_de_test_walk(void *v_cache,
+                                 void *(*action)(const void *key, void **val,
+                                                 void *closure),
+                                 void *closure) {
+  return lbtree_de_walk(v_cache, action, closure);
+}
+
+static void lbtree_de_test_del(void *v_cache) {
+  struct lbtree_de *cache = v_cache;
+  assert(cache->cost == cache->count);
+  assert(cache->evictions == 0);
+  lbtree_de_free(cache);
+  free(cache);
+}
+
+const struct tree_test_iface lbtree_de_test_iface = {
+    .node_tt = &lbtree_de_test_node_tt,
+    .nodes_new = &lbtree_de_test_nodes_new,
+    .nodes_del = &lbtree_de_test_nodes_del,
+    .init = &lbtree_de_test_init,
+    .add = &lbtree_de_test_add,
+    .lookup = &lbtree_de_test_lookup,
+    .rm = &lbtree_de_test_rm,
+    .walk = &lbtree_de_test_walk,
+    .del = &lbtree_de_test_del};
+
+/* records the last pair evicted */
+static void evict_last(const void *key, void *val, void *v_last) {
+  const void **last = v_last;
+  assert(key == val);
+  *last = val;
+}
+
+void lbtree_de_test_clock(void) {
+  static unsigned char keys[] = "abcdefgh";
+  const void *last = 0;
+  struct lbtree_de cache;
+  assert(lbtree_de_init(&cache, 4, 0, &evict_last, &last) == 0);
+
+  size_t i;
+  for (i = 0; i < 4; ++i) {
+    assert(lbtree_dec_add(&cache, &keys[i], 1, &keys[i], 1) == 0);
+  }
+  assert(last == 0);
+  /* "a" is referenced, so the hand passes over it to "b" */
+  assert(lbtree_dec(&cache, &keys[0], 1) == &keys[0]);
+  assert(lbtree_dec_add(&cache, &keys[4], 1, &keys[4], 1) == 0);
+  assert(last == &keys[1]);
+  assert(lbtree_dec(&cache, &keys[1], 1) == 0);
+  /* the hand moves on from "b", leaving "a" with its bit cleared */
+  assert(lbtree_dec_add(&cache, &keys[5], 1, &keys[5], 1) == 0);
+  assert(last == &keys[2]);
+  assert(lbtree_dec_add(&cache, &keys[6], 1, &keys[6], 1) == 0);
+  assert(last == &keys[3]);
+  /* replacing a pair references it */
+  assert(lbtree_dec(&cache, &keys[0], 1) == &keys[0]);
+  assert(lbtree_dec_add(&cache, &keys[4], 1, &keys[4], 1) == &keys[4]);
+  assert(lbtree_dec_add(&cache, &keys[7], 1, &keys[7], 1) == 0);
+  assert(last == &keys[5]);
+  assert((cache.count == 4) && (cache.evictions == 4));
+  assert((cache.hits == 2) && (cache.misses == 1));
+  lbtree_de_free(&cache);
+
+  /* a budget of 10 holds two pairs of cost 4, then one of cost 9 */
+  last = 0;
+  assert(lbtree_de_init(&cache, 4, 10, &evict_last, &last) == 0);
+  assert(lbtree_dec_add(&cache, &keys[0], 1, &keys[0], 4) == 0);
+  assert(lbtree_dec_add(&cache, &keys[1], 1, &keys[1], 4) == 0);
+  assert(last == 0);
+  assert(lbtree_dec_add(&cache, &keys[2], 1, &keys[2], 4) == 0);
+  assert(last == &keys[0]);
+  assert(lbtree_dec_add(&cache, &keys[3], 1, &keys[3], 11) == &keys[3]);
+  assert(cache.cost == 8);
+  /* growing the cost of a pair evicts others, but never that pair */
+  assert(lbtree_dec_add(&cache, &keys[2], 1, &keys[2], 9) == &keys[2]);
+  assert(last == &keys[1]);
+  assert((cache.count == 1) && (cache.cost == 9));
+  assert(lbtree_dec(&cache, &keys[2], 1) == &keys[2]);
+  lbtree_de_free(&cache);
+}
+
+struct evict_test {
+  /* the pair expected for each key, indexed by the first node with that key */
+  struct tree_test **expected;
+  size_t *first;
+  size_t *costs;
+  size_t cost;
+};
+
+static void evict_expected(const void *key, void *val, void *v_test) {
+  struct evict_test *test = v_test;
+  struct tree_test *tt = val;
+  size_t f = test->first[tt->id];
+  assert(key == tt->key.buf);
+  assert(test->expected[f] == tt);
+  test->expected[f] = 0;
+  test->cost -= test->costs[f];
+}
+
+static void *walk_count(const void *key, void **val, void *closure) {
+  struct tree_test *tt = *val;
+  assert(key == tt->key.buf);
+  ++*(size_t *)closure;
+  return 0;
+}
+
+void lbtree_de_test_evict(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_de_test_nodes_new(size, config->max_key_size);
+  struct evict_test test = {.cost = 0};
+  test.expected = calloc(size, sizeof(*test.expected));
+  test.first = tree_test_keys(nodes, config, TREE_TEST_FILL_FEW);
+  test.costs = malloc(size * sizeof(*test.costs));
+  assert((test.expected != 0) && (test.costs != 0));
+
+  size_t capacity = everand(MAX_CAPACITY - 1) + 1;
+  /* no budget, or one that every cost is within */
+  size_t budget = (everand(1) == 0) ? 0 : (everand(MAX_CAPACITY) + MAX_COST);
+  struct lbtree_de cache;
+  assert(lbtree_de_init(&cache, capacity, budget, &evict_expected, &test) ==
+         0);
+
+  size_t hits = 0;
+  size_t misses = 0;
+  unsigned int step;
+  for (step = 0; step < TREE_TEST_STEP_COUNT; ++step) {
+    struct tree_test *tt = nodes[everand(size - 1)];
+    size_t f = test.first[tt->id];
+    struct tree_test *e = test.expected[f];
+    switch (everand(3)) {
+    case 0:
+    case 1: {
+      size_t cost = everand(MAX_COST);
+      if (e != 0) {
+        test.cost -= test.costs[f];
+      }
+      /* pairs evicted by the add are taken from the expected ones as it runs
+       */
+      test.expected[f] = tt;
+      test.costs[f] = cost;
+      test.cost += cost;
+      assert(lbtree_dec_add(&cache, tt->key.buf, tt->key.size, tt, cost) ==
+             e);
+      assert(test.expected[f] == tt);
+      break;
+    }
+    case 2:
+      assert(lbtree_dec(&cache, tt->key.buf, tt->key.size) == e);
+      hits += (e != 0) ? 1 : 0;
+      misses += (e == 0) ? 1 : 0;
+      break;
+    default:
+      assert(lbtree_dec_rm(&cache, tt->key.buf, tt->key.size) == e);
+      if (e != 0) {
+        test.expected[f] = 0;
+        test.cost -= test.costs[f];
+      }
+      break;
+    }
+    assert(cache.count <= capacity);
+    assert((budget == 0) || (cache.cost <= budget));
+    assert(cache.cost == test.cost);
+    assert((cache.hits == hits) && (cache.misses == misses));
+  }
+
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    if (test.first[i] == i) {
+      struct tree_test *tt = nodes[i];
+      assert(lbtree_dec(&cache, tt->key.buf, tt->key.size) ==
+             test.expected[i]);
+      count += (test.expected[i] != 0) ? 1 : 0;
+    }
+  }
+  assert(count == cache.count);
+  count = 0;
+  assert(lbtree_de_walk(&cache, &walk_count, &count) == 0);
+  assert(count == cache.count);
+
+  lbtree_de_free(&cache);
+  free(test.costs);
+  free(test.first);
+  free(test.expected);
+  lbtree_de_test_nodes_del(nodes);
+}
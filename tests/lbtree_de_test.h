@@ -0,0 +1,33 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DE_TEST_H
+#define LBTREE_DE_TEST_H
+
+#include "tree_test.h"
+
+/* a cache large enough to hold every pair of a test, so that none are evicted
+ */
+extern const struct tree_test_iface lbtree_de_test_iface;
+
+/* Evicts from a small cache in a known order, checking the pairs chosen by the
+  hand and by the budget */
+void lbtree_de_test_clock(void);
+
+/* Adds, looks up and removes random keys in a small cache, checking it against
+  the expected pairs, as changed by those passed to `evict`, after each step */
+void lbtree_de_test_evict(struct tree_test_config *config);
+
+#endif
@@ -0,0 +1,124 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_dh_test.h"
+
+#include "../lbtree_dh.h"
+#include "everand/everand.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* so few distinct hashes that most keys share theirs with others */
+#define COLLIDE_HASH_MASK (0x3f)
+
+static struct tree_test *lbtree_dh_test_node_tt(void *node) { return node; }
+
+static void **lbtree_dh_test_nodes_new(size_t size, size_t key_size) {
+  size_t node_size = sizeof(struct tree_test) + key_size;
+  void **nodes = malloc((node_size * size) + (sizeof(void *) * size));
+  assert(nodes != 0);
+
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    nodes[i] = ((unsigned char *)(nodes + size)) + (node_size * i);
+  }
+  return nodes;
+}
+
+static void lbtree_dh_test_nodes_del(void **nodes) { free(nodes); }
+
+static void *lbtree_dh_test_init(void) {
+  struct lbtree_dh *tree = malloc(sizeof(*tree));
+  assert(tree != 0);
+  uint64_t seed[2];
+  everand_arr((unsigned char *)seed, sizeof(seed));
+  lbtree_dh_init(tree, seed);
+  return tree;
+}
+
+static void *lbtree_dh_test_add(void **tree, void *v_tt) {
+  struct tree_test *tt = v_tt;
+  return lbtree_dhc_add(*tree, tt->key.buf, tt->key.size, v_tt);
+}
+
+static void *lbtree_dh_test_lookup(void *tree, struct tree_test *node) {
+  return lbtree_dhc(tree, node->key.buf, node->key.size);
+}
+
+static void lbtree_dh_test_rm(void **tree, void *v_node) {
+  struct tree_test *node = v_node;
+  lbtree_dhc_rm(*tree, node->key.buf, node->key.size);
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(const void *key, void **val, void *v_closure) {
+  struct walk_closure *closure = v_closure;
+  struct tree_test *tt = *val;
+  /* keys are not copied */
+  assert(key == tt->key.buf);
+  return closure->action(key, val, closure->closure);
+}
+
+static void *lbtree_dh_test_walk(void *tree,
+                                 void *(*action)(const void *key, void **val,
+                                                 void *closure),
+                                 void *closure) {
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  return lbtree_dh_walk(tree, &walk_action, &walk_closure);
+}
+
+static void lbtree_dh_test_del(void *tree) {
+  lbtree_dh_free(tree);
+  free(tree);
+}
+
+const struct tree_test_iface lbtree_dh_test_iface = {
+    .node_tt = &lbtree_dh_test_node_tt,
+    .nodes_new = &lbtree_dh_test_nodes_new,
+    .nodes_del = &lbtree_dh_test_nodes_del,
+    .init = &lbtree_dh_test_init,
+    .add = &lbtree_dh_test_add,
+    .lookup = &lbtree_dh_test_lookup,
+    .rm = &lbtree_dh_test_rm,
+    .walk = &lbtree_dh_test_walk,
+    .del = &lbtree_dh_test_del};
+
+static uint64_t collide_hash(const void *key, lbtree_index_t key_size_bits,
+                             const uint64_t seed[2]) {
+  return lbtree_dh_hash(key, key_size_bits, seed) & COLLIDE_HASH_MASK;
+}
+
+static void *lbtree_dh_collide_test_init(void) {
+  struct lbtree_dh *tree = lbtree_dh_test_init();
+  tree->hash = &collide_hash;
+  return tree;
+}
+
+const struct tree_test_iface lbtree_dh_collide_test_iface = {
+    .node_tt = &lbtree_dh_test_node_tt,
+    .nodes_new = &lbtree_dh_test_nodes_new,
+    .nodes_del = &lbtree_dh_test_nodes_del,
+    .init = &lbtree_dh_collide_test_init,
+    .add = &lbtree_dh_test_add,
+    .lookup = &lbtree_dh_test_lookup,
+    .rm = &lbtree_dh_test_rm,
+    .walk = &lbtree_dh_test_walk,
+    .del = &lbtree_dh_test_del};
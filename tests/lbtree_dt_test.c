@@ -0,0 +1,171 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_dt_test.h"
+
+#include "../lbtree_dt.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+/* sweep once a quarter of the pairs are dead */
+#define SWEEP_PERCENT (25)
+
+/* the tree, counting pairs removed and keys released, as each removal leaves a
+  key that is released exactly once */
+struct dt_test {
+  struct lbtree_dt tree;
+  size_t removed;
+  size_t released;
+};
+
+static struct tree_test *lbtree_dt_test_node_tt(void *node) { return node; }
+
+static void **lbtree_dt_test_nodes_new(size_t size, size_t key_size) {
+  size_t node_size = sizeof(struct tree_test) + key_size;
+  void **nodes = malloc((node_size * size) + (sizeof(void *) * size));
+  assert(nodes != 0);
+
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    nodes[i] = ((unsigned char *)(nodes + size)) + (node_size * i);
+  }
+  return nodes;
+}
+
+static void lbtree_dt_test_nodes_del(void **nodes) { free(nodes); }
+
+static void release(const void *key, void *v_test) {
+  (void)key;
+  struct dt_test *test = v_test;
+  ++test->released;
+  /* the removal being made may have swept its own key */
+  assert(test->released <= (test->removed + 1));
+}
+
+static void *dt_test_new(unsigned int sweep_percent) {
+  struct dt_test *test = malloc(sizeof(*test));
+  assert(test != 0);
+  lbtree_dt_init(&test->tree, sweep_percent, &release, test);
+  test->removed = 0;
+  test->released = 0;
+  return test;
+}
+
+static void *lbtree_dt_test_init(void) { return dt_test_new(SWEEP_PERCENT); }
+
+static void *lbtree_dt_test_add(void **v_test, void *v_tt) {
+  struct dt_test *test = *v_test;
+  struct tree_test *tt = v_tt;
+  return lbtree_dtc_add(&test->tree, tt->key.buf, tt->key.size, v_tt);
+}
+
+static void *lbtree_dt_test_lookup(void *v_test, struct tree_test *node) {
+  struct dt_test *test = v_test;
+  return lbtree_dtc(&test->tree, node->key.buf, node->key.size);
+}
+
+static void lbtree_dt_test_rm(void **v_test, void *v_node) {
+  struct dt_test *test = *v_test;
+  struct tree_test *node = v_node;
+  if (lbtree_dtc_rm(&test->tree, node->key.buf, node->key.size) != 0) {
+    ++test->removed;
+  }
+  assert(test->tree.dead <= test->tree.count);
+}
+
+static void *lbtree_dt_test_walk(void *v_test,
+                                 void *(*action)(const void *key, void **val,
+                                                 void *closure),
+                                 void *closure) {
+  struct dt_test *test = v_test;
+  return lbtree_dt_walk(&test->tree, action, closure);
+}
+
+static void lbtree_dt_test_del(void *v_test) {
+  struct dt_test *test = v_test;
+  lbtree_dt_free(&test->tree);
+  assert(test->released == test->removed);
+  free(test);
+}
+
+const struct tree_test_iface lbtree_dt_test_iface = {
+    .node_tt = &lbtree_dt_test_node_tt,
+    .nodes_new = &lbtree_dt_test_nodes_new,
+    .nodes_del = &lbtree_dt_test_nodes_del,
+    .init = &lbtree_dt_test_init,
+    .add = &lbtree_dt_test_add,
+    .lookup = &lbtree_dt_test_lookup,
+    .rm = &lbtree_dt_test_rm,
+    .walk = &lbtree_dt_test_walk,
+    .del = &lbtree_dt_test_del};
+
+static void *lbtree_dt_lazy_test_init(void) { return dt_test_new(0); }
+
+/* sweeps only when asked, every so often, so that dead pairs build up and are
+  revived by later adds */
+static void *lbtree_dt_lazy_test_add(void **v_test, void *v_tt) {
+  struct dt_test *test = *v_test;
+  struct tree_test *tt = v_tt;
+  if ((tt->id % 256) == 0) {
+    size_t live = test->tree.count - test->tree.dead;
+    assert(lbtree_dt_sweep(&test->tree) == 0);
+    assert((test->tree.dead == 0) && (test->tree.count == live));
+  }
+  return lbtree_dt_test_add(v_test, v_tt);
+}
+
+const struct tree_test_iface lbtree_dt_lazy_test_iface = {
+    .node_tt = &lbtree_dt_test_node_tt,
+    .nodes_new = &lbtree_dt_test_nodes_new,
+    .nodes_del = &lbtree_dt_test_nodes_del,
+    .init = &lbtree_dt_lazy_test_init,
+    .add = &lbtree_dt_lazy_test_add,
+    .lookup = &lbtree_dt_test_lookup,
+    .rm = &lbtree_dt_test_rm,
+    .walk = &lbtree_dt_test_walk,
+    .del = &lbtree_dt_test_del};
+
+static void release_last(const void *key, void *closure) {
+  *(const void **)closure = key;
+}
+
+void lbtree_dt_test_release(void) {
+  /* two buffers holding the same key */
+  static unsigned char keys[] = "aa";
+  static int vals[3];
+  const void *last = 0;
+  struct lbtree_dt tree;
+  lbtree_dt_init(&tree, 0, &release_last, &last);
+
+  /* added again in the buffer it was removed in, the key is live once more */
+  assert(lbtree_dtc_add(&tree, &keys[0], 1, &vals[0]) == 0);
+  assert(lbtree_dtc_rm(&tree, &keys[0], 1) == &vals[0]);
+  assert(lbtree_dtc_add(&tree, &keys[0], 1, &vals[1]) == 0);
+  assert(last == 0);
+  assert(lbtree_dtc(&tree, &keys[0], 1) == &vals[1]);
+  /* added again in another buffer, the dead key is released */
+  assert(lbtree_dtc_rm(&tree, &keys[0], 1) == &vals[1]);
+  assert(lbtree_dtc_add(&tree, &keys[1], 1, &vals[0]) == 0);
+  assert(last == &keys[0]);
+  /* the key of a replaced live pair returns to the caller */
+  last = 0;
+  assert(lbtree_dtc_add(&tree, &keys[0], 1, &vals[2]) == &vals[0]);
+  assert(last == 0);
+  assert(lbtree_dtc_rm(&tree, &keys[0], 1) == &vals[2]);
+  assert(lbtree_dt_sweep(&tree) == 0);
+  assert(last == &keys[0]);
+  lbtree_dt_free(&tree);
+}
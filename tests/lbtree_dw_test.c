@@ -0,0 +1,209 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_dw_test.h"
+
+#include "../lbtree_dw.h"
+#include "everand/everand.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define VAL_MAX_SIZE (15)
+#define PATH_SIZE (64)
+
+struct dw_val {
+  /* size of the value, if `present` */
+  size_t size;
+  int present;
+  unsigned char buf[VAL_MAX_SIZE];
+};
+
+/* the keys of the test, the value expected for each being held at the index of
+  the first node with that key */
+struct dw_keys {
+  void **nodes;
+  size_t *first;
+  struct dw_val *vals;
+  size_t size;
+};
+
+static void *count_action(const void *key, lbtree_index_t key_size_bits,
+                          const void *val, size_t val_size, void *closure) {
+  (void)key;
+  (void)key_size_bits;
+  (void)val;
+  (void)val_size;
+  ++*(size_t *)closure;
+  return 0;
+}
+
+static void dw_check(struct lbtree_dw *tree, struct dw_keys *keys) {
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i < keys->size; ++i) {
+    struct tree_test *tt = keys->nodes[i];
+    size_t val_size;
+    const void *val = lbtree_dwc(tree, tt->key.buf, tt->key.size, &val_size);
+    struct dw_val *expected = &keys->vals[keys->first[i]];
+    if (expected->present == 0) {
+      assert(val == 0);
+      continue;
+    }
+    assert((val != 0) && (val_size == expected->size));
+    assert(memcmp(val, expected->buf, val_size) == 0);
+    count += (keys->first[i] == i) ? 1 : 0;
+  }
+  size_t walk_count = 0;
+  lbtree_dw_walk(tree, &count_action, &walk_count);
+  assert(walk_count == count);
+}
+
+static void file_copy(const char *src, const char *dst) {
+  FILE *in = fopen(src, "rb");
+  FILE *out = fopen(dst, "wb");
+  assert(out != 0);
+  if (in != 0) {
+    unsigned char buf[4096];
+    size_t size;
+    while ((size = fread(buf, 1, sizeof(buf), in)) != 0) {
+      assert(fwrite(buf, 1, size, out) == size);
+    }
+    fclose(in);
+  }
+  assert(fclose(out) == 0);
+}
+
+static long file_size(const char *path) {
+  FILE *file = fopen(path, "rb");
+  assert(file != 0);
+  assert(fseek(file, 0, SEEK_END) == 0);
+  long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+/* Opens a copy of the files of `path` at `copy_path`, as they would be found
+  after a crash, with junk appended to the log, and checks their contents */
+static void dw_check_crash(const char *path, const char *copy_path,
+                           struct dw_keys *keys) {
+  char src[PATH_SIZE];
+  char dst[PATH_SIZE];
+  if (access(path, F_OK) == 0) {
+    file_copy(path, copy_path);
+  } else {
+    unlink(copy_path);
+  }
+  snprintf(src, sizeof(src), "%s.log", path);
+  snprintf(dst, sizeof(dst), "%s.log", copy_path);
+  file_copy(src, dst);
+  long log_size = file_size(dst);
+
+  FILE *log = fopen(dst, "ab");
+  assert(log != 0);
+  size_t junk_size = everand(63) + 1;
+  size_t i;
+  for (i = 0; i < junk_size; ++i) {
+    fputc((int)everand(UCHAR_MAX), log);
+  }
+  assert(fclose(log) == 0);
+
+  struct lbtree_dw tree;
+  assert(lbtree_dw_open(&tree, copy_path, 0) == 0);
+  assert(file_size(dst) == log_size);
+  dw_check(&tree, keys);
+  assert(lbtree_dw_close(&tree) == 0);
+}
+
+void lbtree_dw_test_recovery(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  struct dw_keys keys = {.size = size};
+  keys.nodes = malloc(size * sizeof(*keys.nodes));
+  assert(keys.nodes != 0);
+  size_t i;
+  size_t j;
+  for (i = 0; i < size; ++i) {
+    keys.nodes[i] = malloc(sizeof(struct tree_test) + config->max_key_size);
+    assert(keys.nodes[i] != 0);
+  }
+  keys.first = tree_test_keys(keys.nodes, config, TREE_TEST_FILL_FEW);
+  keys.vals = calloc(size, sizeof(*keys.vals));
+  assert(keys.vals != 0);
+
+  char dir[] = "/tmp/lbtree_dw_test_XXXXXX";
+  assert(mkdtemp(dir) != 0);
+  char path[PATH_SIZE];
+  char copy_path[PATH_SIZE];
+  snprintf(path, sizeof(path), "%s/tree", dir);
+  snprintf(copy_path, sizeof(copy_path), "%s/copy", dir);
+
+  /* commits of every change, of small groups and only when asked */
+  static const size_t commit_sizes[] = {0, 256, 1 << 20};
+  size_t commit_size = commit_sizes[everand(2)];
+  struct lbtree_dw tree;
+  assert(lbtree_dw_open(&tree, path, commit_size) == 0);
+  unsigned int step;
+  for (step = 0; step < TREE_TEST_STEP_COUNT; ++step) {
+    struct tree_test *tt = keys.nodes[everand(size - 1)];
+    struct dw_val *expected = &keys.vals[keys.first[tt->id]];
+    size_t op = everand(63);
+    if (op < 40) {
+      expected->size = everand(VAL_MAX_SIZE);
+      for (j = 0; j < expected->size; ++j) {
+        expected->buf[j] = (unsigned char)everand(UCHAR_MAX);
+      }
+      assert(lbtree_dwc_add(&tree, tt->key.buf, tt->key.size, expected->buf,
+                            expected->size) == 0);
+      expected->present = 1;
+    } else if (op < 56) {
+      assert(lbtree_dwc_rm(&tree, tt->key.buf, tt->key.size) == 0);
+      expected->present = 0;
+    } else if (op < 60) {
+      assert(lbtree_dw_commit(&tree) == 0);
+      dw_check_crash(path, copy_path, &keys);
+    } else if (op < 62) {
+      assert(lbtree_dw_checkpoint(&tree) == 0);
+      dw_check_crash(path, copy_path, &keys);
+    } else {
+      assert(lbtree_dw_close(&tree) == 0);
+      commit_size = commit_sizes[everand(2)];
+      assert(lbtree_dw_open(&tree, path, commit_size) == 0);
+      dw_check(&tree, &keys);
+    }
+    size_t val_size;
+    const void *val = lbtree_dwc(&tree, tt->key.buf, tt->key.size, &val_size);
+    assert((val != 0) == (expected->present != 0));
+  }
+  dw_check(&tree, &keys);
+  assert(lbtree_dw_close(&tree) == 0);
+
+  static const char *const names[] = {"tree", "tree.log", "copy", "copy.log"};
+  for (i = 0; i < sizeof(names) / sizeof(*names); ++i) {
+    char name[PATH_SIZE];
+    snprintf(name, sizeof(name), "%s/%s", dir, names[i]);
+    unlink(name);
+  }
+  assert(rmdir(dir) == 0);
+
+  for (i = 0; i < size; ++i) {
+    free(keys.nodes[i]);
+  }
+  free(keys.vals);
+  free(keys.first);
+  free(keys.nodes);
+}
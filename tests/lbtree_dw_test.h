@@ -0,0 +1,26 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DW_TEST_H
+#define LBTREE_DW_TEST_H
+
+#include "tree_test.h"
+
+/* Adds and removes random keys with commits, checkpoints and reopens between,
+  and checks that a copy of the files taken after a commit, with a torn record
+  appended to its log, opens with the committed contents */
+void lbtree_dw_test_recovery(struct tree_test_config *config);
+
+#endif
@@ -0,0 +1,208 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_dx_test.h"
+
+#include "../lbtree_dx.h"
+#include "./everand/everand.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+/* times and intervals are up to this many bits long */
+#define MAX_TIME_BITS (40)
+
+static struct tree_test *lbtree_dx_test_node_tt(void *node) { return node; }
+
+static void **lbtree_dx_test_nodes_new(size_t size, size_t key_size) {
+  /* rounded up so that every node is aligned for any key size */
+  size_t align = _Alignof(struct tree_test);
+  size_t node_size =
+      ((sizeof(struct tree_test) + key_size + align - 1) / align) * align;
+  void **nodes = malloc((node_size * size) + (sizeof(void *) * size));
+  assert(nodes != 0);
+
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    nodes[i] = ((unsigned char *)(nodes + size)) + (node_size * i);
+  }
+  return nodes;
+}
+
+static void lbtree_dx_test_nodes_del(void **nodes) { free(nodes); }
+
+static void expire_none(const void *key, void *val, void *closure) {
+  (void)key;
+  (void)val;
+  (void)closure;
+  assert(0);
+}
+
+static void *lbtree_dx_test_init(void) {
+  struct lbtree_dx *tree = malloc(sizeof(*tree));
+  assert(tree != 0);
+  lbtree_dx_init(tree, 0, &expire_none, 0);
+  return tree;
+}
+
+static void *lbtree_dx_test_add(void **v_tree, void *v_tt) {
+  struct lbtree_dx *tree = *v_tree;
+  struct tree_test *tt = v_tt;
+  if ((tt->id % 64) == 0) {
+    assert(lbtree_dx_tick(tree, tt->id) == 0);
+  }
+  return lbtree_dxc_add(tree, tt->key.buf, tt->key.size, v_tt, UINT64_MAX);
+}
+
+static void *lbtree_dx_test_lookup(void *v_tree, struct tree_test *node) {
+  return lbtree_dxc(v_tree, node->key.buf, node->key.size);
+}
+
+static void lbtree_dx_test_rm(void **v_tree, void *v_node) {
+  struct tree_test *node = v_node;
+  lbtree_dxc_rm(*v_tree, node->key.buf, node->key.size);
+}
+
+static void *lbtree_dx_test_walk(void *v_tree,
+                                 void *(*action)(const void *key, void **val,
+                                                 void *closure),
+                                 void *closure) {
+  return lbtree_dx_walk(v_tree, action, closure);
+}
+
+static void lbtree_dx_test_del(void *v_tree) {
+  lbtree_dx_free(v_tree);
+  free(v_tree);
+}
+
+const struct tree_test_iface lbtree_dx_test_iface = {
+    .node_tt = &lbtree_dx_test_node_tt,
+    .nodes_new = &lbtree_dx_test_nodes_new,
+    .nodes_del = &lbtree_dx_test_nodes_del,
+    .init = &lbtree_dx_test_init,
+    .add = &lbtree_dx_test_add,
+    .lookup = &lbtree_dx_test_lookup,
+    .rm = &lbtree_dx_test_rm,
+    .walk = &lbtree_dx_test_walk,
+    .del = &lbtree_dx_test_del};
+
+struct expire_test {
+  /* the pair expected for each key, indexed by the first node with that key */
+  struct tree_test **expected;
+  size_t *first;
+  uint64_t *expires;
+  uint64_t now;
+  size_t count;
+  size_t expired;
+};
+
+static void expire_expected(const void *key, void *val, void *v_test) {
+  struct expire_test *test = v_test;
+  struct tree_test *tt = val;
+  size_t f = test->first[tt->id];
+  assert(key == tt->key.buf);
+  assert(test->expected[f] == tt);
+  assert(test->expires[f] <= test->now);
+  test->expected[f] = 0;
+  --test->count;
+  ++test->expired;
+}
+
+/* Returns an interval whose bit length is itself random, so that intervals of
+  every scale are as likely */
+static uint64_t interval(void) {
+  return everand(((size_t)1 << everand(MAX_TIME_BITS)) - 1);
+}
+
+void lbtree_dx_test_expire(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_dx_test_nodes_new(size, config->max_key_size);
+  struct expire_test test = {.count = 0};
+  test.expected = calloc(size, sizeof(*test.expected));
+  test.first = tree_test_keys(nodes, config, TREE_TEST_FILL_FEW);
+  test.expires = malloc(size * sizeof(*test.expires));
+  assert((test.expected != 0) && (test.expires != 0));
+
+  uint64_t start = interval();
+  struct lbtree_dx tree;
+  lbtree_dx_init(&tree, start, &expire_expected, &test);
+  test.now = start;
+
+  unsigned int step;
+  for (step = 0; step < TREE_TEST_STEP_COUNT; ++step) {
+    struct tree_test *tt = nodes[everand(size - 1)];
+    size_t f = test.first[tt->id];
+    struct tree_test *e = test.expected[f];
+    /* some pairs have already expired, to be removed by the next tick */
+    uint64_t expires = (everand(7) == 0) ? (tree.now - everand(2))
+                                         : (tree.now + interval());
+    switch (everand(7)) {
+    case 0:
+    case 1:
+    case 2:
+      assert(lbtree_dxc_add(&tree, tt->key.buf, tt->key.size, tt, expires) ==
+             e);
+      test.expected[f] = tt;
+      test.expires[f] = expires;
+      test.count += (e == 0) ? 1 : 0;
+      break;
+    case 3:
+      assert((lbtree_dxc_touch(&tree, tt->key.buf, tt->key.size, expires) ==
+              0) == (e != 0));
+      test.expires[f] = expires;
+      break;
+    case 4:
+      assert(lbtree_dxc(&tree, tt->key.buf, tt->key.size) == e);
+      break;
+    case 5:
+      assert(lbtree_dxc_rm(&tree, tt->key.buf, tt->key.size) == e);
+      test.expected[f] = 0;
+      test.count -= (e != 0) ? 1 : 0;
+      break;
+    default: {
+      uint64_t prev = tree.now;
+      test.now = prev + interval();
+      test.expired = 0;
+      assert(lbtree_dx_tick(&tree, test.now) == test.expired);
+      assert(tree.now == test.now);
+      if (test.now != prev) {
+        size_t i;
+        for (i = 0; i < size; ++i) {
+          assert((test.expected[i] == 0) || (test.expires[i] > test.now));
+        }
+      }
+      break;
+    }
+    }
+    assert(tree.count == test.count);
+  }
+
+  /* every pair expires by the end of time */
+  test.now = UINT64_MAX;
+  test.expired = 0;
+  assert(lbtree_dx_tick(&tree, test.now) == test.expired);
+  assert((tree.count == 0) && (test.count == 0) && (tree.size_tree == 0));
+  /* and the tree is still usable at its end */
+  struct tree_test *tt = nodes[0];
+  assert(lbtree_dxc_add(&tree, tt->key.buf, tt->key.size, tt, 0) == 0);
+  assert(lbtree_dxc(&tree, tt->key.buf, tt->key.size) == tt);
+  lbtree_dx_free(&tree);
+  assert(tree.count == 0);
+
+  free(test.expires);
+  free(test.first);
+  free(test.expected);
+  lbtree_dx_test_nodes_del(nodes);
+}
@@ -0,0 +1,29 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_DX_TEST_H
+#define LBTREE_DX_TEST_H
+
+#include "tree_test.h"
+
+/* a tree whose pairs never expire, though it is ticked as pairs are added */
+extern const struct tree_test_iface lbtree_dx_test_iface;
+
+/* Adds, touches, looks up and removes random keys with expiry times of every
+  scale, ticking the tree forward by every scale, and checks after each tick
+  that exactly the expired pairs were passed to `expire` */
+void lbtree_dx_test_expire(struct tree_test_config *config);
+
+#endif
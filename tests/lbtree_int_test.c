@@ -0,0 +1,120 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_int_test.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define NODE_ALIGN (16)
+
+#define LBTREE_INT_TEST_DEFINE(name, type)                                     \
+  struct name##_test {                                                         \
+    struct name base;                                                          \
+    struct tree_test tt;                                                       \
+  };                                                                           \
+                                                                               \
+  static type name##_test_key(struct tree_test *tt) {                          \
+    type key;                                                                  \
+    assert(tt->key.size == sizeof(key));                                       \
+    memcpy(&key, tt->key.buf, sizeof(key));                                    \
+    return key;                                                                \
+  }                                                                            \
+                                                                               \
+  static struct tree_test *name##_test_node_tt(void *node) {                   \
+    return &((struct name##_test *)node)->tt;                                  \
+  }                                                                            \
+                                                                               \
+  static void **name##_test_nodes_new(size_t size, size_t key_size) {          \
+    size_t node_size = sizeof(struct name##_test) + key_size;                  \
+    /* keep the nodes aligned */                                               \
+    node_size += NODE_ALIGN - 1;                                               \
+    node_size -= node_size % NODE_ALIGN;                                       \
+    void **nodes = malloc((node_size * size) + (sizeof(void *) * size) +       \
+                          NODE_ALIGN);                                         \
+    assert(nodes != 0);                                                        \
+    unsigned char *base = (unsigned char *)(nodes + size);                     \
+    base += NODE_ALIGN - (((uintptr_t)base) % NODE_ALIGN);                     \
+                                                                               \
+    size_t i;                                                                  \
+    for (i = 0; i < size; ++i) {                                               \
+      nodes[i] = base + (node_size * i);                                       \
+    }                                                                          \
+    return nodes;                                                              \
+  }                                                                            \
+                                                                               \
+  static void *name##_test_add(void **tree, void *v_node) {                    \
+    struct name##_test *node = v_node;                                         \
+    node->base.key = name##_test_key(&node->tt);                               \
+    return name##_add((struct name **)tree, &node->base);                      \
+  }                                                                            \
+                                                                               \
+  static void *name##_test_lookup(void *tree, struct tree_test *tt) {          \
+    return name(tree, name##_test_key(tt));                                    \
+  }                                                                            \
+                                                                               \
+  static void name##_test_rm(void **tree, void *v_node) {                      \
+    struct name##_test *node = v_node;                                         \
+    /* exercise both ways of removing */                                       \
+    if ((node->base.key & 1) == 0) {                                           \
+      name##_rm((struct name **)tree, &node->base);                            \
+    } else {                                                                   \
+      void *rm = name##_rm_key((struct name **)tree, node->base.key);          \
+      assert(rm == node);                                                      \
+    }                                                                          \
+  }                                                                            \
+                                                                               \
+  static void *name##_test_walk(void *tree,                                    \
+                                void *(*action)(const void *key, void **val,   \
+                                                void *closure),                \
+                                void *closure) {                               \
+    struct walk_closure walk_closure = {.action = action,                      \
+                                        .closure = closure};                   \
+    return name##_walk(tree, &walk_action, &walk_closure);                     \
+  }                                                                            \
+                                                                               \
+  const struct tree_test_iface name##_test_iface = {                           \
+      .node_tt = &name##_test_node_tt,                                         \
+      .nodes_new = &name##_test_nodes_new,                                     \
+      .nodes_del = &nodes_del,                                                 \
+      .init = &init,                                                           \
+      .add = &name##_test_add,                                                 \
+      .lookup = &name##_test_lookup,                                           \
+      .rm = &name##_test_rm,                                                   \
+      .walk = &name##_test_walk,                                               \
+      .del = &del};
+
+static void nodes_del(void **nodes) { free(nodes); }
+
+static void *init(void) { return 0; }
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(void *node, void *closure) {
+  struct walk_closure *walk_closure = closure;
+  return walk_closure->action(node, &node, walk_closure->closure);
+}
+
+static void del(void *tree) { (void)tree; }
+
+LBTREE_INT_TEST_DEFINE(lbtree_u32, uint32_t)
+LBTREE_INT_TEST_DEFINE(lbtree_u64, uint64_t)
+
+#ifdef LBTREE_U128
+LBTREE_INT_TEST_DEFINE(lbtree_u128, lbtree_u128_t)
+#endif
@@ -0,0 +1,228 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Checks `lbtree_cpp::map` against a `std::map` given the same random
+  operations, including the order of iteration in both directions. */
+
+#include "lbtree.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#define SEED (16)
+#define TEST_COUNT (32)
+#define OP_COUNT (4096)
+
+template <class Key, class Value>
+static void check(const lbtree_cpp::map<Key, Value> &m,
+                  const std::map<Key, Value> &ref) {
+  assert(m.size() == ref.size());
+  assert(m.empty() == ref.empty());
+  auto it = m.begin();
+  for (const auto &kv : ref) {
+    assert(it != m.end());
+    assert(it->first == kv.first);
+    assert(it->second == kv.second);
+    ++it;
+  }
+  assert(it == m.end());
+  auto rit = ref.rbegin();
+  for (auto mit = m.end(); mit != m.begin();) {
+    --mit;
+    assert(mit->first == rit->first);
+    ++rit;
+  }
+  assert(rit == ref.rend());
+}
+
+/* `mask` limits the keys so that adds and removals find existing keys */
+template <class Key>
+static void test_random(std::mt19937_64 &rng, std::uint64_t mask) {
+  std::pmr::monotonic_buffer_resource buf;
+  std::pmr::unsynchronized_pool_resource pool(&buf);
+  lbtree_cpp::map<Key, std::string> m(&pool);
+  std::map<Key, std::string> ref;
+
+  unsigned int i;
+  for (i = 0; i < OP_COUNT; ++i) {
+    Key key = static_cast<Key>(rng() & mask);
+    std::string val = std::to_string(rng());
+    switch (rng() % 6) {
+    case 0: {
+      auto r = m.try_emplace(key, val);
+      auto rr = ref.try_emplace(key, val);
+      assert(r.second == rr.second);
+      assert(r.first->second == rr.first->second);
+      break;
+    }
+    case 1:
+      m.insert_or_assign(key, val);
+      ref.insert_or_assign(key, val);
+      break;
+    case 2:
+      assert(m.erase(key) == ref.erase(key));
+      break;
+    case 3: {
+      auto it = m.find(key);
+      auto rit = ref.find(key);
+      assert((it == m.end()) == (rit == ref.end()));
+      if (it != m.end()) {
+        // the iterator returned is to the next key
+        auto next = m.erase(it);
+        auto rnext = ref.erase(rit);
+        assert((next == m.end()) == (rnext == ref.end()));
+        assert((next == m.end()) || (next->first == rnext->first));
+      }
+      break;
+    }
+    case 4:
+      m[key] += val;
+      ref[key] += val;
+      break;
+    default: {
+      auto r = m.emplace(key, std::move(val));
+      auto rr = ref.emplace(key, r.first->second);
+      assert(r.second == rr.second);
+      break;
+    }
+    }
+    assert(m.contains(key) == (ref.count(key) != 0));
+  }
+  check(m, ref);
+
+  // copies use the default resource, so moves between them copy the values
+  lbtree_cpp::map<Key, std::string> copy(m);
+  check(copy, ref);
+  lbtree_cpp::map<Key, std::string> moved(std::move(copy));
+  assert(copy.empty());
+  check(moved, ref);
+  m = std::move(moved);
+  check(m, ref);
+  m.clear();
+  assert(m.begin() == m.end());
+}
+
+/* the allocator each live node came from, so that a node freed through another
+  is caught */
+static std::map<void *, int> owners;
+
+/* stateful allocator that follows its container on copy and move assignment */
+template <class T> struct tagged_allocator {
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+
+  int id;
+
+  explicit tagged_allocator(int id) : id(id) {}
+  template <class U>
+  tagged_allocator(const tagged_allocator<U> &other) : id(other.id) {}
+
+  T *allocate(std::size_t n) {
+    T *p = std::allocator<T>().allocate(n);
+    owners[p] = id;
+    return p;
+  }
+
+  void deallocate(T *p, std::size_t n) {
+    auto it = owners.find(p);
+    assert((it != owners.end()) && (it->second == id));
+    owners.erase(it);
+    std::allocator<T>().deallocate(p, n);
+  }
+
+  template <class U>
+  friend bool operator==(const tagged_allocator &a,
+                         const tagged_allocator<U> &b) {
+    return a.id == b.id;
+  }
+  template <class U>
+  friend bool operator!=(const tagged_allocator &a,
+                         const tagged_allocator<U> &b) {
+    return a.id != b.id;
+  }
+};
+
+static void test_alloc_propagation() {
+  using alloc = tagged_allocator<std::pair<const int, int>>;
+  using tagged_map =
+      lbtree_cpp::map<int, int, lbtree_cpp::bit_traits<int>, alloc>;
+  {
+    tagged_map a(alloc(1));
+    tagged_map b(alloc(2));
+    tagged_map c(alloc(3));
+    int i;
+    for (i = 0; i < 64; ++i) {
+      a.try_emplace(i, i);
+      b.try_emplace(-i, i);
+    }
+    // `b` frees its nodes with its own allocator, then takes that of `a`
+    b = a;
+    assert(b.get_allocator() == alloc(1));
+    assert(b.size() == 64);
+    // the move takes the allocator and the nodes of `b`
+    c.try_emplace(0, 0);
+    c = std::move(b);
+    assert(c.get_allocator() == alloc(1));
+    assert(b.empty() && (c.size() == 64) && (c.at(63) == 63));
+  }
+  assert(owners.empty());
+}
+
+static void test_move_only() {
+  lbtree_cpp::map<int, std::unique_ptr<int>> m;
+  int i;
+  for (i = -64; i < 64; ++i) {
+    m.try_emplace(i, std::make_unique<int>(i));
+  }
+  i = -64;
+  for (const auto &kv : m) {
+    assert(kv.first == i);
+    assert(*kv.second == i);
+    ++i;
+  }
+  assert(m.at(-1) != nullptr);
+  bool thrown = false;
+  try {
+    m.at(64);
+  } catch (const std::out_of_range &) {
+    thrown = true;
+  }
+  assert(thrown);
+}
+
+int main() {
+  std::mt19937_64 rng(SEED);
+  unsigned int i;
+  for (i = 0; i < TEST_COUNT; ++i) {
+    test_random<std::uint64_t>(rng, ~std::uint64_t(0));
+    test_random<std::uint64_t>(rng, 0x3ff);
+    test_random<std::int32_t>(rng, ~std::uint64_t(0));
+    test_random<std::int16_t>(rng, ~std::uint64_t(0));
+    test_random<std::int8_t>(rng, 0xff);
+    test_random<std::uint8_t>(rng, 0xff);
+  }
+  test_move_only();
+  test_alloc_propagation();
+  return 0;
+}
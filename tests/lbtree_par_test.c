@@ -0,0 +1,187 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_par_test.h"
+
+#include "../lbtree_par.h"
+#include "everand/everand.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define THREAD_COUNT (4)
+
+static struct tree_test *lbtree_d_par_test_node_tt(void *node) {
+  return node;
+}
+
+static void **lbtree_d_par_test_nodes_new(size_t size, size_t key_size) {
+  size_t node_size = sizeof(struct tree_test) + key_size;
+  void **nodes = malloc((node_size * size) + (sizeof(void *) * size));
+  assert(nodes != 0);
+
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    nodes[i] = ((unsigned char *)(nodes + size)) + (node_size * i);
+  }
+  return nodes;
+}
+
+static void lbtree_d_par_test_nodes_del(void **nodes) { free(nodes); }
+
+static void *lbtree_d_par_test_init(void) { return 0; }
+
+static void *lbtree_d_par_test_add(void **tree, void *v_tt) {
+  struct tree_test *tt = v_tt;
+  return lbtree_dc_add((struct lbtree_d **)tree, tt->key.buf, tt->key.size,
+                       v_tt);
+}
+
+static void *lbtree_d_par_test_lookup(void *tree, struct tree_test *node) {
+  return lbtree_dc(tree, node->key.buf, node->key.size);
+}
+
+static void lbtree_d_par_test_rm(void **tree, void *v_node) {
+  struct tree_test *node = v_node;
+  lbtree_dc_rm((struct lbtree_d **)tree, node->key.buf, node->key.size);
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(const void *key, void **val, void *v_closure) {
+  struct walk_closure *closure = v_closure;
+  return closure->action(key, val, closure->closure);
+}
+
+/* the test's action only changes the node it is passed, so all threads can
+  share one closure */
+static void *lbtree_d_par_test_walk(void *tree,
+                                    void *(*action)(const void *key, void **val,
+                                                    void *closure),
+                                    void *closure) {
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  void *closures[THREAD_COUNT];
+  unsigned int i;
+  for (i = 0; i < THREAD_COUNT; ++i) {
+    closures[i] = &walk_closure;
+  }
+  return lbtree_d_par_walk(tree, &walk_action, closures, THREAD_COUNT);
+}
+
+static void lbtree_d_par_test_del(void *tree) { lbtree_d_free(tree); }
+
+const struct tree_test_iface lbtree_d_par_test_iface = {
+    .node_tt = &lbtree_d_par_test_node_tt,
+    .nodes_new = &lbtree_d_par_test_nodes_new,
+    .nodes_del = &lbtree_d_par_test_nodes_del,
+    .init = &lbtree_d_par_test_init,
+    .add = &lbtree_d_par_test_add,
+    .lookup = &lbtree_d_par_test_lookup,
+    .rm = &lbtree_d_par_test_rm,
+    .walk = &lbtree_d_par_test_walk,
+    .del = &lbtree_d_par_test_del};
+
+static void *count_action(void *node, void *closure) {
+  (void)node;
+  ++*(size_t *)closure;
+  return 0;
+}
+
+struct sum {
+  size_t count;
+  size_t id_sum;
+  /* the node whose value stops the walk, if any */
+  struct tree_test *stop;
+};
+
+static void *sum_action(const void *key, void **val, void *closure) {
+  struct sum *sum = closure;
+  struct tree_test *tt = *val;
+  assert(memcmp(key, tt->key.buf, tt->key.size) == 0);
+  ++sum->count;
+  sum->id_sum += tt->id;
+  return (tt == sum->stop) ? tt : 0;
+}
+
+void lbtree_par_test_reduce(struct tree_test_config *config) {
+  size_t size = everand(config->max_size - 1) + 1;
+  void **nodes = lbtree_d_par_test_nodes_new(size, config->max_key_size);
+  struct lbtree_d *tree = 0;
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    struct tree_test *tt = nodes[i];
+    tt->id = i;
+    tt->key.size = everand(config->max_key_size - config->min_key_size) +
+                   config->min_key_size;
+    everand_arr(tt->key.buf, tt->key.size);
+    lbtree_dc_add(&tree, tt->key.buf, tt->key.size, tt);
+  }
+
+  struct sum expected = {.count = 0, .id_sum = 0, .stop = 0};
+  assert(lbtree_d_walk(tree, &sum_action, &expected) == 0);
+  size_t size_count = 0;
+  lbtree_walk(&tree->base, &lbtree_d_sel_node, &count_action, &size_count);
+
+  unsigned int thread_count;
+  for (thread_count = 1; thread_count <= THREAD_COUNT; ++thread_count) {
+    struct sum sums[THREAD_COUNT];
+    void *closures[THREAD_COUNT];
+    unsigned int j;
+    for (j = 0; j < thread_count; ++j) {
+      sums[j].count = 0;
+      sums[j].id_sum = 0;
+      sums[j].stop = 0;
+      closures[j] = &sums[j];
+    }
+    assert(lbtree_d_par_walk(tree, &sum_action, closures, thread_count) == 0);
+    struct sum total = {.count = 0, .id_sum = 0, .stop = 0};
+    for (j = 0; j < thread_count; ++j) {
+      total.count += sums[j].count;
+      total.id_sum += sums[j].id_sum;
+    }
+    assert((total.count == expected.count) &&
+           (total.id_sum == expected.id_sum));
+
+    /* the size tree, walked as a plain lbtree */
+    size_t counts[THREAD_COUNT];
+    for (j = 0; j < thread_count; ++j) {
+      counts[j] = 0;
+      closures[j] = &counts[j];
+    }
+    assert(lbtree_par_walk(&tree->base, &lbtree_d_sel_node, &count_action,
+                           closures, thread_count) == 0);
+    size_t count = 0;
+    for (j = 0; j < thread_count; ++j) {
+      count += counts[j];
+      closures[j] = &sums[j];
+    }
+    assert(count == size_count);
+
+    /* any present node stops the walk */
+    struct tree_test *stop = nodes[everand(size - 1)];
+    stop = lbtree_dc(tree, stop->key.buf, stop->key.size);
+    for (j = 0; j < thread_count; ++j) {
+      sums[j].stop = stop;
+    }
+    assert(lbtree_d_par_walk(tree, &sum_action, closures, thread_count) ==
+           stop);
+  }
+
+  lbtree_d_free(tree);
+  lbtree_d_par_test_nodes_del(nodes);
+}
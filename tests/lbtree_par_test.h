@@ -0,0 +1,28 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LBTREE_PAR_TEST_H
+#define LBTREE_PAR_TEST_H
+
+#include "tree_test.h"
+
+/* lbtree_d, walked with lbtree_d_par_walk */
+extern const struct tree_test_iface lbtree_d_par_test_iface;
+
+/* Sums the values of a random tree per thread and checks the combined sums
+  against a single threaded walk, and that a walk stops on an action's result */
+void lbtree_par_test_reduce(struct tree_test_config *config);
+
+#endif
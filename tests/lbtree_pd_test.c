@@ -0,0 +1,236 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_pd_test.h"
+
+#include "../lbtree_pd.h"
+#include "everand/everand.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+#define VERSION_COUNT (8)
+
+static struct tree_test *lbtree_pd_test_node_tt(void *node) { return node; }
+
+static void **lbtree_pd_test_nodes_new(size_t size, size_t key_size) {
+  size_t node_size = sizeof(struct tree_test) + key_size;
+  void **nodes = malloc((node_size * size) + (sizeof(void *) * size));
+  assert(nodes != 0);
+
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    nodes[i] = ((unsigned char *)(nodes + size)) + (node_size * i);
+  }
+  return nodes;
+}
+
+static void lbtree_pd_test_nodes_del(void **nodes) { free(nodes); }
+
+static void *lbtree_pd_test_init(void) { return 0; }
+
+static void *lbtree_pd_test_add(void **tree, void *v_tt) {
+  struct tree_test *tt = v_tt;
+  return lbtree_pdc_add((struct lbtree_pd **)tree, tt->key.buf, tt->key.size,
+                        v_tt);
+}
+
+static void *lbtree_pd_test_lookup(void *tree, struct tree_test *node) {
+  return lbtree_pdc(tree, node->key.buf, node->key.size);
+}
+
+static void lbtree_pd_test_rm(void **tree, void *v_node) {
+  struct tree_test *node = v_node;
+  lbtree_pdc_rm((struct lbtree_pd **)tree, node->key.buf, node->key.size);
+}
+
+static void *lbtree_pd_test_walk(void *tree,
+                                 void *(*action)(const void *key, void **val,
+                                                 void *closure),
+                                 void *closure) {
+  return lbtree_pd_walk(tree, action, closure);
+}
+
+static void lbtree_pd_test_del(void *tree) { lbtree_pd_release(tree); }
+
+const struct tree_test_iface lbtree_pd_test_iface = {
+    .node_tt = &lbtree_pd_test_node_tt,
+    .nodes_new = &lbtree_pd_test_nodes_new,
+    .nodes_del = &lbtree_pd_test_nodes_del,
+    .init = &lbtree_pd_test_init,
+    .add = &lbtree_pd_test_add,
+    .lookup = &lbtree_pd_test_lookup,
+    .rm = &lbtree_pd_test_rm,
+    .walk = &lbtree_pd_test_walk,
+    .del = &lbtree_pd_test_del};
+
+struct version {
+  struct lbtree_pd *tree;
+  /* the node expected to be found for each distinct key, indexed by the first
+    node with that key */
+  struct tree_test **expected;
+};
+
+static void version_check(struct version *version, void **nodes,
+                          size_t *first, size_t size) {
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    if (first[i] != i) {
+      continue;
+    }
+    struct tree_test *tt = nodes[i];
+    assert(lbtree_pdc(version->tree, tt->key.buf, tt->key.size) ==
+           version->expected[i]);
+    count += (version->expected[i] != 0) ? 1 : 0;
+  }
+  size_t walk_count = 0;
+  lbtree_pd_walk(version->tree, &tree_test_count_action, &walk_count);
+  assert(walk_count == count);
+}
+
+/* the changes expected between two versions */
+struct changes {
+  struct version *from;
+  struct version *to;
+  size_t *first;
+  /* the key of the last change */
+  struct tree_test *last;
+  size_t count;
+  /* the number of changes after which to stop, zero for none */
+  size_t stop;
+};
+
+/* Returns non-zero if the key of `a` is walked before that of `b`, by size
+  and then by the first bit in which they differ */
+static int walked_before(struct tree_test *a, struct tree_test *b) {
+  lbtree_index_t a_size = a->key.size * CHAR_BIT;
+  lbtree_index_t b_size = b->key.size * CHAR_BIT;
+  lbtree_index_t size_bits = sizeof(lbtree_index_t) * CHAR_BIT;
+  lbtree_index_t index = lbtree_d_index(&a_size, &b_size, size_bits);
+  if (index != size_bits) {
+    return lbtree_d_sel_key(&a_size, index) < lbtree_d_sel_key(&b_size, index);
+  }
+  index = lbtree_d_index(a->key.buf, b->key.buf, a_size);
+  return (index != a_size) && (lbtree_d_sel_key(a->key.buf, index) <
+                               lbtree_d_sel_key(b->key.buf, index));
+}
+
+static void *changes_action(const void *key, void *const *from_val,
+                            void *const *to_val, void *v_changes) {
+  struct changes *changes = v_changes;
+  struct tree_test *from_tt = (from_val != 0) ? *from_val : 0;
+  struct tree_test *to_tt = (to_val != 0) ? *to_val : 0;
+  assert(from_tt != to_tt);
+  struct tree_test *tt = (to_tt != 0) ? to_tt : from_tt;
+  size_t f = changes->first[tt->id];
+  assert(key == tt->key.buf);
+  assert(changes->from->expected[f] == from_tt);
+  assert(changes->to->expected[f] == to_tt);
+  /* each key once, in the order of the walks */
+  assert((changes->last == 0) || (walked_before(changes->last, tt) != 0));
+  changes->last = tt;
+  ++changes->count;
+  return (changes->count == changes->stop) ? changes : 0;
+}
+
+static void changes_check(struct changes *changes, size_t size) {
+  size_t expected = 0;
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    if ((changes->first[i] == i) &&
+        (changes->from->expected[i] != changes->to->expected[i])) {
+      ++expected;
+    }
+  }
+  changes->stop = 0;
+  changes->last = 0;
+  changes->count = 0;
+  assert(lbtree_pd_changes(changes->from->tree, changes->to->tree,
+                           &changes_action, changes) == 0);
+  assert(changes->count == expected);
+
+  if (expected != 0) {
+    changes->stop = everand(expected - 1) + 1;
+    changes->last = 0;
+    changes->count = 0;
+    assert(lbtree_pd_changes(changes->from->tree, changes->to->tree,
+                             &changes_action, changes) == changes);
+    assert(changes->count == changes->stop);
+  }
+}
+
+void lbtree_pd_test_snapshots(struct tree_test_config *config) {
+  size_t size = config->max_size;
+  void **nodes = lbtree_pd_test_nodes_new(size, config->max_key_size);
+  size_t *first = tree_test_keys(nodes, config, TREE_TEST_FILL_RAND);
+
+  struct changes changes = {.first = first};
+
+  struct version versions[VERSION_COUNT];
+  size_t i;
+  for (i = 0; i < VERSION_COUNT; ++i) {
+    versions[i].tree = 0;
+    versions[i].expected = calloc(size, sizeof(*versions[i].expected));
+    assert(versions[i].expected != 0);
+  }
+
+  unsigned int step;
+  for (step = 0; step < TREE_TEST_STEP_COUNT; ++step) {
+    struct version *version = &versions[everand(VERSION_COUNT - 1)];
+    size_t op = everand(15);
+    if (op == 0) {
+      /* replace another version with a snapshot of this one */
+      struct version *other = &versions[everand(VERSION_COUNT - 1)];
+      if (other != version) {
+        lbtree_pd_release(other->tree);
+        other->tree = lbtree_pd_snapshot(version->tree);
+        memcpy(other->expected, version->expected,
+               size * sizeof(*other->expected));
+      }
+    } else if (op == 1) {
+      lbtree_pd_release(version->tree);
+      version->tree = 0;
+      memset(version->expected, 0, size * sizeof(*version->expected));
+    } else {
+      struct tree_test *tt = nodes[everand(size - 1)];
+      struct tree_test **expected = &version->expected[first[tt->id]];
+      if (op < 10) {
+        assert(lbtree_pdc_add(&version->tree, tt->key.buf, tt->key.size,
+                              tt) == *expected);
+        *expected = tt;
+      } else {
+        assert(lbtree_pdc_rm(&version->tree, tt->key.buf, tt->key.size) ==
+               *expected);
+        *expected = 0;
+      }
+    }
+
+    for (i = 0; i < VERSION_COUNT; ++i) {
+      version_check(&versions[i], nodes, first, size);
+    }
+    changes.from = &versions[everand(VERSION_COUNT - 1)];
+    changes.to = &versions[everand(VERSION_COUNT - 1)];
+    changes_check(&changes, size);
+  }
+
+  for (i = 0; i < VERSION_COUNT; ++i) {
+    lbtree_pd_release(versions[i].tree);
+    free(versions[i].expected);
+  }
+  free(first);
+  lbtree_pd_test_nodes_del(nodes);
+}
@@ -0,0 +1,128 @@
+/* Copyright 2023 Julian Ingram
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "lbtree_str_test.h"
+
+#include "../lbtree_str.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#define NODE_ALIGN (16)
+
+/* The test keys are arbitrary bytes, each is encoded as two characters so that
+  the string has no embedded terminator and different keys give different
+  strings */
+struct lbtree_str_test {
+  struct lbtree_str base;
+  char *str;
+  struct tree_test tt;
+};
+
+static void encode(char *str, struct tree_test_key *key) {
+  size_t i;
+  for (i = 0; i < key->size; ++i) {
+    *str++ = 'a' + (key->buf[i] & 0xf);
+    *str++ = 'a' + (key->buf[i] >> 4);
+  }
+  *str = 0;
+}
+
+static struct tree_test *lbtree_str_test_node_tt(void *node) {
+  return &((struct lbtree_str_test *)node)->tt;
+}
+
+static void **lbtree_str_test_nodes_new(size_t size, size_t key_size) {
+  size_t str_offset = sizeof(struct lbtree_str_test) + key_size;
+  size_t node_size = str_offset + (key_size * 2) + 1;
+  node_size += NODE_ALIGN - 1;
+  node_size -= node_size % NODE_ALIGN;
+  void **nodes =
+      malloc((node_size * size) + (sizeof(void *) * size) + NODE_ALIGN);
+  assert(nodes != 0);
+  unsigned char *base = (unsigned char *)(nodes + size);
+  base += NODE_ALIGN - (((uintptr_t)base) % NODE_ALIGN);
+
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    struct lbtree_str_test *node = (void *)(base + (node_size * i));
+    node->str = (char *)node + str_offset;
+    nodes[i] = node;
+  }
+  return nodes;
+}
+
+static void lbtree_str_test_nodes_del(void **nodes) { free(nodes); }
+
+static void *lbtree_str_test_init(void) { return 0; }
+
+static void *lbtree_str_test_add(void **tree, void *v_node) {
+  struct lbtree_str_test *node = v_node;
+  encode(node->str, &node->tt.key);
+  node->base.key = node->str;
+  return lbtree_str_add((struct lbtree_str **)tree, &node->base);
+}
+
+static void *lbtree_str_test_lookup(void *tree, struct tree_test *tt) {
+  char *str = malloc((tt->key.size * 2) + 1);
+  assert(str != 0);
+  encode(str, &tt->key);
+  void *node = lbtree_str(tree, str);
+  free(str);
+  return node;
+}
+
+static void lbtree_str_test_rm(void **tree, void *v_node) {
+  struct lbtree_str_test *node = v_node;
+  /* exercise both ways of removing */
+  if ((node->tt.id & 1) == 0) {
+    lbtree_str_rm((struct lbtree_str **)tree, &node->base);
+  } else {
+    void *rm = lbtree_str_rm_key((struct lbtree_str **)tree, node->str);
+    assert(rm == node);
+  }
+}
+
+struct walk_closure {
+  void *(*action)(const void *key, void **val, void *closure);
+  void *closure;
+};
+
+static void *walk_action(void *node, void *closure) {
+  struct walk_closure *walk_closure = closure;
+  return walk_closure->action(node, &node, walk_closure->closure);
+}
+
+static void *lbtree_str_test_walk(void *tree,
+                                  void *(*action)(const void *key, void **val,
+                                                  void *closure),
+                                  void *closure) {
+  struct walk_closure walk_closure = {.action = action, .closure = closure};
+  return lbtree_str_walk(tree, &walk_action, &walk_closure);
+}
+
+static void lbtree_str_test_del(void *tree) { (void)tree; }
+
+const struct tree_test_iface lbtree_str_test_iface = {
+    .node_tt = &lbtree_str_test_node_tt,
+    .nodes_new = &lbtree_str_test_nodes_new,
+    .nodes_del = &lbtree_str_test_nodes_del,
+    .init = &lbtree_str_test_init,
+    .add = &lbtree_str_test_add,
+    .lookup = &lbtree_str_test_lookup,
+    .rm = &lbtree_str_test_rm,
+    .walk = &lbtree_str_test_walk,
+    .del = &lbtree_str_test_del};
@@ -23,6 +23,8 @@
 
 struct lbtree_test {
   struct lbtree base;
+  /* only kept by the trees with parent refs */
+  struct lbtree_up up;
   struct tree_test tt;
 };
 
@@ -59,6 +61,35 @@ static unsigned int sel_node(void *v_node, lbtree_index_t index) {
 
 static void *lbtree_test_init(void) { return 0; }
 
+/* Returns zero if the keys of `a` and `b` match, otherwise sets `index` to that
+  of the first bit in which they differ */
+static int key_diff(struct lbtree_test *a, struct lbtree_test *b,
+                    lbtree_index_t *index) {
+  unsigned char *ka = (unsigned char *)&a->tt.key;
+  unsigned char *kb = (unsigned char *)&b->tt.key;
+  size_t size = a->tt.key.size + sizeof(a->tt.key.size);
+  lbtree_index_t i = 0;
+  while ((i < size) && (*ka == *kb)) {
+    ++ka;
+    ++kb;
+    ++i;
+  }
+  if (i == size) {
+    return 0;
+  }
+  unsigned char da = *ka;
+  unsigned char db = *kb;
+  i *= CHAR_BIT;
+  i += CHAR_BIT;
+  while (da != db) {
+    da <<= 1;
+    db <<= 1;
+    --i;
+  }
+  *index = i;
+  return 1;
+}
+
 static void *lbtree_test_add(void **v_tree, void *v_node) {
   struct lbtree **tree = (struct lbtree **)v_tree;
   struct lbtree_test *node = v_node;
@@ -70,28 +101,11 @@ static void *lbtree_test_add(void **v_tree, void *v_node) {
 
   struct lbtree_test *match =
       (struct lbtree_test *)lbtree(*tree, &sel_key, &node->tt.key);
-  unsigned char *ka = (unsigned char *)&node->tt.key;
-  unsigned char *kb = (unsigned char *)&match->tt.key;
-  size_t size = node->tt.key.size + sizeof(node->tt.key.size);
-  lbtree_index_t index = 0;
-  while ((index < size) && (*ka == *kb)) {
-    ++ka;
-    ++kb;
-    ++index;
-  }
-  if (index == size) {
+  lbtree_index_t index;
+  if (key_diff(node, match, &index) == 0) {
     lbtree_repl(tree, &sel_node, &match->base, &node->base);
     return match;
   }
-  unsigned char da = *ka;
-  unsigned char db = *kb;
-  index *= CHAR_BIT;
-  index += CHAR_BIT;
-  while (da != db) {
-    da <<= 1;
-    db <<= 1;
-    --index;
-  }
   node->base.index = index;
   lbtree_add(tree, &sel_node, &node->base);
   return 0;
@@ -143,3 +157,74 @@ const struct tree_test_iface lbtree_test_iface = {
     .rm = &lbtree_test_rm,
     .walk = &lbtree_test_walk,
     .del = &lbtree_test_del};
+
+static struct lbtree_up *up(void *v_node) {
+  struct lbtree_test *node = v_node;
+  return &node->up;
+}
+
+/* Checks the parent refs of every node below `tree`, whose branch is a child of
+  `parent` */
+static void up_check(struct lbtree *tree, struct lbtree *parent) {
+  assert(up(tree)->branch == parent);
+  unsigned int i;
+  for (i = 0; i < LBTREE_LUT_SIZE; ++i) {
+    struct lbtree *child = tree->children[i];
+    if (sel_node(child, tree->index) != i) {
+      continue;
+    }
+    if (lbtree_index_gt(child->index, tree->index) != 0) {
+      up_check(child, tree);
+    } else if (up(child)->leaf != tree) {
+      /* a node with no branch, whose key is its only child */
+      assert(up(child)->leaf == child);
+      assert(up(child)->branch == tree);
+    }
+  }
+}
+
+static void *lbtree_up_test_add(void **v_tree, void *v_node) {
+  struct lbtree **tree = (struct lbtree **)v_tree;
+  struct lbtree_test *node = v_node;
+  if (*tree == 0) {
+    lbtree_up_init(&node->base, &up);
+    *tree = &node->base;
+    return 0;
+  }
+
+  struct lbtree_test *match =
+      (struct lbtree_test *)lbtree(*tree, &sel_key, &node->tt.key);
+  void *r = 0;
+  lbtree_index_t index;
+  if (key_diff(node, match, &index) == 0) {
+    lbtree_up_repl(tree, &sel_node, &up, &match->base, &node->base);
+    r = match;
+  } else {
+    node->base.index = index;
+    lbtree_up_add(tree, &sel_node, &up, &node->base);
+  }
+  if ((node->tt.id % 64) == 0) {
+    up_check(*tree, 0);
+  }
+  return r;
+}
+
+static void lbtree_up_test_rm(void **v_tree, void *v_node) {
+  struct lbtree **tree = (struct lbtree **)v_tree;
+  struct lbtree_test *node = v_node;
+  lbtree_up_rm(tree, &sel_node, &up, &node->base);
+  if ((*tree != 0) && ((node->tt.id % 64) == 0)) {
+    up_check(*tree, 0);
+  }
+}
+
+const struct tree_test_iface lbtree_up_test_iface = {
+    .node_tt = &lbtree_test_node_tt,
+    .nodes_new = &lbtree_test_nodes_new,
+    .nodes_del = &lbtree_test_nodes_del,
+    .init = &lbtree_test_init,
+    .add = &lbtree_up_test_add,
+    .lookup = &lbtree_test_lookup,
+    .rm = &lbtree_up_test_rm,
+    .walk = &lbtree_test_walk,
+    .del = &lbtree_test_del};
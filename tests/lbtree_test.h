@@ -19,5 +19,6 @@
 #include "tree_test.h"
 
 extern const struct tree_test_iface lbtree_test_iface;
+extern const struct tree_test_iface lbtree_up_test_iface;
 
 #endif
@@ -15,6 +15,16 @@
 
 #include "./everand/everand.h"
 #include "lbtree_d_test.h"
+#include "lbtree_de_test.h"
+#include "lbtree_dh_test.h"
+#include "lbtree_dt_test.h"
+#include "lbtree_dw_test.h"
+#include "lbtree_dx_test.h"
+#include "lbtree_int_test.h"
+#include "lbtree_da_test.h"
+#include "lbtree_par_test.h"
+#include "lbtree_pd_test.h"
+#include "lbtree_str_test.h"
 #include "lbtree_test.h"
 #include "tsearch_test.h"
 
@@ -22,6 +32,20 @@
 
 #define SEED (16)
 #define TEST_COUNT (32)
+#define SNAPSHOT_TEST_COUNT (8)
+#define RM_PREFIX_TEST_COUNT (8)
+#define SET_OPS_TEST_COUNT (64)
+#define SPLIT_TEST_COUNT (64)
+#define PAR_TEST_COUNT (8)
+#define DW_TEST_COUNT (4)
+#define UPSERT_TEST_COUNT (8)
+#define DEEP_TEST_COUNT (8)
+#define FINGER_TEST_COUNT (8)
+#define ORDER_TEST_COUNT (64)
+#define BATCH_TEST_COUNT (64)
+#define COUNT_TEST_COUNT (64)
+#define EVICT_TEST_COUNT (64)
+#define EXPIRE_TEST_COUNT (64)
 
 void test_multiple(const struct tree_test_iface *iface,
                    struct tree_test_config *config, unsigned int test_count) {
@@ -51,11 +75,127 @@ int main(int argc, char *argv[]) {
       .max_size = 4096, .min_key_size = 0, .max_key_size = 8, .sort = 0};
 
   test_multiple(&lbtree_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_up_test_iface, &config, TEST_COUNT);
   test_multiple(&lbtree_d_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_da_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_da_compact_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_de_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_dh_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_dh_collide_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_dt_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_dt_lazy_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_dx_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_pd_test_iface, &config, TEST_COUNT);
+  test_multiple(&lbtree_str_test_iface, &config, TEST_COUNT);
   test_multiple(&tsearch_test_iface, &config, TEST_COUNT);
 
   test_walk_multiple(&lbtree_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_up_test_iface, &config, TEST_COUNT);
   test_walk_multiple(&lbtree_d_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_da_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_da_compact_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_de_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_dh_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_dh_collide_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_dt_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_dt_lazy_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_dx_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_pd_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_d_par_test_iface, &config, TEST_COUNT);
+  test_walk_multiple(&lbtree_str_test_iface, &config, TEST_COUNT);
+
+  struct tree_test_config u32_config = {
+      .max_size = 4096, .min_key_size = 4, .max_key_size = 4, .sort = 0};
+  struct tree_test_config u64_config = {
+      .max_size = 4096, .min_key_size = 8, .max_key_size = 8, .sort = 0};
+  test_multiple(&lbtree_u32_test_iface, &u32_config, TEST_COUNT);
+  test_multiple(&lbtree_u64_test_iface, &u64_config, TEST_COUNT);
+  test_walk_multiple(&lbtree_u32_test_iface, &u32_config, TEST_COUNT);
+  test_walk_multiple(&lbtree_u64_test_iface, &u64_config, TEST_COUNT);
+#ifdef LBTREE_U128
+  struct tree_test_config u128_config = {
+      .max_size = 4096, .min_key_size = 16, .max_key_size = 16, .sort = 0};
+  test_multiple(&lbtree_u128_test_iface, &u128_config, TEST_COUNT);
+  test_walk_multiple(&lbtree_u128_test_iface, &u128_config, TEST_COUNT);
+#endif
+
+  struct tree_test_config snapshot_config = {
+      .max_size = 256, .min_key_size = 0, .max_key_size = 4, .sort = 0};
+  everand_seed(SEED);
+  unsigned int i;
+  for (i = 0; i < SNAPSHOT_TEST_COUNT; ++i) {
+    lbtree_pd_test_snapshots(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < RM_PREFIX_TEST_COUNT; ++i) {
+    lbtree_d_test_rm_prefix(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < SET_OPS_TEST_COUNT; ++i) {
+    lbtree_d_test_set_ops(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < SPLIT_TEST_COUNT; ++i) {
+    lbtree_d_test_split(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < UPSERT_TEST_COUNT; ++i) {
+    lbtree_d_test_upsert(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < ORDER_TEST_COUNT; ++i) {
+    lbtree_d_test_order(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < BATCH_TEST_COUNT; ++i) {
+    lbtree_d_test_add_batch(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < COUNT_TEST_COUNT; ++i) {
+    lbtree_d_test_count(&snapshot_config);
+  }
+
+  lbtree_dt_test_release();
+  lbtree_de_test_clock();
+  everand_seed(SEED);
+  for (i = 0; i < EVICT_TEST_COUNT; ++i) {
+    lbtree_de_test_evict(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < EXPIRE_TEST_COUNT; ++i) {
+    lbtree_dx_test_expire(&snapshot_config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < DEEP_TEST_COUNT; ++i) {
+    lbtree_d_test_deep();
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < FINGER_TEST_COUNT; ++i) {
+    lbtree_d_test_finger(&config);
+  }
+
+  everand_seed(SEED);
+  for (i = 0; i < DW_TEST_COUNT; ++i) {
+    lbtree_dw_test_recovery(&snapshot_config);
+  }
+
+  /* large enough that the deepest branches are walked by a single thread */
+  struct tree_test_config par_config = {
+      .max_size = 131072, .min_key_size = 0, .max_key_size = 8, .sort = 0};
+  everand_seed(SEED);
+  for (i = 0; i < PAR_TEST_COUNT; ++i) {
+    lbtree_par_test_reduce(&par_config);
+  }
 
   return 0;
 }
@@ -18,6 +18,7 @@
 #include "everand/everand.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <string.h>
 
 static void tree_test_rand_node(struct tree_test *tt, size_t min_key_size,
@@ -199,3 +200,54 @@ void tree_test_walk(const struct tree_test_iface *iface,
   iface->del(tree);
   iface->nodes_del(nodes);
 }
+
+size_t *tree_test_keys(void **nodes, struct tree_test_config *config,
+                       enum tree_test_fill fill) {
+  size_t size = config->max_size;
+  size_t *first = malloc(size * sizeof(*first));
+  assert(first != 0);
+
+  size_t n = 0;
+  size_t i;
+  size_t j;
+  for (i = 0; i < size; ++i) {
+    struct tree_test *tt = nodes[i];
+    tt->id = i;
+    tt->key.size = everand(config->max_key_size - config->min_key_size) +
+                   config->min_key_size;
+    switch (fill) {
+    case TREE_TEST_FILL_RAND:
+      everand_arr(tt->key.buf, tt->key.size);
+      break;
+    case TREE_TEST_FILL_FEW:
+      for (j = 0; j < tt->key.size; ++j) {
+        tt->key.buf[j] = (unsigned char)(everand(7) * 33);
+      }
+      break;
+    case TREE_TEST_FILL_COUNT:
+      n += everand(3);
+      for (j = 0; j < tt->key.size; ++j) {
+        tt->key.buf[j] =
+            (unsigned char)(n >> ((tt->key.size - j - 1) * CHAR_BIT));
+      }
+      break;
+    }
+    first[i] = i;
+    for (j = 0; j < i; ++j) {
+      struct tree_test *other = nodes[j];
+      if ((other->key.size == tt->key.size) &&
+          (memcmp(other->key.buf, tt->key.buf, tt->key.size) == 0)) {
+        first[i] = j;
+        break;
+      }
+    }
+  }
+  return first;
+}
+
+void *tree_test_count_action(const void *key, void **val, void *closure) {
+  (void)key;
+  (void)val;
+  ++*(size_t *)closure;
+  return 0;
+}
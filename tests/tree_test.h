@@ -18,6 +18,9 @@
 
 #include <stdlib.h>
 
+/* steps taken by the randomised tests that check a tree against a model */
+#define TREE_TEST_STEP_COUNT (4096)
+
 struct tree_test_key {
   size_t size;
   unsigned char buf[];
@@ -58,4 +61,24 @@ void tree_test(const struct tree_test_iface *iface,
                struct tree_test_config *config);
 void tree_test_walk(const struct tree_test_iface *iface,
                     struct tree_test_config *config);
+
+/* ways for `tree_test_keys` to fill the bytes of keys */
+enum tree_test_fill {
+  TREE_TEST_FILL_RAND,
+  /* few byte values, so that keys share long prefixes */
+  TREE_TEST_FILL_FEW,
+  /* big endian counts with small gaps, so that consecutive keys share their
+    first bits */
+  TREE_TEST_FILL_COUNT
+};
+
+/* Gives each of the `config->max_size` nodes in `nodes`, which must each be a
+  `struct tree_test`, its index as its id and a key of random size filled as
+  `fill` says. Returns the index of the first node with a matching key for each
+  node, in an array to be freed with `free`. */
+size_t *tree_test_keys(void **nodes, struct tree_test_config *config,
+                       enum tree_test_fill fill);
+
+/* walk action that counts the pairs walked in the `size_t` at `closure` */
+void *tree_test_count_action(const void *key, void **val, void *closure);
 #endif